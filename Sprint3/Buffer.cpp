@@ -1,6 +1,18 @@
 #include "Buffer.h"
+#include "Defragmenter.h"
+#include "DeletionQueue.h"
 #include <string.h>
 
+static memoryCategory_t TranslateCategory( bufferUsageFlags_t usage ) {
+	if ( ( usage & BUFFER_USAGE_VERTEX_BUFFER ) != 0 ) {
+		return MEMORY_CATEGORY_VERTEX;
+	}
+	if ( ( usage & BUFFER_USAGE_INDEX_BUFFER ) != 0 ) {
+		return MEMORY_CATEGORY_INDEX;
+	}
+	return MEMORY_CATEGORY_UNIFORM;
+}
+
 static VkBufferUsageFlags TranslateUsage( bufferUsageFlags_t usage ) {
 	VkBufferUsageFlags result = 0;
 	if ( ( usage & BUFFER_USAGE_UNIFORM_BUFFER ) != 0 ) {
@@ -12,12 +24,38 @@ static VkBufferUsageFlags TranslateUsage( bufferUsageFlags_t usage ) {
 	if ( ( usage & BUFFER_USAGE_INDEX_BUFFER ) != 0 ) {
 		result |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
 	}
+	// Buffers may be moved by the defragmenter, which copies them on the GPU.
+	result |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	result |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
 	return result;
 }
 
+// Where the contents are read once uploaded.  The defragmenter may copy the buffer as soon as its upload is staged, so transfer reads
+// are covered too.
+static void GetReadStagesAndAccess( bufferUsageFlags_t usage, VkPipelineStageFlags & stages, VkAccessFlags & access ) {
+	stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	access = VK_ACCESS_TRANSFER_READ_BIT;
+	if ( ( usage & BUFFER_USAGE_UNIFORM_BUFFER ) != 0 ) {
+		stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		access |= VK_ACCESS_UNIFORM_READ_BIT;
+	}
+	if ( ( usage & BUFFER_USAGE_VERTEX_BUFFER ) != 0 ) {
+		stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	}
+	if ( ( usage & BUFFER_USAGE_INDEX_BUFFER ) != 0 ) {
+		stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		access |= VK_ACCESS_INDEX_READ_BIT;
+	}
+}
+
 Buffer * Buffer::Create( const void * data, uint32_t dataSize, bufferUsageFlags_t usage ) {
 	Buffer * result = new Buffer;
+	result->m_size = dataSize;
+	result->m_usage = usage;
+	result->m_regionSize = dataSize;
+	result->m_regionStride = dataSize;
 
 	// This is basically the same thing that we did in Sprint 2 for the vertex and index buffers in Mesh::Create,
 	// just generalized for different usages.
@@ -29,15 +67,102 @@ Buffer * Buffer::Create( const void * data, uint32_t dataSize, bufferUsageFlags_
 
 	VkMemoryRequirements memReq;
 	vkGetBufferMemoryRequirements( renderObjects.device, result->m_buffer, &memReq );
-	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE, result->m_memory );
+	const bool hostWrite = ( usage & BUFFER_USAGE_HOST_WRITE ) != 0;
+	AllocateDeviceMemory( memReq, hostWrite == true ? MEMORY_MAPPABLE : MEMORY_DEVICE_MAPPABLE, TranslateCategory( usage ), result->m_memory );
+	VK_CHECK( vkBindBufferMemory( renderObjects.device, result->m_buffer, result->m_memory.memory, result->m_memory.offset ) );
+
+	if ( data != NULL ) {
+		if ( result->m_memory.mappedData != NULL ) {
+			// The memory block is persistently mapped by the allocator, so there's no map/unmap here.  Device local memory that's
+			// mapped is written the same way, which skips the staging copy.
+			memcpy( result->m_memory.mappedData, data, dataSize );
+		} else {
+			VkPipelineStageFlags stages;
+			VkAccessFlags access;
+			GetReadStagesAndAccess( usage, stages, access );
+			result->m_uploadHandle = StageBufferData( data, dataSize, result->m_buffer, stages, access );
+		}
+	}
+
+	RegisterForDefragmentation( result );
+	return result;
+}
+
+uint32_t AlignUniformBufferOffset( uint32_t offset ) {
+	const uint32_t alignment = ( uint32_t )renderObjects.physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+	return ( offset + alignment - 1 ) / alignment * alignment;
+}
+
+Buffer * Buffer::CreateDynamic( const void * data, uint32_t dataSize, bufferUsageFlags_t usage ) {
+	Buffer * result = new Buffer;
+	result->m_regionSize = dataSize;
+	result->m_regionStride = AlignUniformBufferOffset( dataSize );
+	result->m_regionCount = FRAMES_IN_FLIGHT;
+	result->m_size = result->m_regionStride * FRAMES_IN_FLIGHT;
+	result->m_usage = usage;
+
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = TranslateUsage( usage );
+	bufferCreateInfo.size = result->m_size;
+	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &result->m_buffer ) );
+
+	// With resizable BAR or unified memory, the GPU reads it from device local memory, which the CPU can still write.
+	VkMemoryRequirements memReq;
+	vkGetBufferMemoryRequirements( renderObjects.device, result->m_buffer, &memReq );
+	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE | MEMORY_DEVICE_MAPPABLE, TranslateCategory( usage ), result->m_memory );
 	VK_CHECK( vkBindBufferMemory( renderObjects.device, result->m_buffer, result->m_memory.memory, result->m_memory.offset ) );
 
 	if ( data != NULL ) {
-		void * mem;
-		VK_CHECK( vkMapMemory( renderObjects.device, result->m_memory.memory, result->m_memory.offset, dataSize, 0, &mem ) );
-		memcpy( mem, data, dataSize );
-		vkUnmapMemory( renderObjects.device, result->m_memory.memory );
+		for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+			memcpy( ( uint8_t * )result->m_memory.mappedData + i * result->m_regionStride, data, dataSize );
+		}
 	}
 
+	RegisterForDefragmentation( result );
 	return result;
+}
+
+void Buffer::Update( const void * data, uint32_t size, uint32_t offset ) {
+	assert( IsDynamic() == true );
+	assert( offset + size <= m_regionSize );
+	// The fence of the last frame to use this region has been waited on, so the GPU is done with it.
+	memcpy( ( uint8_t * )m_memory.mappedData + GetCurrentOffset() + offset, data, size );
+}
+
+void Buffer::Destroy( Buffer * buffer ) {
+	UnregisterFromDefragmentation( buffer );
+	CancelPendingUploads( buffer->m_buffer );
+	DeferDestroyBuffer( buffer->m_buffer );
+	DeferFreeDeviceMemory( buffer->m_memory );
+	delete buffer;
+}
+
+bool Buffer::Relocate( VkCommandBuffer commandBuffer, VkBuffer & retiredBuffer, allocation_t & retiredMemory ) {
+	assert( IsRelocatable() == true );
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = TranslateUsage( m_usage );
+	bufferCreateInfo.size = m_size;
+	VkBuffer buffer;
+	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &buffer ) );
+
+	VkMemoryRequirements memReq;
+	vkGetBufferMemoryRequirements( renderObjects.device, buffer, &memReq );
+	allocation_t memory;
+	if ( ReallocateDeviceMemory( memReq, m_memory, memory ) == false ) {
+		vkDestroyBuffer( renderObjects.device, buffer, NULL );
+		return false;
+	}
+	VK_CHECK( vkBindBufferMemory( renderObjects.device, buffer, memory.memory, memory.offset ) );
+
+	VkBufferCopy region = {};
+	region.size = m_size;
+	vkCmdCopyBuffer( commandBuffer, m_buffer, buffer, 1, &region );
+
+	retiredBuffer = m_buffer;
+	retiredMemory = m_memory;
+	m_buffer = buffer;
+	m_memory = memory;
+	return true;
 }
\ No newline at end of file
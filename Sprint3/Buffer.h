@@ -7,19 +7,57 @@ enum bufferUsageFlags_t {
 	BUFFER_USAGE_UNIFORM_BUFFER = BIT( 0 ),
 	BUFFER_USAGE_VERTEX_BUFFER = BIT( 1 ),
 	BUFFER_USAGE_INDEX_BUFFER = BIT( 2 ),
+	// The CPU rewrites the contents through GetMemory().mappedData, so the buffer stays in host visible memory.  Without it, buffers are
+	// device local, which is much faster for the GPU to read on discrete cards.  They're filled through the staging ring, or written in
+	// place when renderObjects.deviceLocalMappable.
+	BUFFER_USAGE_HOST_WRITE = BIT( 3 ),
 };
 inline bufferUsageFlags_t operator |( bufferUsageFlags_t left, bufferUsageFlags_t right ) {
 	return ( bufferUsageFlags_t )( ( int )left | ( int )right );
 }
 
+// Uniform buffer offsets, including dynamic ones, have to be a multiple of the device's alignment, so constants for many draws laid out
+// in one buffer are spaced by this rounded up size.
+uint32_t AlignUniformBufferOffset( uint32_t offset );
+
 class Buffer {
 public:
+	// Device local buffers can't be used until their upload is staged, which for large ones may be a few frames from now.  The data
+	// is only read during the call either way.
 	static Buffer * Create( const void * data, uint32_t dataSize, bufferUsageFlags_t usage );
+	// Dynamic buffers have a region per frame in flight, in persistently mapped memory, so the CPU can rewrite the contents every frame
+	// without waiting on the GPU.  Update writes the region of the frame being recorded, and descriptor sets and draws pick that region
+	// when they're bound.  Regions don't carry over from frame to frame, so whatever a frame reads has to be written during it.  The
+	// data, if any, fills every region.
+	static Buffer * CreateDynamic( const void * data, uint32_t dataSize, bufferUsageFlags_t usage );
+	// The Vulkan objects are released once no frame in flight can be using them.  The pointer is invalid immediately.
+	static void Destroy( Buffer * buffer );
 	VkBuffer GetBuffer() const { return m_buffer; }
+	bool IsDynamic() const { return m_regionCount > 1; }
+	// What one frame sees, which is the whole buffer unless it's dynamic.
+	uint32_t GetRegionSize() const { return m_regionSize; }
+	// Where the current frame's region starts, for binding.
+	uint32_t GetCurrentOffset() const { return IsDynamic() == true ? renderObjects.frameIndex * m_regionStride : 0; }
+	// Write into the current frame's region.  Only for dynamic buffers.
+	void Update( const void * data, uint32_t size, uint32_t offset = 0 );
+	const allocation_t & GetMemory() const { return m_memory; }
+	bool IsUploadStaged() const { return GetUploadStatus( m_uploadHandle ) != UPLOAD_PENDING; }
+	// The upload has to be staged first, or its remaining copies would go to the old buffer.  Buffers the CPU writes, dynamic or
+	// BUFFER_USAGE_HOST_WRITE, may be written after the copy is recorded, which the copy would then overwrite, so they stay put.
+	bool IsRelocatable() const { return IsUploadStaged() == true && IsDynamic() == false && ( m_usage & BUFFER_USAGE_HOST_WRITE ) == 0; }
+	// Move the contents into a new buffer in a fuller memory block with a GPU copy.  The old buffer and memory are handed back in
+	// retired, and must be kept alive until the GPU can no longer be using them.  Returns false if there was nowhere to move to.
+	bool Relocate( VkCommandBuffer commandBuffer, VkBuffer & retiredBuffer, allocation_t & retiredMemory );
 
 private:
 	VkBuffer m_buffer = VK_NULL_HANDLE;
 	allocation_t m_memory = {};
+	uint32_t m_size = 0;
+	bufferUsageFlags_t m_usage = {};
+	uploadHandle_t m_uploadHandle = 0;
+	uint32_t m_regionSize = 0;
+	uint32_t m_regionStride = 0;	// Aligned for use as a uniform buffer offset
+	uint32_t m_regionCount = 1;
 
 private:
 	Buffer() = default;
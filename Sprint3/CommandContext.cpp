@@ -3,6 +3,9 @@
 #include "ShaderProgram.h"
 #include "DescriptorSet.h"
 #include "Buffer.h"
+#include "TransientAllocator.h"
+#include "DeletionQueue.h"
+#include "TextureStreaming.h"
 #include <vector>
 
 struct framebufferDescription_t {
@@ -55,9 +58,10 @@ static VkRenderPass CreateRenderPass( const renderPassDescription_t & descriptio
 		// so it's paramount that the image is ALREADY in the correct layout before setting it as a render target.
 		attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		attachmentDescription.format = TranslateFormat( description.color->GetFormat() );
+		attachmentDescription.format = TranslateFormat( description.colorFormat );
 		attachmentDescription.loadOp = newDesc.clearColor ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
-		attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		// Not storing transient attachments is what lets a tiler keep them on chip, so they never need real memory.
+		attachmentDescription.storeOp = description.colorTransient == true ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 		attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -71,11 +75,21 @@ static VkRenderPass CreateRenderPass( const renderPassDescription_t & descriptio
 		// See the comment for initialLayout and finalLayout for color images above.
 		attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 		attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		attachmentDescription.format = TranslateFormat( description.depth->GetFormat() );
+		attachmentDescription.format = TranslateFormat( description.depthFormat );
 		attachmentDescription.loadOp = newDesc.clearDepth ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
-		attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-		attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+		if ( description.depthTransient == true ) {
+			attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		} else {
+			attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+			attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+		}
+		// Clearing depth clears stencil too, to zero.  Formats without stencil ignore the stencil ops.
+		if ( newDesc.clearDepth == true && HasStencil( description.depthFormat ) == true ) {
+			attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		}
 		attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
 		VkAttachmentReference & attachmentReference = attachmentReferences[ newDesc.color != NULL ? 1 : 0 ];
 		attachmentReference.attachment = newDesc.color != NULL ? 1 : 0;
@@ -121,9 +135,34 @@ static VkFramebuffer CreateFramebuffer( const framebufferDescription_t & descrip
 	framebufferCreateInfo.pAttachments = attachments.data();
 	VK_CHECK( vkCreateFramebuffer( renderObjects.device, &framebufferCreateInfo, NULL, &newDesc.framebuffer ) );
 
+	createdFramebuffers.push_back( newDesc );	// Without this, every SetRenderTargets call made (and leaked) a new framebuffer
 	return newDesc.framebuffer;
 }
 
+void ReleaseFramebuffersUsingView( VkImageView view ) {
+	for ( size_t i = 0; i < createdFramebuffers.size(); ) {
+		if ( createdFramebuffers[ i ].colorView == view || createdFramebuffers[ i ].depthStencilView == view ) {
+			DeferDestroyFramebuffer( createdFramebuffers[ i ].framebuffer );
+			createdFramebuffers[ i ] = createdFramebuffers.back();
+			createdFramebuffers.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
+
+void ReleasePipelinesUsingShader( const ShaderProgram * shader ) {
+	for ( size_t i = 0; i < createdPipelines.size(); ) {
+		if ( createdPipelines[ i ].shader == shader ) {
+			DeferDestroyPipeline( createdPipelines[ i ].pipeline );
+			createdPipelines[ i ] = createdPipelines.back();
+			createdPipelines.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
+
 CommandContext * CommandContext::Create() {
 	CommandContext * result = new CommandContext;
 
@@ -152,15 +191,25 @@ void CommandContext::End() {
 	if ( m_inRenderPass == true ) {
 		vkCmdEndRenderPass( m_commandBuffer );
 	}
+	// The CPU reads the streaming and virtual texture feedback written during the frame once its fence has signaled.
+	EndTextureStreamingFrame( m_commandBuffer );
 	VK_CHECK( vkEndCommandBuffer( m_commandBuffer ) );
 }
 
 void CommandContext::SetRenderTargets( Image * colorTarget, Image * depthStencilTarget ) {
-	renderPassDescription_t renderPassDescription;
+	renderPassDescription_t renderPassDescription = {};
 	renderPassDescription.clearColor = false;
 	renderPassDescription.clearDepth = false;
 	renderPassDescription.color = colorTarget;
 	renderPassDescription.depth = depthStencilTarget;
+	if ( colorTarget != NULL ) {
+		renderPassDescription.colorFormat = colorTarget->GetFormat();
+		renderPassDescription.colorTransient = colorTarget->IsTransient();
+	}
+	if ( depthStencilTarget != NULL ) {
+		renderPassDescription.depthFormat = depthStencilTarget->GetFormat();
+		renderPassDescription.depthTransient = depthStencilTarget->IsTransient();
+	}
 	VkRenderPass renderPass = VK_NULL_HANDLE;
 	for ( size_t i = 0; i < createdPasses.size(); ++i ) {
 		if ( renderPassDescription == createdPasses[ i ] ) {
@@ -184,10 +233,10 @@ void CommandContext::SetRenderTargets( Image * colorTarget, Image * depthStencil
 		framebufferDescription.height = depthStencilTarget->GetHeight();
 	}
 	if ( colorTarget != NULL ) {
-		framebufferDescription.colorView = colorTarget->GetView();
+		framebufferDescription.colorView = colorTarget->GetAttachmentView();
 	}
 	if ( depthStencilTarget != NULL ) {
-		framebufferDescription.depthStencilView = depthStencilTarget->GetView();
+		framebufferDescription.depthStencilView = depthStencilTarget->GetAttachmentView();
 	}
 	VkFramebuffer framebuffer = VK_NULL_HANDLE;
 	for ( size_t i = 0; i < createdFramebuffers.size(); ++i ) {
@@ -338,7 +387,7 @@ static VkPipeline CreatePipeline( const pipelineDescription_t & pipelineState )
 	return description.pipeline;
 }
 
-void CommandContext::Draw( const Mesh * mesh, const ShaderProgram * shader ) {
+void CommandContext::BindPipelineState( const ShaderProgram * shader ) {
 	m_pipelineState.shader = shader;
 	VkPipeline pipeline = VK_NULL_HANDLE;
 	for ( size_t i = 0; i < createdPipelines.size(); ++i ) {
@@ -363,14 +412,28 @@ void CommandContext::Draw( const Mesh * mesh, const ShaderProgram * shader ) {
 	scissor.extent.width = m_viewportAndScissorWidth;
 	scissor.extent.height = m_viewportAndScissorHeight;
 	vkCmdSetScissor( m_commandBuffer, 0, 1, &scissor );
+}
+
+void CommandContext::Draw( const Mesh * mesh, const ShaderProgram * shader ) {
+	BindPipelineState( shader );
+	// Static geometry is device local, and has to be staged before it's drawn.
+	assert( mesh->GetVertexBuffer()->IsUploadStaged() == true && mesh->GetIndexBuffer()->IsUploadStaged() == true );
 	VkBuffer vertexBuffer = mesh->GetVertexBuffer()->GetBuffer();
-	VkDeviceSize offset = 0;
+	VkDeviceSize offset = mesh->GetVertexBuffer()->GetCurrentOffset();
 	vkCmdBindVertexBuffers( m_commandBuffer, 0, 1, &vertexBuffer, &offset );
 	VkBuffer indexBuffer = mesh->GetIndexBuffer()->GetBuffer();
-	vkCmdBindIndexBuffer( m_commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16 );
+	vkCmdBindIndexBuffer( m_commandBuffer, indexBuffer, mesh->GetIndexBuffer()->GetCurrentOffset(), VK_INDEX_TYPE_UINT16 );
 	vkCmdDrawIndexed( m_commandBuffer, mesh->GetIndexCount(), 1, 0, 0, 0 );
 }
 
+void CommandContext::Draw( const transientAllocation_t & vertices, const transientAllocation_t & indices, uint32_t indexCount, const ShaderProgram * shader ) {
+	BindPipelineState( shader );
+	VkDeviceSize offset = vertices.offset;
+	vkCmdBindVertexBuffers( m_commandBuffer, 0, 1, &vertices.buffer, &offset );
+	vkCmdBindIndexBuffer( m_commandBuffer, indices.buffer, indices.offset, VK_INDEX_TYPE_UINT16 );
+	vkCmdDrawIndexed( m_commandBuffer, indexCount, 1, 0, 0, 0 );
+}
+
 void CommandContext::Clear( bool doClearColor, bool doClearDepth, float clearR, float clearG, float clearB, float clearA, float clearDepth ) {
 	m_pipelineState.renderPassState.clearColor = doClearColor;
 	m_pipelineState.renderPassState.clearDepth = doClearDepth;
@@ -416,8 +479,24 @@ void CommandContext::Clear( bool doClearColor, bool doClearDepth, float clearR,
 }
 
 void CommandContext::BindDescriptorSet( const DescriptorSet * descriptorSet ) {
+	BindDescriptorSet( descriptorSet, NULL, 0 );
+}
+
+void CommandContext::BindDescriptorSet( const DescriptorSet * descriptorSet, const uint32_t * dynamicOffsets, uint32_t dynamicOffsetCount ) {
 	VkDescriptorSet set = descriptorSet->GetDescriptorSet();
-	vkCmdBindDescriptorSets( m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderObjects.unifiedPipelineLayout, descriptorSet->GetScope(), 1, &set, 0, NULL );
+	descriptorSet->MarkBound();
+	uint32_t offsets[ DESCRIPTOR_SET_MAX_SLOTS ];
+	const uint32_t offsetCount = descriptorSet->GetDynamicOffsets( offsets );
+	assert( dynamicOffsetCount <= offsetCount );
+	for ( uint32_t i = 0; i < dynamicOffsetCount; ++i ) {
+		assert( dynamicOffsets[ i ] == AlignUniformBufferOffset( dynamicOffsets[ i ] ) );
+		offsets[ i ] += dynamicOffsets[ i ];
+	}
+	vkCmdBindDescriptorSets( m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderObjects.unifiedPipelineLayout, descriptorSet->GetScope(), 1, &set, offsetCount, offsets );
+}
+
+void CommandContext::SetDrawConstants( const drawConstants_t & constants ) {
+	vkCmdPushConstants( m_commandBuffer, renderObjects.unifiedPipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof( constants ), &constants );
 }
 
 void CommandContext::EndRenderPass() {
@@ -492,9 +571,16 @@ void CommandContext::PipelineBarrier( Image * image, imageLayout_t newLayout, ba
 		// as well as a convenience.  Generally, attachments should be discarded the first time they're used in a frame.
 		// In addition, render passes won't do any of this for us, so before setting a render target, it should be transitioned
 		// to the proper attachment layout.
+		// The old contents don't matter, but with several frames in flight the last user of the image may still be running,
+		// so we still wait on whatever stage last touched it.
+		VkImageLayout discardedLayout;
+		TranslateImageLayout( image->GetLayout(), discardedLayout, barrier.srcAccessMask, srcPipelineStage );
+		if ( image->IsAliased() == true ) {
+			// The last user of the memory may have been any image of the alias group, in any layout, so wait for everything.
+			barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			srcPipelineStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		}
 		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		barrier.srcAccessMask = 0;
-		srcPipelineStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
 	} else {
 		if ( image->GetLayout() == newLayout ) {
 			return;	// Layouts that don't discard nor transition between two different layouts become a NOP.
@@ -6,6 +6,7 @@
 class Mesh;
 class ShaderProgram;
 class DescriptorSet;
+struct transientAllocation_t;
 
 struct renderPassDescription_t {
 	bool clearColor;
@@ -13,6 +14,11 @@ struct renderPassDescription_t {
 	VkRenderPass renderPass = VK_NULL_HANDLE;
 	const Image * color;
 	const Image * depth;
+	// Copied from the images, because cached descriptions outlive them.  Comparisons must never dereference color or depth.
+	imageFormat_t colorFormat;
+	imageFormat_t depthFormat;
+	bool colorTransient;
+	bool depthTransient;
 
 	bool operator ==( const renderPassDescription_t & other ) const {
 		if ( ( color == NULL ) != ( other.color == NULL ) ) {
@@ -28,12 +34,18 @@ struct renderPassDescription_t {
 			return false;
 		}
 		if ( color != NULL ) {
-			if ( color->GetFormat() != other.color->GetFormat() ) {
+			if ( colorFormat != other.colorFormat ) {
+				return false;
+			}
+			if ( colorTransient != other.colorTransient ) {
 				return false;
 			}
 		}
 		if ( depth != NULL ) {
-			if ( depth->GetFormat() != other.depth->GetFormat() ) {
+			if ( depthFormat != other.depthFormat ) {
+				return false;
+			}
+			if ( depthTransient != other.depthTransient ) {
 				return false;
 			}
 		}
@@ -71,6 +83,10 @@ inline barrierFlags_t operator |( barrierFlags_t left, barrierFlags_t right ) {
 	return ( barrierFlags_t )( ( int )left | ( int )right );
 }
 
+// Cached framebuffers and pipelines hold on to the views and shaders they were made with, so they're released along with them.
+void ReleaseFramebuffersUsingView( VkImageView view );
+void ReleasePipelinesUsingShader( const ShaderProgram * shader );
+
 class CommandContext {
 public:
 	static CommandContext * Create();
@@ -79,13 +95,24 @@ public:
 	void SetRenderTargets( Image * colorTarget, Image * depthStencilTarget );
 	void SetViewportAndScissor( uint32_t width, uint32_t height );
 	void Draw( const Mesh * mesh, const ShaderProgram * shader );
+	// Draw geometry written into the transient ring this frame.  Indices are 16-bit, like Mesh.
+	void Draw( const transientAllocation_t & vertices, const transientAllocation_t & indices, uint32_t indexCount, const ShaderProgram * shader );
 	void Clear( bool doClearColor, bool doClearDepth, float clearR, float clearG, float clearB, float clearA, float clearDepth );
 	void BindDescriptorSet( const DescriptorSet * descriptorSet );
+	// The offsets are added to the uniform buffer slots of the set, in slot order, on top of the current region of dynamic buffers.  Each
+	// has to be a multiple of AlignUniformBufferOffset's alignment.  Rebinding the same set with new offsets is all it takes to move to
+	// the next draw's constants.
+	void BindDescriptorSet( const DescriptorSet * descriptorSet, const uint32_t * dynamicOffsets, uint32_t dynamicOffsetCount );
+	// Per-draw data for the shaders' DrawConstants block.  It holds until it's set again, even across pipeline and descriptor set changes.
+	void SetDrawConstants( const drawConstants_t & constants );
 	void Blit( const Image * src, const Image * dst );
 	void PipelineBarrier( Image * image, imageLayout_t newLayout, barrierFlags_t flags );
 	void EndRenderPass();
 	VkCommandBuffer GetCommandBuffer() const { return m_commandBuffer; }
 
+private:
+	void BindPipelineState( const ShaderProgram * shader );
+
 private:
 	VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
 	pipelineDescription_t m_pipelineState = {};
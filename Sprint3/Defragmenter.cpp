@@ -0,0 +1,301 @@
+#include "Defragmenter.h"
+#include "Memory.h"
+#include "Buffer.h"
+#include "Image.h"
+#include "DescriptorSet.h"
+#include <vector>
+#include <algorithm>
+
+// The defragmenter works one block at a time: every resource in the sparsest block is copied into a fuller block of the same kind, and
+// once the last one has moved out, the empty block is released by FreeDeviceMemory.  Buffer and Image objects keep their identity, only
+// their Vulkan handles change, so anything that reads the handles while recording (like Mesh draws) picks up the move for free.
+// Descriptor sets bake the handles in, so those are rewritten.  Sets still in flight are replaced by new ones rather than written.
+
+// A resource that has been moved away from.  Its old handles stay alive until no submitted work can reference them.
+struct retiredResource_t {
+	const void *	owner;			// Cleared if the Buffer or Image is destroyed first.  The handles are still released on schedule
+	VkBuffer		buffer;
+	VkImage			image;
+	VkImageView		view;
+	allocation_t	memory;
+	uint64_t		retireFrame;	// The first frame at which the GPU is certainly done with the old handles
+};
+
+struct defragmenter_t {
+	std::vector< Buffer * >				buffers;
+	std::vector< Image * >				images;
+	std::vector< DescriptorSet * >		descriptorSets;
+	std::vector< DescriptorSet * >		staleDescriptorSets;	// Pointing at old handles and waiting for UpdateDefragmentation to rewrite them
+	std::vector< retiredResource_t >	retiredResources;
+	memoryBlock_t *						evacuatingBlock = NULL;
+	uint64_t							nextAttemptFrame = 0;
+	uint32_t							bytesPerFrame = 8 * 1024 * 1024;
+};
+
+// If a move fails because the other blocks are too fragmented, wait a while before trying again rather than thrashing every frame.
+static const uint64_t DEFRAGMENTATION_RETRY_FRAMES = 300;
+
+static defragmenter_t defragmenter;
+
+void RegisterForDefragmentation( Buffer * buffer ) {
+	defragmenter.buffers.push_back( buffer );
+}
+
+void RegisterForDefragmentation( Image * image ) {
+	// Evicted images stay registered, so their descriptor sets keep tracking them, and register again when they're reloaded.
+	if ( std::find( defragmenter.images.begin(), defragmenter.images.end(), image ) == defragmenter.images.end() ) {
+		defragmenter.images.push_back( image );
+	}
+}
+
+void RegisterForDefragmentation( DescriptorSet * descriptorSet ) {
+	defragmenter.descriptorSets.push_back( descriptorSet );
+}
+
+template< typename T >
+static void RemoveFromList( std::vector< T * > & list, const T * item ) {
+	typename std::vector< T * >::iterator it = std::find( list.begin(), list.end(), item );
+	if ( it != list.end() ) {
+		*it = list.back();
+		list.pop_back();
+	}
+}
+
+static void ForgetResource( const void * resource ) {
+	for ( size_t i = 0; i < defragmenter.descriptorSets.size(); ++i ) {
+		defragmenter.descriptorSets[ i ]->ForgetResource( resource );
+	}
+	for ( size_t i = 0; i < defragmenter.retiredResources.size(); ++i ) {
+		if ( defragmenter.retiredResources[ i ].owner == resource ) {
+			defragmenter.retiredResources[ i ].owner = NULL;
+		}
+	}
+}
+
+void UnregisterFromDefragmentation( Buffer * buffer ) {
+	RemoveFromList( defragmenter.buffers, buffer );
+	ForgetResource( buffer );
+}
+
+void UnregisterFromDefragmentation( Image * image ) {
+	RemoveFromList( defragmenter.images, image );
+	ForgetResource( image );
+}
+
+void UnregisterFromDefragmentation( DescriptorSet * descriptorSet ) {
+	RemoveFromList( defragmenter.descriptorSets, descriptorSet );
+	RemoveFromList( defragmenter.staleDescriptorSets, descriptorSet );
+}
+
+void SetDefragmentationBudget( uint32_t bytesPerFrame ) {
+	defragmenter.bytesPerFrame = bytesPerFrame;
+}
+
+static bool IsRetiring( const void * owner ) {
+	assert( owner != NULL );
+	for ( size_t i = 0; i < defragmenter.retiredResources.size(); ++i ) {
+		if ( defragmenter.retiredResources[ i ].owner == owner ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool IsReferencedByStaleSet( const void * owner ) {
+	if ( owner == NULL ) {
+		return false;
+	}
+	for ( size_t i = 0; i < defragmenter.staleDescriptorSets.size(); ++i ) {
+		if ( defragmenter.staleDescriptorSets[ i ]->References( owner ) == true ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void ReleaseRetiredResources() {
+	std::vector< retiredResource_t > & retired = defragmenter.retiredResources;
+	for ( size_t i = 0; i < retired.size(); ) {
+		if ( retired[ i ].retireFrame > renderObjects.frameNumber || IsReferencedByStaleSet( retired[ i ].owner ) == true ) {
+			++i;
+			continue;
+		}
+		if ( retired[ i ].buffer != VK_NULL_HANDLE ) {
+			vkDestroyBuffer( renderObjects.device, retired[ i ].buffer, NULL );
+		}
+		if ( retired[ i ].view != VK_NULL_HANDLE ) {
+			vkDestroyImageView( renderObjects.device, retired[ i ].view, NULL );
+		}
+		if ( retired[ i ].image != VK_NULL_HANDLE ) {
+			vkDestroyImage( renderObjects.device, retired[ i ].image, NULL );
+		}
+		FreeDeviceMemory( retired[ i ].memory );	// Releases the evacuated block along with its last allocation
+		retired[ i ] = retired.back();
+		retired.pop_back();
+	}
+}
+
+static void RefreshStaleDescriptorSets() {
+	std::vector< DescriptorSet * > & stale = defragmenter.staleDescriptorSets;
+	for ( size_t i = 0; i < stale.size(); ++i ) {
+		DescriptorSet * descriptorSet = stale[ i ];
+		descriptorSet->RefreshResources();
+		// The set may have been bound with the old handles as recently as this frame, so those have to outlive the frames in flight.
+		for ( size_t j = 0; j < defragmenter.retiredResources.size(); ++j ) {
+			retiredResource_t & retired = defragmenter.retiredResources[ j ];
+			if ( retired.owner != NULL && descriptorSet->References( retired.owner ) == true ) {
+				retired.retireFrame = std::max( retired.retireFrame, renderObjects.frameNumber + FRAMES_IN_FLIGHT );
+			}
+		}
+	}
+	stale.clear();
+}
+
+static void MarkReferencingSetsStale( const void * owner ) {
+	for ( size_t i = 0; i < defragmenter.descriptorSets.size(); ++i ) {
+		DescriptorSet * descriptorSet = defragmenter.descriptorSets[ i ];
+		if ( descriptorSet->References( owner ) == true ) {
+			if ( std::find( defragmenter.staleDescriptorSets.begin(), defragmenter.staleDescriptorSets.end(), descriptorSet ) == defragmenter.staleDescriptorSets.end() ) {
+				defragmenter.staleDescriptorSets.push_back( descriptorSet );
+			}
+		}
+	}
+}
+
+void RefreshDescriptorSetsReferencing( const void * resource ) {
+	MarkReferencingSetsStale( resource );
+}
+
+static void Retire( const void * owner, VkBuffer buffer, VkImage image, VkImageView view, const allocation_t & memory ) {
+	retiredResource_t retired = {};
+	retired.owner = owner;
+	retired.buffer = buffer;
+	retired.image = image;
+	retired.view = view;
+	retired.memory = memory;
+	retired.retireFrame = renderObjects.frameNumber + FRAMES_IN_FLIGHT;	// Earlier frames in flight recorded the old handles, and this frame's copy reads them
+	defragmenter.retiredResources.push_back( retired );
+	MarkReferencingSetsStale( owner );
+}
+
+void RetireImageStorage( const Image * image, VkImage oldImage, VkImageView oldView, const allocation_t & oldMemory ) {
+	Retire( image, VK_NULL_HANDLE, oldImage, oldView, oldMemory );
+}
+
+// A block can only be emptied if everything in it can move.  Render targets and images still uploading pin their block.
+static bool CanEvacuate( const memoryBlock_t * block ) {
+	for ( size_t i = 0; i < defragmenter.buffers.size(); ++i ) {
+		const Buffer * buffer = defragmenter.buffers[ i ];
+		if ( buffer->GetMemory().block == block && buffer->IsRelocatable() == false ) {
+			return false;
+		}
+	}
+	for ( size_t i = 0; i < defragmenter.images.size(); ++i ) {
+		const Image * image = defragmenter.images[ i ];
+		if ( image->GetMemory().block == block && image->IsRelocatable() == false ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static memoryBlock_t * SelectEvacuationBlock() {
+	std::vector< memoryBlock_t * > candidates;
+	GetDefragmentationCandidates( candidates );
+	for ( size_t i = 0; i < candidates.size(); ++i ) {
+		if ( CanEvacuate( candidates[ i ] ) == true ) {
+			return candidates[ i ];
+		}
+	}
+	return NULL;
+}
+
+// Move resources out of the evacuating block until the frame's budget is spent.  Returns false if a move failed.
+static bool EvacuateBlock( memoryBlock_t * block ) {
+	const VkCommandBuffer commandBuffer = stagingBuffer.graphicsCommandBuffer;	// Image copies need graphics stages in their barriers
+	uint64_t movedBytes = 0;
+	for ( size_t i = 0; i < defragmenter.buffers.size() && movedBytes < defragmenter.bytesPerFrame; ++i ) {
+		Buffer * buffer = defragmenter.buffers[ i ];
+		if ( buffer->GetMemory().block != block || IsRetiring( buffer ) == true ) {
+			continue;
+		}
+		if ( buffer->IsRelocatable() == false ) {
+			return false;	// Something pinned it since the block was selected
+		}
+		VkBuffer retiredBuffer;
+		allocation_t retiredMemory;
+		if ( buffer->Relocate( commandBuffer, retiredBuffer, retiredMemory ) == false ) {
+			return false;
+		}
+		movedBytes += retiredMemory.size;
+		Retire( buffer, retiredBuffer, VK_NULL_HANDLE, VK_NULL_HANDLE, retiredMemory );
+	}
+	for ( size_t i = 0; i < defragmenter.images.size() && movedBytes < defragmenter.bytesPerFrame; ++i ) {
+		Image * image = defragmenter.images[ i ];
+		if ( image->GetMemory().block != block || IsRetiring( image ) == true ) {
+			continue;
+		}
+		if ( image->IsRelocatable() == false ) {
+			return false;	// Something pinned it since the block was selected
+		}
+		VkImage retiredImage;
+		VkImageView retiredView;
+		allocation_t retiredMemory;
+		if ( image->Relocate( commandBuffer, retiredImage, retiredView, retiredMemory ) == false ) {
+			return false;
+		}
+		movedBytes += retiredMemory.size;
+		Retire( image, VK_NULL_HANDLE, retiredImage, retiredView, retiredMemory );
+	}
+
+	if ( movedBytes > 0 ) {
+		// Buffer copies need to land before this frame's draws read them.  The image copies carry their own barriers.
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+		vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL, 0, NULL );
+	}
+	return true;
+}
+
+static bool IsBlockEvacuated( const memoryBlock_t * block ) {
+	for ( size_t i = 0; i < defragmenter.buffers.size(); ++i ) {
+		if ( defragmenter.buffers[ i ]->GetMemory().block == block ) {
+			return false;
+		}
+	}
+	for ( size_t i = 0; i < defragmenter.images.size(); ++i ) {
+		if ( defragmenter.images[ i ]->GetMemory().block == block ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void UpdateDefragmentation() {
+	// Both of these run even with defragmentation turned off, since the image loader and texture streamer rely on them too.
+	RefreshStaleDescriptorSets();
+	ReleaseRetiredResources();
+
+	if ( defragmenter.bytesPerFrame == 0 || renderObjects.frameNumber < defragmenter.nextAttemptFrame ) {
+		return;
+	}
+	if ( defragmenter.evacuatingBlock == NULL ) {
+		defragmenter.evacuatingBlock = SelectEvacuationBlock();
+		if ( defragmenter.evacuatingBlock == NULL ) {
+			return;
+		}
+	}
+	if ( EvacuateBlock( defragmenter.evacuatingBlock ) == false ) {
+		defragmenter.evacuatingBlock = NULL;
+		defragmenter.nextAttemptFrame = renderObjects.frameNumber + DEFRAGMENTATION_RETRY_FRAMES;
+		return;
+	}
+	// Stop tracking the block once nothing lives in it anymore.  The retired allocations still hold it until the GPU is done.
+	if ( IsBlockEvacuated( defragmenter.evacuatingBlock ) == true ) {
+		defragmenter.evacuatingBlock = NULL;
+	}
+	// Point the sets at the new copies right away, so they never bind the old ones this frame.
+	RefreshStaleDescriptorSets();
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Memory.h"
+
+class Buffer;
+class Image;
+class DescriptorSet;
+
+// Every Buffer, Image and DescriptorSet registers itself on creation.  The defragmenter needs to know which resources live in a block
+// to empty it, and which descriptor sets point at a resource to rewrite them once it has moved.
+void RegisterForDefragmentation( Buffer * buffer );
+void RegisterForDefragmentation( Image * image );
+void RegisterForDefragmentation( DescriptorSet * descriptorSet );
+// Called on destruction.  Destroyed Buffers and Images are also forgotten by every descriptor set that pointed at them.
+void UnregisterFromDefragmentation( Buffer * buffer );
+void UnregisterFromDefragmentation( Image * image );
+void UnregisterFromDefragmentation( DescriptorSet * descriptorSet );
+
+// Rewrite the descriptor sets pointing at a resource whose view or handle has changed.  The sets are rewritten by UpdateDefragmentation,
+// and those still in flight are replaced.
+void RefreshDescriptorSetsReferencing( const void * resource );
+
+// Hand over the old storage of an image whose contents have been copied into new storage outside the defragmenter, as the texture
+// streamer does.  The old handles are kept until no frame in flight or descriptor set can use them, and the sets are rewritten.
+void RetireImageStorage( const Image * image, VkImage oldImage, VkImageView oldView, const allocation_t & oldMemory );
+
+// How many bytes may be copied per frame.  Zero turns defragmentation off.
+void SetDefragmentationBudget( uint32_t bytesPerFrame );
+// Move resources out of sparse memory blocks, a few per frame, so the blocks empty out and go back to the driver.  Also rewrites descriptor
+// sets that point at moved resources and releases old copies once the GPU is done with them.  Call after BeginStagingFrame, since the copies
+// are recorded into the staging graphics command buffer.
+void UpdateDefragmentation();
\ No newline at end of file
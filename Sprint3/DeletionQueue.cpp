@@ -0,0 +1,90 @@
+#include "DeletionQueue.h"
+#include <vector>
+
+struct deletionQueue_t {
+	std::vector< VkFramebuffer >	framebuffers;
+	std::vector< VkPipeline >		pipelines;
+	std::vector< VkShaderModule >	shaderModules;
+	std::vector< VkDescriptorSet >	descriptorSets;
+	std::vector< VkImageView >		imageViews;
+	std::vector< VkImage >			images;
+	std::vector< VkBuffer >			buffers;
+	std::vector< allocation_t >		allocations;
+};
+
+// Objects queued during a frame can be referenced by that frame's commands, and objects queued between frames by the frame just
+// submitted, which is still the current frame index.  Either way, waiting for the current slot's fence covers them.
+static deletionQueue_t deletionQueues[ FRAMES_IN_FLIGHT ];
+
+static deletionQueue_t & CurrentQueue() {
+	return deletionQueues[ renderObjects.frameIndex ];
+}
+
+void DeferDestroyBuffer( VkBuffer buffer ) {
+	CurrentQueue().buffers.push_back( buffer );
+}
+
+void DeferDestroyImage( VkImage image ) {
+	CurrentQueue().images.push_back( image );
+}
+
+void DeferDestroyImageView( VkImageView imageView ) {
+	CurrentQueue().imageViews.push_back( imageView );
+}
+
+void DeferDestroyFramebuffer( VkFramebuffer framebuffer ) {
+	CurrentQueue().framebuffers.push_back( framebuffer );
+}
+
+void DeferDestroyPipeline( VkPipeline pipeline ) {
+	CurrentQueue().pipelines.push_back( pipeline );
+}
+
+void DeferDestroyShaderModule( VkShaderModule shaderModule ) {
+	CurrentQueue().shaderModules.push_back( shaderModule );
+}
+
+void DeferFreeDescriptorSet( VkDescriptorSet descriptorSet ) {
+	CurrentQueue().descriptorSets.push_back( descriptorSet );
+}
+
+void DeferFreeDeviceMemory( const allocation_t & allocation ) {
+	CurrentQueue().allocations.push_back( allocation );
+}
+
+void FlushDeletionQueue() {
+	deletionQueue_t & queue = CurrentQueue();
+	// Objects that reference other objects go first, and memory goes last, after everything that could be bound to it.
+	for ( size_t i = 0; i < queue.framebuffers.size(); ++i ) {
+		vkDestroyFramebuffer( renderObjects.device, queue.framebuffers[ i ], NULL );
+	}
+	for ( size_t i = 0; i < queue.pipelines.size(); ++i ) {
+		vkDestroyPipeline( renderObjects.device, queue.pipelines[ i ], NULL );
+	}
+	for ( size_t i = 0; i < queue.shaderModules.size(); ++i ) {
+		vkDestroyShaderModule( renderObjects.device, queue.shaderModules[ i ], NULL );
+	}
+	if ( queue.descriptorSets.empty() == false ) {
+		VK_CHECK( vkFreeDescriptorSets( renderObjects.device, renderObjects.descriptorPool, ( uint32_t )queue.descriptorSets.size(), queue.descriptorSets.data() ) );
+	}
+	for ( size_t i = 0; i < queue.imageViews.size(); ++i ) {
+		vkDestroyImageView( renderObjects.device, queue.imageViews[ i ], NULL );
+	}
+	for ( size_t i = 0; i < queue.images.size(); ++i ) {
+		vkDestroyImage( renderObjects.device, queue.images[ i ], NULL );
+	}
+	for ( size_t i = 0; i < queue.buffers.size(); ++i ) {
+		vkDestroyBuffer( renderObjects.device, queue.buffers[ i ], NULL );
+	}
+	for ( size_t i = 0; i < queue.allocations.size(); ++i ) {
+		FreeDeviceMemory( queue.allocations[ i ] );
+	}
+	queue.framebuffers.clear();
+	queue.pipelines.clear();
+	queue.shaderModules.clear();
+	queue.descriptorSets.clear();
+	queue.imageViews.clear();
+	queue.images.clear();
+	queue.buffers.clear();
+	queue.allocations.clear();
+}
\ No newline at end of file
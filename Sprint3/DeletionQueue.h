@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Memory.h"
+
+// Vulkan objects can't be destroyed while a command buffer that references them may still execute.  Instead of waiting for the GPU,
+// destruction is deferred: objects are queued against the frame slot being recorded, and released the next time that slot comes around,
+// right after its fence has been waited on.  Handle types get their own function names, because on 32-bit builds every non-dispatchable
+// handle is the same uint64_t, so overloads would collide.
+void DeferDestroyBuffer( VkBuffer buffer );
+void DeferDestroyImage( VkImage image );
+void DeferDestroyImageView( VkImageView imageView );
+void DeferDestroyFramebuffer( VkFramebuffer framebuffer );
+void DeferDestroyPipeline( VkPipeline pipeline );
+void DeferDestroyShaderModule( VkShaderModule shaderModule );
+void DeferFreeDescriptorSet( VkDescriptorSet descriptorSet );
+void DeferFreeDeviceMemory( const allocation_t & allocation );
+
+// Release everything queued the last time this frame slot was used.  Only valid once that frame's fence has signaled.
+void FlushDeletionQueue();
\ No newline at end of file
@@ -1,12 +1,11 @@
 #include "DescriptorSet.h"
 #include "Buffer.h"
 #include "Image.h"
+#include "TransientAllocator.h"
+#include "Defragmenter.h"
+#include "DeletionQueue.h"
 
-// Allocates a descriptor set for a specific scope.  It should only be bound at the specified scope (which it will remember).
-DescriptorSet * DescriptorSet::Allocate( descriptorScope_t scope ) {
-	DescriptorSet * result = new DescriptorSet;
-	result->m_scope = scope;
-
+static VkDescriptorSet AllocateVkDescriptorSet( descriptorScope_t scope ) {
 	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
 	descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	descriptorSetAllocateInfo.descriptorPool = renderObjects.descriptorPool;
@@ -25,33 +24,106 @@ DescriptorSet * DescriptorSet::Allocate( descriptorScope_t scope ) {
 			break;
 		}
 	}
-	VK_CHECK( vkAllocateDescriptorSets( renderObjects.device, &descriptorSetAllocateInfo, &result->m_descriptorSet ) );
+	VkDescriptorSet result;
+	VK_CHECK( vkAllocateDescriptorSets( renderObjects.device, &descriptorSetAllocateInfo, &result ) );
+	return result;
+}
 
+// Allocates a descriptor set for a specific scope.  It should only be bound at the specified scope (which it will remember).
+DescriptorSet * DescriptorSet::Allocate( descriptorScope_t scope ) {
+	DescriptorSet * result = new DescriptorSet;
+	result->m_scope = scope;
+	result->m_descriptorSet = AllocateVkDescriptorSet( scope );
+
+	RegisterForDefragmentation( result );
 	return result;
 }
 
+void DescriptorSet::Free( DescriptorSet * descriptorSet ) {
+	UnregisterFromDefragmentation( descriptorSet );
+	DeferFreeDescriptorSet( descriptorSet->m_descriptorSet );
+	delete descriptorSet;
+}
+
 void DescriptorSet::SetUniformBuffer( descriptorSlot_t slot, const Buffer * buffer ) {
+	SetUniformBuffer( slot, buffer, buffer->GetRegionSize() );
+}
+
+void DescriptorSet::SetUniformBuffer( descriptorSlot_t slot, const Buffer * buffer, uint32_t range ) {
+	assert( range <= buffer->GetRegionSize() );
+	m_buffers[ slot ] = buffer;
+	m_ranges[ slot ] = range;
+	m_images[ slot ] = NULL;
 	VkDescriptorBufferInfo bufferInfo = {};
 	bufferInfo.buffer = buffer->GetBuffer();
 	bufferInfo.offset = 0;
+	bufferInfo.range = range;	// The dynamic offset picks the region, and the window within it
+
+	VkWriteDescriptorSet writeDescriptorSet = {};
+	writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSet.descriptorCount = 1;
+	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	writeDescriptorSet.dstBinding = slot;
+	writeDescriptorSet.dstSet = m_descriptorSet;
+	m_writtenSlots |= BIT( slot );
+	writeDescriptorSet.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets( renderObjects.device, 1, &writeDescriptorSet, 0, NULL );
+}
+
+void DescriptorSet::SetUniformBuffer( descriptorSlot_t slot, const transientAllocation_t & allocation ) {
+	m_buffers[ slot ] = NULL;
+	m_images[ slot ] = NULL;
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = allocation.buffer;
+	bufferInfo.offset = allocation.offset;
+	bufferInfo.range = allocation.size;
+
+	VkWriteDescriptorSet writeDescriptorSet = {};
+	writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSet.descriptorCount = 1;
+	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	writeDescriptorSet.dstBinding = slot;
+	writeDescriptorSet.dstSet = m_descriptorSet;
+	m_writtenSlots |= BIT( slot );
+	writeDescriptorSet.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets( renderObjects.device, 1, &writeDescriptorSet, 0, NULL );
+}
+
+void DescriptorSet::SetStorageBuffer( descriptorSlot_t slot, VkBuffer buffer ) {
+	m_buffers[ slot ] = NULL;
+	m_images[ slot ] = NULL;
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = 0;
 	bufferInfo.range = VK_WHOLE_SIZE;
 
 	VkWriteDescriptorSet writeDescriptorSet = {};
 	writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	writeDescriptorSet.descriptorCount = 1;
-	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	writeDescriptorSet.dstBinding = slot;
 	writeDescriptorSet.dstSet = m_descriptorSet;
+	m_writtenSlots |= BIT( slot );
 	writeDescriptorSet.pBufferInfo = &bufferInfo;
 
 	vkUpdateDescriptorSets( renderObjects.device, 1, &writeDescriptorSet, 0, NULL );
 }
 
-void DescriptorSet::SetImageSampler( descriptorSlot_t slot, samplerType_t samplerType, const Image * image ) {
+void DescriptorSet::SetImageSampler( descriptorSlot_t slot, samplerHandle_t sampler, const Image * image ) {
+	image->MarkUsed();
+	WriteImageSampler( slot, sampler, image );
+}
+
+void DescriptorSet::WriteImageSampler( descriptorSlot_t slot, samplerHandle_t sampler, const Image * image ) {
+	m_buffers[ slot ] = NULL;
+	m_images[ slot ] = image;
+	m_samplers[ slot ] = sampler;
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageView = image->GetView();
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo.sampler = renderObjects.samplers[ samplerType ];
+	imageInfo.sampler = GetVkSampler( sampler );
 
 	VkWriteDescriptorSet writeDescriptorSet = {};
 	writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -59,7 +131,88 @@ void DescriptorSet::SetImageSampler( descriptorSlot_t slot, samplerType_t sample
 	writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	writeDescriptorSet.dstBinding = slot;
 	writeDescriptorSet.dstSet = m_descriptorSet;
+	m_writtenSlots |= BIT( slot );
 	writeDescriptorSet.pImageInfo = &imageInfo;
 
 	vkUpdateDescriptorSets( renderObjects.device, 1, &writeDescriptorSet, 0, NULL );
+}
+
+void DescriptorSet::MarkBound() const {
+	m_lastBoundFrame = renderObjects.frameNumber;
+	m_everBound = true;
+	for ( uint32_t i = 0; i < DESCRIPTOR_SET_MAX_SLOTS; ++i ) {
+		if ( m_images[ i ] != NULL ) {
+			// Images sample as the placeholder until their data is staged, so the set is never bound with an empty image.
+			assert( m_images[ i ]->IsLoading() == true || m_images[ i ]->IsUploadStaged() == true );
+			m_images[ i ]->MarkUsed();
+		}
+	}
+}
+
+uint32_t DescriptorSet::GetDynamicOffsets( uint32_t * offsets ) const {
+	const uint32_t count = DESCRIPTOR_SET_UNIFORM_BUFFER_SLOTS[ m_scope ];
+	for ( uint32_t i = 0; i < count; ++i ) {
+		offsets[ i ] = m_buffers[ i ] != NULL ? m_buffers[ i ]->GetCurrentOffset() : 0;
+	}
+	return count;
+}
+
+bool DescriptorSet::References( const void * resource ) const {
+	if ( resource == NULL ) {
+		return false;
+	}
+	for ( uint32_t i = 0; i < DESCRIPTOR_SET_MAX_SLOTS; ++i ) {
+		if ( m_buffers[ i ] == resource || m_images[ i ] == resource ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void DescriptorSet::RefreshResources() {
+	if ( IsInFlight() == true ) {
+		ReplaceDescriptorSet();
+	}
+	for ( uint32_t i = 0; i < DESCRIPTOR_SET_MAX_SLOTS; ++i ) {
+		if ( m_buffers[ i ] != NULL ) {
+			SetUniformBuffer( i, m_buffers[ i ], m_ranges[ i ] );
+		} else if ( m_images[ i ] != NULL ) {
+			WriteImageSampler( i, m_samplers[ i ], m_images[ i ] );	// Not a use, or evicted images would look wanted again
+		}
+	}
+}
+
+void DescriptorSet::ReplaceDescriptorSet() {
+	// Everything written so far is copied over, which covers the slots that aren't tracked, like storage buffers and transient slices.
+	// The tracked ones are rewritten by the caller anyway.
+	VkDescriptorSet replacement = AllocateVkDescriptorSet( m_scope );
+	VkCopyDescriptorSet copies[ DESCRIPTOR_SET_MAX_SLOTS ];
+	uint32_t copyCount = 0;
+	for ( uint32_t i = 0; i < DESCRIPTOR_SET_MAX_SLOTS; ++i ) {
+		if ( ( m_writtenSlots & BIT( i ) ) == 0 ) {
+			continue;
+		}
+		VkCopyDescriptorSet & copy = copies[ copyCount++ ];
+		copy = {};
+		copy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+		copy.srcSet = m_descriptorSet;
+		copy.srcBinding = i;
+		copy.dstSet = replacement;
+		copy.dstBinding = i;
+		copy.descriptorCount = 1;
+	}
+	vkUpdateDescriptorSets( renderObjects.device, 0, NULL, copyCount, copies );
+	DeferFreeDescriptorSet( m_descriptorSet );
+	m_descriptorSet = replacement;
+	m_everBound = false;
+}
+
+void DescriptorSet::ForgetResource( const void * resource ) {
+	for ( uint32_t i = 0; i < DESCRIPTOR_SET_MAX_SLOTS; ++i ) {
+		if ( m_buffers[ i ] == resource || m_images[ i ] == resource ) {
+			m_buffers[ i ] = NULL;
+			m_images[ i ] = NULL;
+			m_writtenSlots &= ~BIT( i );	// The descriptor names the destroyed handles, so it mustn't be copied into a replacement set
+		}
+	}
 }
\ No newline at end of file
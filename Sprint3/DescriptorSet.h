@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Renderer.h"
+#include "SamplerCache.h"
 
 // The scope determines for how long the descriptor set is to be bound.  It plays directly into which slots are valid for a set.
 enum descriptorScope_t {
@@ -17,6 +18,12 @@ enum frameDescriptorUniformBufferSlot_t {
 	FRAME_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND
 };
 
+enum frameDescriptorStorageBufferSlot_t {
+	FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_0 = FRAME_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND,
+	FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_1,
+	FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_BOUND
+};
+
 enum viewDescriptorUniformBufferSlot_t {
 	VIEW_DESCRIPTOR_UNIFORM_BUFFER_SLOT_0,
 	VIEW_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND
@@ -29,25 +36,70 @@ enum meshDescriptorUniformBufferSlot_t {
 
 enum meshDescriptorSamplerSlot_t {
 	MESH_DESCRIPTOR_SAMPLER_SLOT_0 = MESH_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND,
+	MESH_DESCRIPTOR_SAMPLER_SLOT_1,
 	MESH_DESCRIPTOR_SAMPLER_SLOT_BOUND
 };
 
 typedef uint32_t descriptorSlot_t;
+const uint32_t DESCRIPTOR_SET_MAX_SLOTS = MESH_DESCRIPTOR_SAMPLER_SLOT_BOUND;	// The mesh scope has the most slots
+// Uniform buffers come first in every scope.
+const uint32_t DESCRIPTOR_SET_UNIFORM_BUFFER_SLOTS[ DESCRIPTOR_SCOPE_COUNT ] = {
+	FRAME_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND,
+	VIEW_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND,
+	MESH_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND,
+};
 
 class Buffer;
 class Image;
+struct transientAllocation_t;
 
 class DescriptorSet {
 public:
 	static DescriptorSet * Allocate( descriptorScope_t scope );
+	// The set is returned to the pool once no frame in flight can be using it.
+	static void Free( DescriptorSet * descriptorSet );
+	// Dynamic buffers are followed to the current frame's region whenever the set is bound, so the set doesn't need updating.
 	void SetUniformBuffer( descriptorSlot_t slot, const Buffer * buffer );
-	void SetImageSampler( descriptorSlot_t slot, samplerType_t samplerType, const Image * image );
+	// Only range bytes from the start of the buffer are visible, and the offset given to CommandContext::BindDescriptorSet moves that
+	// window, so one set and one large buffer can serve many draws with their own constants.
+	void SetUniformBuffer( descriptorSlot_t slot, const Buffer * buffer, uint32_t range );
+	// Points the slot at a slice of the transient ring.  The slice changes every frame, and a set can't be updated while an earlier
+	// frame in flight might still be using it, so sets used this way need one copy per frame in flight.
+	void SetUniformBuffer( descriptorSlot_t slot, const transientAllocation_t & allocation );
+	// For buffers the renderer owns outright, like the streaming feedback buffer.  They never move, so the slot isn't tracked.
+	void SetStorageBuffer( descriptorSlot_t slot, VkBuffer buffer );
+	// The sampler comes from GetSampler.
+	void SetImageSampler( descriptorSlot_t slot, samplerHandle_t sampler, const Image * image );
 	VkDescriptorSet GetDescriptorSet() const { return m_descriptorSet; }
+	// Every uniform buffer slot is dynamic, and needs an offset when the set is bound.  Returns how many were written, in slot order.
+	uint32_t GetDynamicOffsets( uint32_t * offsets ) const;
 	descriptorScope_t GetScope() const { return m_scope; }
+	// Called by the command context whenever the set is bound, so we know when the GPU is done with it.
+	// The images in the set are marked used too, which is what the texture residency manager goes by.
+	void MarkBound() const;
+	// A set may only be written once no frame in flight has it bound.
+	bool IsInFlight() const { return m_everBound == true && m_lastBoundFrame + FRAMES_IN_FLIGHT > renderObjects.frameNumber; }
+	bool References( const void * resource ) const;
+	// Stop tracking a resource that's being destroyed.  The descriptor itself is left alone, since the set can't be updated while in flight.
+	void ForgetResource( const void * resource );
+	// Rewrite every Buffer and Image slot with the resource's current handles, after the defragmenter has moved some of them.  A set
+	// that's in flight can't be written, so it moves to a newly allocated set, and the old one is freed once those frames are done.
+	void RefreshResources();
 
 private:
+	void WriteImageSampler( descriptorSlot_t slot, samplerHandle_t sampler, const Image * image );
+	void ReplaceDescriptorSet();
+
 	VkDescriptorSet m_descriptorSet = VK_NULL_HANDLE;
 	descriptorScope_t m_scope = DESCRIPTOR_SCOPE_COUNT;
+	// What each slot points at, so the set can be rewritten when a resource moves.  Transient slots aren't tracked, since the ring never moves.
+	const Buffer * m_buffers[ DESCRIPTOR_SET_MAX_SLOTS ] = {};
+	uint32_t m_ranges[ DESCRIPTOR_SET_MAX_SLOTS ] = {};
+	const Image * m_images[ DESCRIPTOR_SET_MAX_SLOTS ] = {};
+	samplerHandle_t m_samplers[ DESCRIPTOR_SET_MAX_SLOTS ] = {};
+	uint32_t m_writtenSlots = 0;	// Bit per slot holding a valid descriptor, which is what a replacement set copies over
+	mutable uint64_t m_lastBoundFrame = 0;
+	mutable bool m_everBound = false;
 
 private:
 	DescriptorSet() = default;
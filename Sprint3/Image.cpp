@@ -1,5 +1,17 @@
 #include "Image.h"
+#include "Defragmenter.h"
+#include "DeletionQueue.h"
+#include "CommandContext.h"
+#include "TextureFile.h"
+#include "ImageLoader.h"
+#include "TextureStreaming.h"
+#include "TextureResidency.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
 
+// Files are decoded on the image loader's threads, and the failure string is a global nobody can read safely, so it isn't kept.
+#define STBI_NO_FAILURE_STRINGS
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.c"
 
@@ -14,14 +26,59 @@ VkFormat TranslateFormat( imageFormat_t format ) {
 		case IMAGE_FORMAT_DEPTH: {
 			return VK_FORMAT_D32_SFLOAT;
 		}
+		case IMAGE_FORMAT_BC1: {
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		}
+		case IMAGE_FORMAT_BC3: {
+			return VK_FORMAT_BC3_UNORM_BLOCK;
+		}
+		case IMAGE_FORMAT_BC4: {
+			return VK_FORMAT_BC4_UNORM_BLOCK;
+		}
+		case IMAGE_FORMAT_BC5: {
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		}
+		case IMAGE_FORMAT_BC7: {
+			return VK_FORMAT_BC7_UNORM_BLOCK;
+		}
+		case IMAGE_FORMAT_RGBA16F: {
+			return VK_FORMAT_R16G16B16A16_SFLOAT;
+		}
+		case IMAGE_FORMAT_R11G11B10F: {
+			return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+		}
+		case IMAGE_FORMAT_R16F: {
+			return VK_FORMAT_R16_SFLOAT;
+		}
+		case IMAGE_FORMAT_RG16F: {
+			return VK_FORMAT_R16G16_SFLOAT;
+		}
+		case IMAGE_FORMAT_DEPTH16: {
+			return VK_FORMAT_D16_UNORM;
+		}
+		case IMAGE_FORMAT_DEPTH24_STENCIL8: {
+			return VK_FORMAT_D24_UNORM_S8_UINT;
+		}
 	}
 	return VK_FORMAT_UNDEFINED;
 }
 
+bool TranslateVkFormat( uint32_t vkFormat, imageFormat_t & format ) {
+	const imageFormat_t candidates[] = { IMAGE_FORMAT_RGBA8, IMAGE_FORMAT_BGRA8, IMAGE_FORMAT_BC1, IMAGE_FORMAT_BC3, IMAGE_FORMAT_BC4, IMAGE_FORMAT_BC5, IMAGE_FORMAT_BC7 };
+	for ( uint32_t i = 0; i < ARRAY_COUNT( candidates ); ++i ) {
+		if ( TranslateFormat( candidates[ i ] ) == ( VkFormat )vkFormat ) {
+			format = candidates[ i ];
+			return true;
+		}
+	}
+	return false;
+}
+
 static VkImageUsageFlags TranslateUsage( imageUsageFlags_t usage, imageFormat_t format ) {
+	assert( IsCompressedFormat( format ) == false || ( usage & IMAGE_USAGE_RENDER_TARGET ) == 0 );
 	VkImageUsageFlags result = 0;
 	if ( ( usage & IMAGE_USAGE_RENDER_TARGET ) != 0 ) {
-		if ( format == IMAGE_FORMAT_DEPTH ) {
+		if ( IsDepthFormat( format ) == true ) {
 			result |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 		} else {
 			result |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
@@ -35,26 +92,130 @@ static VkImageUsageFlags TranslateUsage( imageUsageFlags_t usage, imageFormat_t
 	}
 	if ( ( usage & IMAGE_USAGE_SHADER ) != 0 ) {
 		result |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		result |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;	// So the defragmenter can copy it somewhere else
 		result |= VK_IMAGE_USAGE_SAMPLED_BIT;
 	}
+	// Transient attachments may only be used as attachments, which is what lets the driver skip backing them with real memory.
+	if ( ( usage & IMAGE_USAGE_TRANSIENT ) != 0 && ( result & ~( VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT ) ) == 0 ) {
+		result |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	}
 	return result;
 }
 
 VkImageAspectFlags TranslateFormatToAspect( imageFormat_t format ) {
 	VkImageAspectFlags result = 0;
-	if ( format == IMAGE_FORMAT_DEPTH ) {
+	if ( IsDepthFormat( format ) == true ) {
 		result |= VK_IMAGE_ASPECT_DEPTH_BIT;
 	} else {
 		result |= VK_IMAGE_ASPECT_COLOR_BIT;
 	}
+	if ( HasStencil( format ) == true ) {
+		result |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
 	return result;
 }
 
-Image * Image::Create( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
-	Image * result = new Image;
-	result->m_format = format;
-	result->m_width = width;
-	result->m_height = height;
+bool IsDepthFormat( imageFormat_t format ) {
+	return format == IMAGE_FORMAT_DEPTH || format == IMAGE_FORMAT_DEPTH16 || format == IMAGE_FORMAT_DEPTH24_STENCIL8;
+}
+
+bool HasStencil( imageFormat_t format ) {
+	return format == IMAGE_FORMAT_DEPTH24_STENCIL8;
+}
+
+void GetFormatBlockInfo( imageFormat_t format, uint32_t & blockExtent, uint32_t & blockSize ) {
+	switch ( format ) {
+		case IMAGE_FORMAT_RGBA8:
+		case IMAGE_FORMAT_BGRA8:
+		case IMAGE_FORMAT_DEPTH:
+		case IMAGE_FORMAT_R11G11B10F:
+		case IMAGE_FORMAT_RG16F:
+		case IMAGE_FORMAT_DEPTH24_STENCIL8: {
+			blockExtent = 1;
+			blockSize = 4;
+			return;
+		}
+		case IMAGE_FORMAT_R16F:
+		case IMAGE_FORMAT_DEPTH16: {
+			blockExtent = 1;
+			blockSize = 2;
+			return;
+		}
+		case IMAGE_FORMAT_RGBA16F: {
+			blockExtent = 1;
+			blockSize = 8;
+			return;
+		}
+		case IMAGE_FORMAT_BC1:
+		case IMAGE_FORMAT_BC4: {
+			blockExtent = COMPRESSION_BLOCK_EXTENT;
+			blockSize = 8;
+			return;
+		}
+		case IMAGE_FORMAT_BC3:
+		case IMAGE_FORMAT_BC5:
+		case IMAGE_FORMAT_BC7: {
+			blockExtent = COMPRESSION_BLOCK_EXTENT;
+			blockSize = 16;
+			return;
+		}
+	}
+	blockExtent = 1;
+	blockSize = 0;
+}
+
+bool IsCompressedFormat( imageFormat_t format ) {
+	uint32_t blockExtent;
+	uint32_t blockSize;
+	GetFormatBlockInfo( format, blockExtent, blockSize );
+	return blockExtent > 1;
+}
+
+bool SupportsSampling( imageFormat_t format ) {
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties( renderObjects.physicalDevice, TranslateFormat( format ), &properties );
+	return ( properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT ) != 0;
+}
+
+bool SupportsRenderTarget( imageFormat_t format ) {
+	const VkFormatFeatureFlags required = IsDepthFormat( format ) == true ? VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties( renderObjects.physicalDevice, TranslateFormat( format ), &properties );
+	return ( properties.optimalTilingFeatures & required ) != 0;
+}
+
+imageFormat_t SelectRenderTargetFormat( const imageFormat_t * candidates, uint32_t candidateCount ) {
+	assert( candidateCount > 0 );
+	for ( uint32_t i = 0; i < candidateCount; ++i ) {
+		assert( IsDepthFormat( candidates[ i ] ) == IsDepthFormat( candidates[ 0 ] ) );	// A fallback has to be the same kind of target
+		if ( SupportsRenderTarget( candidates[ i ] ) == true ) {
+			return candidates[ i ];
+		}
+	}
+	// Vulkan requires every device to render to these two.
+	return IsDepthFormat( candidates[ 0 ] ) == true ? IMAGE_FORMAT_DEPTH16 : IMAGE_FORMAT_RGBA8;
+}
+
+bool SupportsLinearBlit( imageFormat_t format ) {
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties( renderObjects.physicalDevice, TranslateFormat( format ), &properties );
+	return ( properties.optimalTilingFeatures & required ) == required;
+}
+
+static uint32_t GetMipLevelCount( uint32_t width, uint32_t height, imageUsageFlags_t usage ) {
+	return ( usage & IMAGE_USAGE_MIPMAPPED ) != 0 ? GetMipLevelCount( width, height ) : 1;
+}
+
+static memoryOptions_t TranslateMemoryOptions( imageUsageFlags_t usage ) {
+	memoryOptions_t result = MEMORY_OPTIMAL_TILING;
+	if ( ( TranslateUsage( usage, IMAGE_FORMAT_RGBA8 ) & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT ) != 0 ) {
+		result = result | MEMORY_LAZILY_ALLOCATED;
+	}
+	return result;
+}
+
+static VkImage CreateVkImage( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
 	VkImageCreateInfo imageCreateInfo = {};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageCreateInfo.arrayLayers = 1;
@@ -63,20 +224,23 @@ Image * Image::Create( uint32_t width, uint32_t height, imageFormat_t format, im
 	imageCreateInfo.extent.height = height;
 	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.mipLevels = GetMipLevelCount( width, height, usage );
 	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 	imageCreateInfo.format = TranslateFormat( format );
 	imageCreateInfo.usage = TranslateUsage( usage, format );
-	VK_CHECK( vkCreateImage( renderObjects.device, &imageCreateInfo, NULL, &result->m_image ) );
-
-	VkMemoryRequirements memReq;
-	vkGetImageMemoryRequirements( renderObjects.device, result->m_image, &memReq );
+	VkImage image;
+	VK_CHECK( vkCreateImage( renderObjects.device, &imageCreateInfo, NULL, &image ) );
+	return image;
+}
 
-	AllocateDeviceMemory( memReq, MEMORY_NONE, result->m_memory );
-	VK_CHECK( vkBindImageMemory( renderObjects.device, result->m_image, result->m_memory.memory, result->m_memory.offset ) );
+// A view of a depth stencil format can only be sampled with a single aspect, so sampled views of depth formats only see depth.
+static VkImageAspectFlags GetSampledAspect( imageFormat_t format ) {
+	return IsDepthFormat( format ) == true ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
 
+static VkImageView CreateVkImageView( VkImage image, imageFormat_t format, VkImageAspectFlags aspect ) {
 	VkImageViewCreateInfo viewCreateInfo = {};
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewCreateInfo.components = {
@@ -85,18 +249,64 @@ Image * Image::Create( uint32_t width, uint32_t height, imageFormat_t format, im
 		VK_COMPONENT_SWIZZLE_IDENTITY,
 		VK_COMPONENT_SWIZZLE_IDENTITY,
 	};
-	viewCreateInfo.format = imageCreateInfo.format;
-	viewCreateInfo.image = result->m_image;
-	viewCreateInfo.subresourceRange.aspectMask = TranslateFormatToAspect( format );
+	viewCreateInfo.format = TranslateFormat( format );
+	viewCreateInfo.image = image;
+	viewCreateInfo.subresourceRange.aspectMask = aspect;
 	viewCreateInfo.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 	viewCreateInfo.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
 	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	VK_CHECK( vkCreateImageView( renderObjects.device, &viewCreateInfo, NULL, &result->m_imageView ) );
+	VkImageView view;
+	VK_CHECK( vkCreateImageView( renderObjects.device, &viewCreateInfo, NULL, &view ) );
+	return view;
+}
+
+Image * Image::Create( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
+	Image * result = CreateWithoutLayout( width, height, format, usage );
 	InitializeImageLayout( result, usage );
+	return result;
+}
 
+Image * Image::CreateWithoutLayout( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
+	assert( ( usage & IMAGE_USAGE_RENDER_TARGET ) == 0 || SupportsRenderTarget( format ) == true );
+	Image * result = new Image;
+	result->CreateStorage( width, height, format, usage );
 	return result;
 }
 
+void Image::CreateStorage( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
+	m_format = format;
+	m_width = width;
+	m_height = height;
+	m_usage = usage;
+	m_mipLevels = GetMipLevelCount( width, height, usage );
+	m_lastUsedFrame = renderObjects.frameNumber;	// So a new image isn't evicted before it's first drawn
+	m_image = CreateVkImage( width, height, format, usage );
+
+	VkMemoryRequirements memReq;
+	vkGetImageMemoryRequirements( renderObjects.device, m_image, &memReq );
+
+	const memoryCategory_t category = ( usage & IMAGE_USAGE_RENDER_TARGET ) != 0 ? MEMORY_CATEGORY_RENDER_TARGET : MEMORY_CATEGORY_TEXTURE;
+	AllocateDeviceMemory( memReq, TranslateMemoryOptions( usage ), category, m_memory );
+	VK_CHECK( vkBindImageMemory( renderObjects.device, m_image, m_memory.memory, m_memory.offset ) );
+
+	CreateViews();
+
+	RegisterForDefragmentation( this );
+}
+
+void Image::CreateViews() {
+	const VkImageAspectFlags aspect = TranslateFormatToAspect( m_format );
+	if ( ( m_usage & IMAGE_USAGE_SHADER ) == 0 || GetSampledAspect( m_format ) == aspect ) {
+		m_imageView = CreateVkImageView( m_image, m_format, aspect );
+		return;
+	}
+	// Sampled depth stencil images need a second view with both aspects to be rendered to.
+	m_imageView = CreateVkImageView( m_image, m_format, GetSampledAspect( m_format ) );
+	if ( ( m_usage & IMAGE_USAGE_RENDER_TARGET ) != 0 ) {
+		m_attachmentView = CreateVkImageView( m_image, m_format, aspect );
+	}
+}
+
 Image * Image::CreateFromSwapchain() {
 	Image * result = new Image;
 	result->m_width = renderObjects.swapchainExtent.width;
@@ -136,31 +346,839 @@ Image * Image::CreateFromSwapchain() {
 	return result;
 }
 
-Image * Image::CreateFromFile( const char * filename ) {
-	// Use stbi to get image data from the file, then create the corresponding image as a shader read image and stage the data.
+static void ReleaseDecodedImage( void * data ) {
+	stbi_image_free( data );
+}
+
+static void ReleaseAllocatedData( void * data ) {
+	free( data );
+}
+
+static void ReleaseMappedFile( void * file ) {
+	extern void UnmapFile( const void * data );
+	UnmapFile( file );
+}
+
+static bool IsBakedFile( const uint8_t * file, uint64_t fileSize ) {
+	return fileSize >= sizeof( textureFileHeader_t ) && ( ( const textureFileHeader_t * )file )->magic == TEXTURE_FILE_MAGIC;
+}
+
+// Baked textures are staged straight out of the mapped file, so the only work left is the copy into the staging ring, and the
+// pages are read by that copy.  Returns false, and points failure at why, if the file is stale or damaged, since the stager would
+// read past the end of the mapping.
+static bool DecodeBakedFile( const uint8_t * file, uint64_t fileSize, decodedImage_t & decoded, const char *& failure ) {
+	const textureFileHeader_t * header = ( const textureFileHeader_t * )file;
+	if ( header->version != TEXTURE_FILE_VERSION ) {
+		failure = "it was baked by another version of TextureBaker";
+		return false;
+	}
+	if ( TranslateVkFormat( header->vkFormat, decoded.format ) == false ) {
+		failure = "its format isn't one the renderer knows";
+		return false;
+	}
+	const uint32_t maxExtent = renderObjects.physicalDeviceProperties.limits.maxImageDimension2D;
+	if ( header->width == 0 || header->height == 0 || header->width > maxExtent || header->height > maxExtent || header->mipLevels == 0 ||
+			header->mipLevels > GetMipLevelCount( header->width, header->height ) || fileSize < GetTextureFileDataOffset( header->mipLevels ) ) {
+		failure = "its header is damaged";
+		return false;
+	}
+
+	// The levels are written back to back, largest first, which is what the stager expects.  It works out each level's size from
+	// the format, so the file has to agree.
+	uint32_t blockExtent;
+	uint32_t blockSize;
+	GetFormatBlockInfo( decoded.format, blockExtent, blockSize );
+	const textureFileLevel_t * levels = ( const textureFileLevel_t * )( header + 1 );
+	uint64_t dataSize = 0;
+	for ( uint32_t i = 0; i < header->mipLevels; ++i ) {
+		const uint64_t blocksWide = ( GetMipExtent( header->width, i ) + blockExtent - 1 ) / blockExtent;
+		const uint64_t blocksHigh = ( GetMipExtent( header->height, i ) + blockExtent - 1 ) / blockExtent;
+		if ( levels[ i ].offset != levels[ 0 ].offset + dataSize || levels[ i ].size != blocksWide * blocksHigh * blockSize ) {
+			failure = "its level index is damaged";
+			return false;
+		}
+		dataSize += levels[ i ].size;
+	}
+	if ( levels[ 0 ].offset > fileSize || dataSize > fileSize - levels[ 0 ].offset || dataSize > UINT32_MAX ) {
+		failure = "it's truncated";
+		return false;
+	}
+	decoded.data = file + levels[ 0 ].offset;
+	decoded.size = ( uint32_t )dataSize;
+	decoded.width = header->width;
+	decoded.height = header->height;
+	decoded.levelCount = header->mipLevels;
+	decoded.release = ReleaseMappedFile;
+	decoded.releaseContext = ( void * )file;
+	return true;
+}
+
+// Takes ownership of the mapped file, which is released along with the decoded data or right away.
+static bool DecodeMappedFile( const uint8_t * file, uint64_t fileSize, decodedImage_t & decoded, const char *& failure ) {
+	extern void UnmapFile( const void * data );
+	if ( IsBakedFile( file, fileSize ) == true ) {
+		if ( DecodeBakedFile( file, fileSize, decoded, failure ) == false ) {
+			UnmapFile( file );
+			return false;
+		}
+		return true;
+	}
+
+	// Anything else is a source image, which stbi decodes to RGBA8.
 	int x;
 	int y;
 	int comp;
-	uint8_t * imageData = stbi_load( filename, &x, &y, &comp, 4 );
-	Image * result = Create( x, y, IMAGE_FORMAT_RGBA8, IMAGE_USAGE_SHADER );
-	VkMemoryRequirements requirements;
-	vkGetImageMemoryRequirements( renderObjects.device, result->GetImage(), &requirements );
-	StageImageData( imageData, x * y * 4, ( uint32_t )requirements.alignment, result );
-	result->SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );	// This is the layout in which the stager will leave the image
+	uint8_t * imageData = stbi_load_from_memory( file, ( int )fileSize, &x, &y, &comp, 4 );
+	UnmapFile( file );
+	if ( imageData == NULL ) {
+		failure = "it isn't a baked texture or an image stb_image can decode";
+		return false;
+	}
+	decoded.width = x;
+	decoded.height = y;
+	decoded.format = IMAGE_FORMAT_RGBA8;
+	if ( SupportsLinearBlit( IMAGE_FORMAT_RGBA8 ) == true ) {
+		// Only the base level goes through staging.  The stager blits the rest from it once it lands.
+		decoded.data = imageData;
+		decoded.size = x * y * 4;
+		decoded.levelCount = 1;
+		decoded.release = ReleaseDecodedImage;
+		decoded.releaseContext = imageData;
+		return true;
+	}
+	uint8_t * chain = BuildMipChain( imageData, x, y, GetMipLevelCount( x, y ), 4, decoded.size );
 	stbi_image_free( imageData );
+	decoded.data = chain;
+	decoded.levelCount = GetMipLevelCount( x, y );
+	decoded.release = ReleaseAllocatedData;
+	decoded.releaseContext = chain;
+	return true;
+}
+
+// Takes ownership of the mapped file, like DecodeMappedFile, and turns down formats the device can't sample.
+static bool DecodeFileForDevice( const uint8_t * file, uint64_t fileSize, decodedImage_t & decoded, const char *& failure ) {
+	if ( DecodeMappedFile( file, fileSize, decoded, failure ) == false ) {
+		return false;
+	}
+	// Devices without BC support are mostly mobile, which would need the textures baked to ASTC or ETC2 instead.
+	if ( SupportsSampling( decoded.format ) == false ) {
+		decoded.release( decoded.releaseContext );
+		failure = "the device can't sample its format";
+		return false;
+	}
+	return true;
+}
+
+bool DecodeImageFile( const char * filename, decodedImage_t & decoded, const char ** failure ) {
+	extern const void * MapFile( const char * filename, uint64_t & size );
+	uint64_t fileSize;
+	const uint8_t * file = ( const uint8_t * )MapFile( filename, fileSize );
+	const char * reason = "the file couldn't be opened";
+	if ( file == NULL || DecodeFileForDevice( file, fileSize, decoded, reason ) == false ) {
+		if ( failure != NULL ) {
+			*failure = reason;
+		}
+		return false;
+	}
+	return true;
+}
+
+bool DecodeBakedImageFile( const void * file, uint64_t fileSize, decodedImage_t & decoded, const char ** failure ) {
+	const char * reason = "it isn't a baked texture";
+	if ( IsBakedFile( ( const uint8_t * )file, fileSize ) == false || DecodeBakedFile( ( const uint8_t * )file, fileSize, decoded, reason ) == false ) {
+		if ( failure != NULL ) {
+			*failure = reason;
+		}
+		return false;
+	}
+	return true;
+}
+
+void Image::CreateStorageForData( uint32_t width, uint32_t height, imageFormat_t format, uint32_t levelCount ) {
+	assert( SupportsSampling( format ) == true );	// DecodeImageFile turns these files down
+	const uint32_t fullMipLevels = GetMipLevelCount( width, height );
+	assert( levelCount == 1 || levelCount == fullMipLevels );
+	// A single level gets the rest of the chain generated when the format allows, otherwise the image just has the one level.
+	imageUsageFlags_t usage = IMAGE_USAGE_SHADER;
+	if ( levelCount == fullMipLevels || SupportsLinearBlit( format ) == true ) {
+		usage = usage | IMAGE_USAGE_MIPMAPPED;
+	}
+	// No layout initialization, because with a dedicated transfer queue the graphics queue would run it after the copies and discard them.
+	CreateStorage( width, height, format, usage );
+}
+
+// Linear tiling is the only tiling the CPU can write, but devices only sample it in some formats and sizes, and may allow just a single
+// level.  Without the whole chain in the data the rest would have to be blitted, which linear images can't be relied on for either.
+static bool SupportsDirectUpload( const decodedImage_t & decoded ) {
+	if ( renderObjects.deviceLocalMappable == false || decoded.levelCount != GetMipLevelCount( decoded.width, decoded.height ) ) {
+		return false;
+	}
+	const VkFormat format = TranslateFormat( decoded.format );
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties( renderObjects.physicalDevice, format, &properties );
+	if ( ( properties.linearTilingFeatures & required ) != required ) {
+		return false;
+	}
+	VkImageFormatProperties imageProperties;
+	if ( vkGetPhysicalDeviceImageFormatProperties( renderObjects.physicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT, 0, &imageProperties ) != VK_SUCCESS ) {
+		return false;
+	}
+	return imageProperties.maxMipLevels >= decoded.levelCount && imageProperties.maxExtent.width >= decoded.width && imageProperties.maxExtent.height >= decoded.height;
+}
+
+bool Image::LoadDecodedDirect( const decodedImage_t & decoded ) {
+	m_format = decoded.format;
+	m_width = decoded.width;
+	m_height = decoded.height;
+	m_usage = IMAGE_USAGE_SHADER | IMAGE_USAGE_MIPMAPPED;
+	m_mipLevels = decoded.levelCount;
+	m_lastUsedFrame = renderObjects.frameNumber;	// So a new image isn't evicted before it's first drawn
+	m_linearTiling = true;
+
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.extent.width = m_width;
+	imageCreateInfo.extent.height = m_height;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;	// Keeps what the CPU writes before the first transition
+	imageCreateInfo.mipLevels = m_mipLevels;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_LINEAR;
+	imageCreateInfo.format = TranslateFormat( m_format );
+	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	VK_CHECK( vkCreateImage( renderObjects.device, &imageCreateInfo, NULL, &m_image ) );
 
+	// Linear images may be limited to memory types the CPU can't write, which only shows once the image exists.
+	VkMemoryRequirements memReq;
+	vkGetImageMemoryRequirements( renderObjects.device, m_image, &memReq );
+	if ( SupportsDeviceMappable( memReq.memoryTypeBits ) == false ) {
+		vkDestroyImage( renderObjects.device, m_image, NULL );	// Never used, so it can go right away
+		m_image = VK_NULL_HANDLE;
+		m_linearTiling = false;
+		return false;
+	}
+	AllocateDeviceMemory( memReq, MEMORY_DEVICE_MAPPABLE, MEMORY_CATEGORY_TEXTURE, m_memory );
+	assert( m_memory.mappedData != NULL );
+	VK_CHECK( vkBindImageMemory( renderObjects.device, m_image, m_memory.memory, m_memory.offset ) );
+	m_imageView = CreateVkImageView( m_image, m_format, VK_IMAGE_ASPECT_COLOR_BIT );
+
+	// The driver decides where each level goes and how far apart its rows are.
+	uint32_t blockExtent;
+	uint32_t blockSize;
+	GetFormatBlockInfo( m_format, blockExtent, blockSize );
+	const uint8_t * level = ( const uint8_t * )decoded.data;
+	for ( uint32_t i = 0; i < m_mipLevels; ++i ) {
+		VkImageSubresource subresource = {};
+		subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		subresource.mipLevel = i;
+		VkSubresourceLayout layout;
+		vkGetImageSubresourceLayout( renderObjects.device, m_image, &subresource, &layout );
+		const uint32_t rowSize = ( GetMipExtent( m_width, i ) + blockExtent - 1 ) / blockExtent * blockSize;
+		const uint32_t rowCount = ( GetMipExtent( m_height, i ) + blockExtent - 1 ) / blockExtent;
+		uint8_t * destination = ( uint8_t * )m_memory.mappedData + layout.offset;
+		for ( uint32_t row = 0; row < rowCount; ++row ) {
+			memcpy( destination + row * layout.rowPitch, level + row * rowSize, rowSize );
+		}
+		level += rowCount * rowSize;
+	}
+	if ( decoded.release != NULL ) {
+		decoded.release( decoded.releaseContext );
+	}
+
+	// The memory is coherent, and submitting the graphics staging command buffer makes the writes available to it.
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = m_image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+	SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );
+
+	RegisterForDefragmentation( this );	// Not to be moved, but its block mustn't look empty
+	return true;
+}
+
+void Image::LoadDecoded( const decodedImage_t & decoded ) {
+	if ( SupportsDirectUpload( decoded ) == true && LoadDecodedDirect( decoded ) == true ) {
+		return;
+	}
+	m_linearTiling = false;
+	CreateStorageForData( decoded.width, decoded.height, decoded.format, decoded.levelCount );
+	// The stager releases the data once it's all in staging memory, which may be a few frames from now for a large image.
+	m_uploadHandle = StageImageData( decoded.data, decoded.size, this, decoded.levelCount, decoded.release, decoded.releaseContext );
+	SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );	// This is the layout in which the stager will leave the image
+}
+
+Image * Image::CreateFromData( const decodedImage_t & decoded ) {
+	Image * result = new Image;
+	result->LoadDecoded( decoded );
+	result->SampleAsPlaceholderUntilStaged();
+	return result;
+}
+
+void Image::SampleAsPlaceholderUntilStaged() {
+	// The placeholder itself is tiny, and staged by the first frame, before anything can be drawn.
+	if ( IsUploadStaged() == true || renderObjects.placeholderImage == NULL ) {
+		return;
+	}
+	m_loading = true;
+	WatchImageUpload( this );
+}
+
+// Where a JPEG decoded by CreateFromJpeg ended up: in the staging ring, or on the heap when the ring had no room.
+struct jpegDecode_t {
+	Image *		image = NULL;
+	uint8_t *	heapData = NULL;
+	uint32_t	width = 0;
+	uint32_t	height = 0;
+};
+
+// Called by the JPEG decoder once the image has decoded, so nothing is reserved for a file that turns out to be corrupt.
+uint8_t * Image::ReserveDecodeStaging( void * context, int width, int height, int * stride ) {
+	jpegDecode_t & decode = *( jpegDecode_t * )context;
+	const uint64_t imageSize = ( uint64_t )width * height * 4;
+	decode.width = width;
+	decode.height = height;
+	*stride = width * 4;
+	if ( imageSize <= stagingBuffer.size ) {
+		Image * image = new Image;
+		image->CreateStorageForData( width, height, IMAGE_FORMAT_RGBA8, 1 );
+		uint8_t * staging = StageImageDataInPlace( ( uint32_t )imageSize, image, 1, image->m_uploadHandle );
+		if ( staging != NULL ) {
+			decode.image = image;
+			return staging;
+		}
+		Destroy( image );
+	}
+	decode.heapData = ( uint8_t * )malloc( ( size_t )imageSize );
+	return decode.heapData;
+}
+
+// JPEGs are decoded front to back without ever reading the output, which is the one access pattern that's fast on write-combined
+// memory, so they're decoded straight into the staging ring.  That saves a heap allocation and a copy of every texel.  If the ring
+// can't take the whole image this frame, it's decoded to the heap and staged like any other.  Returns NULL if the file isn't a JPEG
+// that decodes.
+Image * Image::CreateFromJpeg( const uint8_t * file, uint64_t fileSize ) {
+	jpegDecode_t decode;
+	// Only the base level is staged, so the format has to be able to generate the rest of the chain.
+	if ( SupportsLinearBlit( IMAGE_FORMAT_RGBA8 ) == false || stbi_jpeg_load_into_from_memory( file, ( int )fileSize, 4, ReserveDecodeStaging, &decode ) == 0 ) {
+		free( decode.heapData );
+		return NULL;
+	}
+	if ( decode.image == NULL ) {
+		decodedImage_t decoded;
+		decoded.data = decode.heapData;
+		decoded.size = decode.width * decode.height * 4;
+		decoded.width = decode.width;
+		decoded.height = decode.height;
+		decoded.levelCount = 1;
+		decoded.format = IMAGE_FORMAT_RGBA8;
+		decoded.release = ReleaseAllocatedData;
+		decoded.releaseContext = decode.heapData;
+		return CreateFromData( decoded );
+	}
+	decode.image->SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );	// This is the layout in which the stager will leave the image
+	decode.image->SampleAsPlaceholderUntilStaged();
+	return decode.image;
+}
+
+Image * Image::CreateFromFile( const char * filename ) {
+	extern const void * MapFile( const char * filename, uint64_t & size );
+	extern void UnmapFile( const void * data );
+	uint64_t fileSize;
+	const uint8_t * file = ( const uint8_t * )MapFile( filename, fileSize );
+	const char * failure = "the file couldn't be opened";
+	Image * result = NULL;
+	if ( file != NULL ) {
+		result = CreateFromJpeg( file, fileSize );
+		decodedImage_t decoded;
+		if ( result != NULL ) {
+			UnmapFile( file );
+		} else if ( DecodeFileForDevice( file, fileSize, decoded, failure ) == true ) {
+			result = CreateFromData( decoded );
+		}
+	}
+	if ( result == NULL ) {
+		extern void PrintDebugMessage( const char * message );
+		char message[ 512 ];
+		snprintf( message, sizeof( message ), "Couldn't load image %s: %s\n", filename, failure );
+		PrintDebugMessage( message );
+		return NULL;
+	}
+	// The file can be read again, so the image can be evicted and reloaded.
+	result->m_sourceFile = filename;
+	result->m_residencyManaged = true;
+	RegisterResidentImage( result );
+	return result;
+}
+
+Image * Image::CreateStreamed( const char * filename ) {
+	extern const void * MapFile( const char * filename, uint64_t & size );
+	extern void UnmapFile( const void * data );
+	uint64_t fileSize;
+	const uint8_t * file = ( const uint8_t * )MapFile( filename, fileSize );
+	// Baked files have every level of the chain ready to be copied on its own.
+	decodedImage_t decoded;
+	const char * failure = NULL;
+	if ( file == NULL ) {
+		failure = "the file couldn't be opened";
+	} else if ( IsBakedFile( file, fileSize ) == false ) {
+		failure = "it isn't a baked texture";
+	} else if ( DecodeBakedFile( file, fileSize, decoded, failure ) == true ) {
+		if ( decoded.levelCount != GetMipLevelCount( decoded.width, decoded.height ) ) {
+			failure = "it was baked without the full mip chain";
+		} else if ( SupportsSampling( decoded.format ) == false ) {
+			failure = "the device can't sample its format";
+		}
+	}
+	if ( failure != NULL ) {
+		if ( file != NULL ) {
+			UnmapFile( file );
+		}
+		extern void PrintDebugMessage( const char * message );
+		char message[ 512 ];
+		snprintf( message, sizeof( message ), "Couldn't stream image %s: %s\n", filename, failure );
+		PrintDebugMessage( message );
+		return NULL;
+	}
+
+	// The levels that fit within STREAMING_RESIDENT_EXTENT are always resident.  They're a small fraction of the chain, and mean
+	// there's something to sample from the first frame.
+	uint32_t residentLevel = 0;
+	while ( std::max( GetMipExtent( decoded.width, residentLevel ), GetMipExtent( decoded.height, residentLevel ) ) > STREAMING_RESIDENT_EXTENT ) {
+		++residentLevel;
+	}
+	Image * result = new Image;
+	result->m_streamingFile = ( const textureFileHeader_t * )file;
+	result->m_residentLevel = residentLevel;
+	result->m_streamingTailLevel = residentLevel;
+	result->CreateStorageForData( GetMipExtent( decoded.width, residentLevel ), GetMipExtent( decoded.height, residentLevel ), decoded.format, decoded.levelCount - residentLevel );
+	const textureFileLevel_t * levels = ( const textureFileLevel_t * )( result->m_streamingFile + 1 );
+	const uint64_t skipped = levels[ residentLevel ].offset - levels[ 0 ].offset;
+	// The file is released by Destroy, not the stager, since later levels are read from it too.
+	result->m_uploadHandle = StageImageData( ( const uint8_t * )decoded.data + skipped, ( uint32_t )( decoded.size - skipped ), result, result->m_mipLevels, NULL, NULL );
+	result->SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );
+	result->SampleAsPlaceholderUntilStaged();
+	result->m_streamingId = RegisterStreamedImage( result );
+	result->m_residencyManaged = true;
+	RegisterResidentImage( result );
+	return result;
+}
+
+bool Image::StreamInLevel() {
+	if ( m_residentLevel == 0 || m_streamingStorage != NULL ) {
+		return false;
+	}
+	// The new storage has room for the new level on top of every level already resident.  Only the new level is read from the file,
+	// and FinishStreamIn copies the rest over from the current storage on the GPU.
+	const uint32_t level = m_residentLevel - 1;
+	const textureFileLevel_t * levels = ( const textureFileLevel_t * )( m_streamingFile + 1 );
+	Image * storage = new Image;
+	storage->CreateStorage( GetMipExtent( m_streamingFile->width, level ), GetMipExtent( m_streamingFile->height, level ), m_format, m_usage );
+	m_streamingStorage = storage;
+	const uint8_t * data = ( const uint8_t * )m_streamingFile + levels[ level ].offset;
+	const uploadHandle_t handle = StageImageData( data, ( uint32_t )levels[ level ].size, storage, 1, NULL, NULL, FinishStreamIn, this );
+	// If the level fit in the ring right away, the storage has already been taken over.  Otherwise the handle keeps the defragmenter
+	// from moving it while it fills.
+	if ( m_streamingStorage != NULL ) {
+		m_streamingStorage->m_uploadHandle = handle;
+	}
+	return true;
+}
+
+// Copy levelCount levels from source into destination, which is in transfer dst, on the graphics staging command buffer.  Every level
+// of both ends up in shader read.  The source goes back to shader read because descriptor sets that haven't been pointed at the
+// destination yet will keep sampling it for a few frames.
+static void CopyLevels( const Image * source, uint32_t sourceLevel, const Image * destination, uint32_t destinationLevel, uint32_t levelCount ) {
+	const VkCommandBuffer commandBuffer = stagingBuffer.graphicsCommandBuffer;
+	VkImageMemoryBarrier barriers[ 2 ] = {};
+	for ( uint32_t i = 0; i < ARRAY_COUNT( barriers ); ++i ) {
+		barriers[ i ].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[ i ].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[ i ].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[ i ].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barriers[ i ].subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		barriers[ i ].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	}
+	barriers[ 0 ].image = source->GetImage();
+	barriers[ 0 ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;	// Its own upload may have been recorded earlier this frame
+	barriers[ 0 ].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[ 0 ].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[ 0 ].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barriers[ 0 ] );
+
+	std::vector< VkImageCopy > regions( levelCount );
+	for ( uint32_t i = 0; i < levelCount; ++i ) {
+		VkImageCopy & region = regions[ i ];
+		region = {};
+		region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.srcSubresource.mipLevel = sourceLevel + i;
+		region.srcSubresource.layerCount = 1;
+		region.dstSubresource = region.srcSubresource;
+		region.dstSubresource.mipLevel = destinationLevel + i;
+		region.extent.width = GetMipExtent( source->GetWidth(), sourceLevel + i );
+		region.extent.height = GetMipExtent( source->GetHeight(), sourceLevel + i );
+		region.extent.depth = 1;
+	}
+	vkCmdCopyImage( commandBuffer, source->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destination->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount, regions.data() );
+
+	barriers[ 0 ].srcAccessMask = 0;	// Reads don't need to be made visible
+	barriers[ 0 ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[ 0 ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[ 0 ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[ 1 ].image = destination->GetImage();
+	barriers[ 1 ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;	// The copy above, and any copy from staging before it
+	barriers[ 1 ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[ 1 ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[ 1 ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ), barriers );
+}
+
+void Image::AdoptStorage( Image * storage ) {
+	// The image keeps its identity and takes over the new storage, and the descriptor sets pointing at it are rewritten.
+	RetireImageStorage( this, m_image, m_imageView, m_memory );
+	m_image = storage->m_image;
+	m_imageView = storage->m_imageView;
+	m_memory = storage->m_memory;
+	m_width = storage->m_width;
+	m_height = storage->m_height;
+	m_mipLevels = storage->m_mipLevels;
+	UnregisterFromDefragmentation( storage );
+	delete storage;
+}
+
+void Image::FinishStreamIn( void * context ) {
+	Image * image = ( Image * )context;
+	Image * storage = image->m_streamingStorage;
+	// Level i of the current storage is level i + 1 of the new one.
+	CopyLevels( image, 0, storage, 1, image->m_mipLevels );
+	image->AdoptStorage( storage );
+	--image->m_residentLevel;
+	image->m_streamingStorage = NULL;
+}
+
+bool Image::CanEvict() const {
+	if ( m_residencyManaged == false || m_loading == true || IsUploadStaged() == false ) {
+		return false;
+	}
+	// Streamed images give up their most detailed level instead, and always keep their smallest levels.
+	if ( m_streamingFile != NULL ) {
+		return m_streamingStorage == NULL && m_residentLevel < m_streamingTailLevel;
+	}
+	return true;
+}
+
+void Image::Evict() {
+	assert( CanEvict() == true );
+	if ( m_streamingFile != NULL ) {
+		Image * storage = new Image;
+		storage->CreateStorage( GetMipExtent( m_width, 1 ), GetMipExtent( m_height, 1 ), m_format, m_usage );
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.image = storage->m_image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+		// Level i + 1 of the current storage is level i of the new one.  The dropped level streams back in if the shaders want it.
+		CopyLevels( this, 1, storage, 0, storage->m_mipLevels );
+		AdoptStorage( storage );
+		++m_residentLevel;
+		return;
+	}
+
+	// The whole image goes, and samples as the placeholder until it's used again and reloaded.
+	m_evictedBytes = m_memory.size;
+	RetireImageStorage( this, m_image, m_imageView, m_memory );
+	m_image = VK_NULL_HANDLE;
+	m_imageView = VK_NULL_HANDLE;
+	m_memory = {};
+	m_loading = true;
+	m_evicted = true;
+	m_evictedFrame = renderObjects.frameNumber;
+}
+
+void Image::Reload() {
+	assert( m_evicted == true );
+	m_evicted = false;
+	QueueImageLoad( this, m_sourceFile.c_str() );
+}
+
+uint64_t Image::GetResidentBytes() const {
+	uint64_t result = m_memory.size;
+	if ( m_streamingStorage != NULL ) {
+		result += m_streamingStorage->m_memory.size;
+	}
+	return result;
+}
+
+uint64_t Image::GetStreamInBytes() const {
+	// The new storage holds everything resident plus the new level, and the current storage lives on until it's been copied.
+	const textureFileLevel_t * levels = ( const textureFileLevel_t * )( m_streamingFile + 1 );
+	return m_memory.size + levels[ m_residentLevel - 1 ].size;
+}
+
+Image * Image::CreateFromFileAsync( const char * filename ) {
+	Image * result = new Image;
+	result->m_loading = true;
+	result->m_sourceFile = filename;
+	result->m_residencyManaged = true;
+	RegisterResidentImage( result );
+	QueueImageLoad( result, filename );
+	return result;
+}
+
+void Image::FinishAsyncLoad( const decodedImage_t & decoded ) {
+	assert( m_loading == true && m_image == VK_NULL_HANDLE );
+	LoadDecoded( decoded );
+}
+
+VkImageView Image::GetView() const {
+	if ( m_loading == true ) {
+		return renderObjects.placeholderImage->m_imageView;
+	}
+	return m_imageView;
+}
+
+Image * Image::CreateAliased( imageAliasGroup_t & group, uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage, uint32_t firstPass, uint32_t lastPass ) {
+	assert( group.memory.memory == VK_NULL_HANDLE );	// Already finalized
+	assert( ( usage & IMAGE_USAGE_RENDER_TARGET ) != 0 );	// Aliasing only makes sense for things the GPU writes every frame
+	assert( firstPass <= lastPass );
+	Image * result = new Image;
+	result->m_format = format;
+	result->m_width = width;
+	result->m_height = height;
+	result->m_usage = usage;
+	result->m_aliased = true;
+	result->m_mipLevels = GetMipLevelCount( width, height, usage );
+	result->m_image = CreateVkImage( width, height, format, usage );
+	group.images.push_back( result );
+	group.firstPasses.push_back( firstPass );
+	group.lastPasses.push_back( lastPass );
 	return result;
 }
 
+void Image::FinalizeAliasGroup( imageAliasGroup_t & group ) {
+	struct placement_t {
+		VkMemoryRequirements	requirements;
+		VkDeviceSize			offset;
+		bool					placed;
+	};
+	const size_t imageCount = group.images.size();
+	std::vector< placement_t > placements( imageCount );
+	std::vector< size_t > order( imageCount );
+	VkMemoryRequirements groupRequirements = {};
+	groupRequirements.alignment = 1;
+	groupRequirements.memoryTypeBits = ~0U;
+	bool lazilyAllocated = true;
+	for ( size_t i = 0; i < imageCount; ++i ) {
+		vkGetImageMemoryRequirements( renderObjects.device, group.images[ i ]->m_image, &placements[ i ].requirements );
+		placements[ i ].placed = false;
+		order[ i ] = i;
+		group.unaliasedBytes += placements[ i ].requirements.size;
+		groupRequirements.memoryTypeBits &= placements[ i ].requirements.memoryTypeBits;
+		groupRequirements.alignment = std::max( groupRequirements.alignment, placements[ i ].requirements.alignment );
+		lazilyAllocated = lazilyAllocated && ( TranslateMemoryOptions( group.images[ i ]->m_usage ) & MEMORY_LAZILY_ALLOCATED ) != 0;
+	}
+	assert( groupRequirements.memoryTypeBits != 0 );	// The images have to be able to live in the same kind of memory
+
+	// Place the largest images first, each at the lowest offset that doesn't overlap an already placed image whose lifetime overlaps
+	// its own.  The only offsets worth trying are zero and the ends of those images, since any other gap starts at one of them.
+	std::sort( order.begin(), order.end(), [ & ]( size_t a, size_t b ) {
+		return placements[ a ].requirements.size > placements[ b ].requirements.size;
+	} );
+	for ( size_t i = 0; i < imageCount; ++i ) {
+		const size_t current = order[ i ];
+		placement_t & placement = placements[ current ];
+		std::vector< VkDeviceSize > candidates( 1, 0 );
+		for ( size_t j = 0; j < imageCount; ++j ) {
+			if ( placements[ j ].placed == true ) {
+				const VkDeviceSize end = placements[ j ].offset + placements[ j ].requirements.size;
+				const VkDeviceSize alignment = placement.requirements.alignment;
+				candidates.push_back( ( end + alignment - 1 ) / alignment * alignment );
+			}
+		}
+		std::sort( candidates.begin(), candidates.end() );
+		for ( size_t c = 0; c < candidates.size(); ++c ) {
+			const VkDeviceSize begin = candidates[ c ];
+			const VkDeviceSize end = begin + placement.requirements.size;
+			bool fits = true;
+			for ( size_t j = 0; j < imageCount && fits == true; ++j ) {
+				if ( placements[ j ].placed == false ) {
+					continue;
+				}
+				const bool livesTogether = group.firstPasses[ j ] <= group.lastPasses[ current ] && group.firstPasses[ current ] <= group.lastPasses[ j ];
+				const bool overlaps = begin < placements[ j ].offset + placements[ j ].requirements.size && placements[ j ].offset < end;
+				fits = livesTogether == false || overlaps == false;
+			}
+			if ( fits == true ) {
+				placement.offset = begin;
+				break;
+			}
+		}
+		placement.placed = true;
+		groupRequirements.size = std::max( groupRequirements.size, placement.offset + placement.requirements.size );
+	}
+
+	memoryOptions_t options = MEMORY_OPTIMAL_TILING;
+	if ( lazilyAllocated == true ) {
+		options = options | MEMORY_LAZILY_ALLOCATED;
+	}
+	AllocateDeviceMemory( groupRequirements, options, MEMORY_CATEGORY_RENDER_TARGET, group.memory );
+	for ( size_t i = 0; i < imageCount; ++i ) {
+		Image * image = group.images[ i ];
+		// Every image keeps a copy of the group's allocation, so the defragmenter sees the block as pinned.  It's freed with the group, not the image.
+		image->m_memory = group.memory;
+		VK_CHECK( vkBindImageMemory( renderObjects.device, image->m_image, group.memory.memory, group.memory.offset + placements[ i ].offset ) );
+		image->CreateViews();
+		InitializeImageLayout( image, image->m_usage );
+		RegisterForDefragmentation( image );
+	}
+}
+
+void Image::DestroyHandles() {
+	UnregisterFromDefragmentation( this );
+	ReleaseFramebuffersUsingView( m_imageView );
+	DeferDestroyImageView( m_imageView );
+	if ( m_attachmentView != VK_NULL_HANDLE ) {
+		ReleaseFramebuffersUsingView( m_attachmentView );
+		DeferDestroyImageView( m_attachmentView );
+	}
+	DeferDestroyImage( m_image );
+}
+
+void Image::Destroy( Image * image ) {
+	assert( image->m_swapchainImages[ 0 ] == VK_NULL_HANDLE );	// The swapchain owns its images
+	assert( image->m_aliased == false );
+	if ( image->m_loading == true ) {
+		CancelImageLoad( image );
+	}
+	// Asynchronously loaded images don't have anything to release until their file has been decoded.
+	if ( image->m_image != VK_NULL_HANDLE ) {
+		CancelPendingUploads( image );
+		image->DestroyHandles();
+		DeferFreeDeviceMemory( image->m_memory );
+	}
+	if ( image->m_streamingStorage != NULL ) {
+		Destroy( image->m_streamingStorage );
+	}
+	if ( image->m_residencyManaged == true ) {
+		UnregisterResidentImage( image );
+	}
+	if ( image->m_streamingFile != NULL ) {
+		extern void UnmapFile( const void * data );
+		UnregisterStreamedImage( image );
+		UnmapFile( image->m_streamingFile );	// Nothing reads it anymore, now that every upload from it is staged or cancelled
+	}
+	delete image;
+}
+
+void Image::DestroyAliasGroup( imageAliasGroup_t & group ) {
+	for ( size_t i = 0; i < group.images.size(); ++i ) {
+		group.images[ i ]->DestroyHandles();
+		delete group.images[ i ];
+	}
+	DeferFreeDeviceMemory( group.memory );
+	group = {};
+}
+
 void Image::SelectSwapchainImage( uint32_t index ) {
 	m_image = m_swapchainImages[ index ];
 	m_imageView = m_swapchainViews[ index ];
 }
 
+bool Image::IsRelocatable() const {
+	if ( ( m_usage & IMAGE_USAGE_RENDER_TARGET ) != 0 || ( m_usage & IMAGE_USAGE_SHADER ) == 0 || m_linearTiling == true ) {
+		return false;
+	}
+	return m_layout == IMAGE_LAYOUT_FRAGMENT_SHADER_READ && IsUploadStaged() == true;
+}
+
+bool Image::Relocate( VkCommandBuffer commandBuffer, VkImage & retiredImage, VkImageView & retiredView, allocation_t & retiredMemory ) {
+	assert( IsRelocatable() == true );
+	VkImage image = CreateVkImage( m_width, m_height, m_format, m_usage );
+	VkMemoryRequirements memReq;
+	vkGetImageMemoryRequirements( renderObjects.device, image, &memReq );
+	allocation_t memory;
+	if ( ReallocateDeviceMemory( memReq, m_memory, memory ) == false ) {
+		vkDestroyImage( renderObjects.device, image, NULL );
+		return false;
+	}
+	VK_CHECK( vkBindImageMemory( renderObjects.device, image, memory.memory, memory.offset ) );
+
+	// The old image goes to transfer src for the copy and back to shader read afterward, because descriptor sets that haven't been
+	// pointed at the new image yet will keep sampling it for a few frames.
+	VkImageMemoryBarrier barriers[ 2 ] = {};
+	for ( uint32_t i = 0; i < ARRAY_COUNT( barriers ); ++i ) {
+		barriers[ i ].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[ i ].subresourceRange.aspectMask = TranslateFormatToAspect( m_format );
+		barriers[ i ].subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		barriers[ i ].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	}
+	barriers[ 0 ].image = m_image;
+	barriers[ 0 ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;	// The last chunk of its upload may have been recorded earlier this frame
+	barriers[ 0 ].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[ 0 ].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[ 0 ].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[ 1 ].image = image;
+	barriers[ 1 ].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[ 1 ].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[ 1 ].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ), barriers );
+
+	std::vector< VkImageCopy > regions( m_mipLevels );
+	for ( uint32_t level = 0; level < m_mipLevels; ++level ) {
+		VkImageCopy & region = regions[ level ];
+		region = {};
+		region.srcSubresource.aspectMask = TranslateFormatToAspect( m_format );
+		region.srcSubresource.mipLevel = level;
+		region.srcSubresource.layerCount = 1;
+		region.dstSubresource = region.srcSubresource;
+		region.extent.width = GetMipExtent( m_width, level );
+		region.extent.height = GetMipExtent( m_height, level );
+		region.extent.depth = 1;
+	}
+	vkCmdCopyImage( commandBuffer, m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels, regions.data() );
+
+	barriers[ 0 ].srcAccessMask = 0;	// Reads don't need to be made visible
+	barriers[ 0 ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[ 0 ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[ 0 ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[ 1 ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[ 1 ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[ 1 ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[ 1 ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ), barriers );
+
+	retiredImage = m_image;
+	retiredView = m_imageView;
+	retiredMemory = m_memory;
+	m_image = image;
+	m_imageView = CreateVkImageView( image, m_format, GetSampledAspect( m_format ) );	// Render targets are never moved, so there's no attachment view
+	m_memory = memory;
+	return true;
+}
+
 bool Image::IsColor() const {
 	return IsDepth() == false;
 }
 
 bool Image::IsDepth() const {
-	return m_format == IMAGE_FORMAT_DEPTH;
+	return IsDepthFormat( m_format );
 }
\ No newline at end of file
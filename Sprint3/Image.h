@@ -2,14 +2,47 @@
 
 #include "Renderer.h"
 #include "Memory.h"
+#include "TextureProcessing.h"
+#include <vector>
+#include <string>
 
 enum imageFormat_t {
 	IMAGE_FORMAT_RGBA8,
 	IMAGE_FORMAT_BGRA8,	// Needed for most architectures' swapchain image format
 	IMAGE_FORMAT_DEPTH,
+	// Block compressed formats can only be sampled, and their data comes from the TextureBaker tool.
+	IMAGE_FORMAT_BC1,
+	IMAGE_FORMAT_BC3,
+	IMAGE_FORMAT_BC4,
+	IMAGE_FORMAT_BC5,
+	IMAGE_FORMAT_BC7,
+	// Float formats for HDR targets.  Half floats cover the range of lighting without the bandwidth of 32-bit floats, and R11G11B10F
+	// halves it again for targets that don't need alpha.
+	IMAGE_FORMAT_RGBA16F,
+	IMAGE_FORMAT_R11G11B10F,
+	IMAGE_FORMAT_R16F,
+	IMAGE_FORMAT_RG16F,
+	// Smaller depth formats.  D24S8 isn't supported everywhere, so check with SupportsRenderTarget.
+	IMAGE_FORMAT_DEPTH16,
+	IMAGE_FORMAT_DEPTH24_STENCIL8,
 };
 
 VkImageAspectFlags TranslateFormatToAspect( imageFormat_t format );
+bool IsDepthFormat( imageFormat_t format );
+bool HasStencil( imageFormat_t format );
+// Image data is laid out in blocks of blockExtent x blockExtent texels, each blockSize bytes.  Uncompressed formats have 1x1 blocks.
+void GetFormatBlockInfo( imageFormat_t format, uint32_t & blockExtent, uint32_t & blockSize );
+bool IsCompressedFormat( imageFormat_t format );
+bool SupportsSampling( imageFormat_t format );
+// Whether the format can be a color or depth stencil attachment, as its aspect calls for.
+bool SupportsRenderTarget( imageFormat_t format );
+// The first of the candidates that SupportsRenderTarget, for picking a fallback.  The candidates must all be color or all be depth.  If
+// none are supported, returns IMAGE_FORMAT_DEPTH16 or IMAGE_FORMAT_RGBA8, which every device can render to.
+imageFormat_t SelectRenderTargetFormat( const imageFormat_t * candidates, uint32_t candidateCount );
+// Baked textures store a VkFormat, which has to be one we have an imageFormat_t for.
+bool TranslateVkFormat( uint32_t vkFormat, imageFormat_t & format );
+// Whether mip levels of the format can be made on the GPU with a linearly filtered vkCmdBlitImage.
+bool SupportsLinearBlit( imageFormat_t format );
 
 enum imageLayout_t {
 	IMAGE_LAYOUT_FRAGMENT_SHADER_READ,
@@ -19,33 +52,165 @@ enum imageLayout_t {
 };
 
 class Swapchain;
+class Image;
+struct textureFileHeader_t;
+
+// Everything needed to create a sampled image from a file, produced without touching the device, so files can be decoded on any thread.
+// The data holds levelCount mip levels laid out as StageImageData expects.  With a single level, the rest of the chain is generated
+// if the format can be blitted.
+struct decodedImage_t {
+	const void *			data;
+	uint32_t				size;
+	uint32_t				width;
+	uint32_t				height;
+	uint32_t				levelCount;
+	imageFormat_t			format;
+	uploadDataRelease_t		release;
+	void *					releaseContext;
+};
+
+// Files written by TextureBaker are mapped and their levels used in place; anything else is decoded with stb_image.  Returns false if
+// the file can't be read, and points failure at why.  Safe to call from any thread.
+bool DecodeImageFile( const char * filename, decodedImage_t & decoded, const char ** failure = NULL );
+// For callers that keep a baked file mapped and read its levels themselves.  Points decoded at the levels, and returns false with
+// failure pointing at why if the file isn't baked, or is stale or damaged.  The mapping is left alone either way.
+bool DecodeBakedImageFile( const void * file, uint64_t fileSize, decodedImage_t & decoded, const char ** failure );
+
+// Render targets that are only needed for part of a frame can share memory with others whose lifetimes don't overlap.  Each image is
+// described by the first and last pass of the frame that touch it, and FinalizeAliasGroup packs them all into a single allocation.
+// Aliased images hold garbage whenever another image of the group has been used in between, so the first use in a frame has to be
+// a barrier with BARRIER_DISCARD_AND_IGNORE_OLD_LAYOUT.
+struct imageAliasGroup_t {
+	std::vector< Image * >		images;
+	std::vector< uint32_t >		firstPasses;
+	std::vector< uint32_t >		lastPasses;
+	allocation_t				memory = {};
+	uint64_t					unaliasedBytes = 0;	// What the images would take on their own, to see what aliasing saves
+};
 
 class Image {
 public:
 	static Image * Create( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage );
 	static Image * CreateFromSwapchain();
+	// The image is filled by the stager, which owns its layout until the upload is staged.  Until then, the image samples as
+	// renderObjects.placeholderImage, like one loaded asynchronously.  JPEGs are decoded straight into staging memory when there's room.
+	// Returns NULL if the file can't be read or decoded.
 	static Image * CreateFromFile( const char * filename );
+	static Image * CreateFromData( const decodedImage_t & decoded );
+	// The file is decoded on a worker thread.  Until its data has been staged, the image samples as renderObjects.placeholderImage,
+	// and descriptor sets pointing at it are rewritten once it's ready.
+	static Image * CreateFromFileAsync( const char * filename );
+	// Only for files written by TextureBaker.  The image starts out with just its smallest levels, and the texture streamer brings in
+	// more detailed ones as the shaders ask for them.  The file stays mapped for as long as the image lives.  Returns NULL if the file
+	// can't be read, isn't baked with a full chain, or has a format the device can't sample.
+	static Image * CreateStreamed( const char * filename );
+	bool IsStreamed() const { return m_streamingFile != NULL; }
+	// The most detailed level of the full chain that's resident.  The image only holds the levels from here down, so this doubles
+	// as its min LOD clamp: the view can't reach a level that hasn't been loaded.
+	uint32_t GetResidentLevel() const { return m_residentLevel; }
+	uint32_t GetStreamingId() const { return m_streamingId; }
+	bool IsStreamingIn() const { return m_streamingStorage != NULL; }
+	// Start uploading the next more detailed level.  Returns false if everything is resident or a level is already on its way.
+	bool StreamInLevel();
+	// Residency.  Images loaded from files can be evicted to stay within the texture budget, since they can be loaded again.
+	// Descriptor sets mark their images used whenever they're set or bound.
+	void MarkUsed() const { m_lastUsedFrame = renderObjects.frameNumber; }
+	uint64_t GetLastUsedFrame() const { return m_lastUsedFrame; }
+	bool CanEvict() const;
+	// Streamed images drop their most detailed level.  Anything else is released entirely, and samples as the placeholder until reloaded.
+	void Evict();
+	bool IsEvicted() const { return m_evicted; }
+	bool WantsReload() const { return m_evicted == true && m_lastUsedFrame > m_evictedFrame; }
+	// Queue the file for loading again, with the image loader.
+	void Reload();
+	uint64_t GetEvictedBytes() const { return m_evictedBytes; }
+	uint64_t GetResidentBytes() const;
+	// Roughly what StreamInLevel will allocate.
+	uint64_t GetStreamInBytes() const;
+	// Called by the image loader on the render thread once the file has been decoded.
+	void FinishAsyncLoad( const decodedImage_t & decoded );
+	bool IsLoading() const { return m_loading; }
+	void SetLoaded() { m_loading = false; }
+	// The image can't be used until the group has been finalized.
+	static Image * CreateAliased( imageAliasGroup_t & group, uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage, uint32_t firstPass, uint32_t lastPass );
+	static void FinalizeAliasGroup( imageAliasGroup_t & group );
+	// The Vulkan objects are released once no frame in flight can be using them.  Aliased images are destroyed with their group.
+	static void Destroy( Image * image );
+	static void DestroyAliasGroup( imageAliasGroup_t & group );
 	imageFormat_t GetFormat() const { return m_format; }
 	uint32_t GetWidth() const { return m_width; }
 	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetMipLevels() const { return m_mipLevels; }
 	VkImage GetImage() const { return m_image; }
-	VkImageView GetView() const { return m_imageView; }
+	// The view to sample.  Depth stencil images are sampled through their depth aspect only.
+	VkImageView GetView() const;
+	// The view to render to, which only differs from GetView for depth stencil images that are also sampled.
+	VkImageView GetAttachmentView() const { return m_attachmentView != VK_NULL_HANDLE ? m_attachmentView : m_imageView; }
 	void SelectSwapchainImage( uint32_t index );
 	imageLayout_t GetLayout() const { return m_layout; }
 	void SetLayout( imageLayout_t layout ) { m_layout = layout; }
 	bool IsColor() const;
 	bool IsDepth() const;
+	bool IsAliased() const { return m_aliased; }
+	bool IsTransient() const { return ( m_usage & IMAGE_USAGE_TRANSIENT ) != 0; }
 	VkImage GetSwapchainImage( uint32_t index ) { return m_swapchainImages[ index ]; }
+	// Images created from data can't be sampled until their upload has at least been staged.
+	bool IsUploadStaged() const { return GetUploadStatus( m_uploadHandle ) != UPLOAD_PENDING; }
+	const allocation_t & GetMemory() const { return m_memory; }
+	// Only sampled images whose data is fully staged can be moved.  Render targets are written every frame and are left alone, as are
+	// linear images written by the CPU.
+	bool IsRelocatable() const;
+	// Move the contents into a new image in a fuller memory block with a GPU copy.  The old image, view and memory are handed back,
+	// and must be kept alive until the GPU can no longer be using them.  Returns false if there was nowhere to move to.
+	bool Relocate( VkCommandBuffer commandBuffer, VkImage & retiredImage, VkImageView & retiredView, allocation_t & retiredMemory );
 
 private:
 	imageFormat_t m_format;
 	VkImage m_image = VK_NULL_HANDLE;
 	allocation_t m_memory = {};
 	VkImageView m_imageView = VK_NULL_HANDLE;
+	VkImageView m_attachmentView = VK_NULL_HANDLE;	// Only for sampled depth stencil render targets
 	imageLayout_t m_layout = {};
+	imageUsageFlags_t m_usage = {};
+	bool m_aliased = false;
+	bool m_loading = false;	// Waiting on an asynchronous load
+	bool m_linearTiling = false;	// Written directly by the CPU, without staging.  Such images are never relocated
+	// Streamed images only.
+	const textureFileHeader_t * m_streamingFile = NULL;
+	uint32_t m_residentLevel = 0;
+	uint32_t m_streamingId = 0;
+	uint32_t m_streamingTailLevel = 0;	// The levels from here down are never evicted
+	Image * m_streamingStorage = NULL;	// Larger storage being filled with the next level, which replaces the current storage once staged
+	// Residency.
+	std::string m_sourceFile;
+	bool m_residencyManaged = false;
+	bool m_evicted = false;
+	uint64_t m_evictedFrame = 0;
+	uint64_t m_evictedBytes = 0;
+	mutable uint64_t m_lastUsedFrame = 0;
+
+private:
+	void DestroyHandles();
+	static Image * CreateWithoutLayout( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage );
+	void CreateStorage( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage );
+	void CreateViews();
+	void CreateStorageForData( uint32_t width, uint32_t height, imageFormat_t format, uint32_t levelCount );
+	// Images with their whole mip chain are written straight into their memory when the device can sample them with linear tiling from
+	// memory the CPU can write, like on integrated GPUs.  Anything else goes through staging.
+	void LoadDecoded( const decodedImage_t & decoded );
+	// Returns false, before anything is allocated, if the linear image can't be put in memory the CPU can write.
+	bool LoadDecodedDirect( const decodedImage_t & decoded );
+	// Hand the image to the image loader, which lets it be sampled once its upload is staged.
+	void SampleAsPlaceholderUntilStaged();
+	static uint8_t * ReserveDecodeStaging( void * context, int width, int height, int * stride );
+	static Image * CreateFromJpeg( const uint8_t * file, uint64_t fileSize );
+	static void FinishStreamIn( void * context );
+	void AdoptStorage( Image * storage );
 
 	uint32_t m_width = 0;
 	uint32_t m_height = 0;
+	uint32_t m_mipLevels = 1;
+	uploadHandle_t m_uploadHandle = 0;
 
 	// These are specific to the Image created from the swapchain.
 	// This causes 32B of bloat for non-swapchain images, which will be most, but it's not that crucial
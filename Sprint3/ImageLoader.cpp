@@ -0,0 +1,177 @@
+#include "ImageLoader.h"
+#include "Image.h"
+#include "Defragmenter.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <stdio.h>
+
+struct loadJob_t {
+	std::string			filename;
+	Image *				image;		// NULL once the image has been destroyed
+	decodedImage_t		decoded;
+	bool				succeeded;
+	const char *		failure;	// Why the decode failed, which is always a string literal
+};
+
+struct imageLoader_t {
+	std::mutex					mutex;			// Guards the two queues, and the image pointer of every job in them
+	std::condition_variable		jobQueued;
+	std::deque< loadJob_t * >	queuedJobs;		// Waiting for a worker
+	std::vector< loadJob_t * >	decodingJobs;	// Taken by a worker
+	std::vector< loadJob_t * >	finishedJobs;	// Decoded, waiting for the render thread
+	std::vector< Image * >		uploadingImages;	// Only touched by the render thread
+	std::vector< std::thread >	workers;
+	bool						stopping = false;
+};
+
+static imageLoader_t imageLoader;
+
+static void ImageLoaderWorker() {
+	for ( ;; ) {
+		loadJob_t * job;
+		{
+			std::unique_lock< std::mutex > lock( imageLoader.mutex );
+			imageLoader.jobQueued.wait( lock, []() { return imageLoader.stopping == true || imageLoader.queuedJobs.empty() == false; } );
+			if ( imageLoader.stopping == true ) {
+				return;
+			}
+			job = imageLoader.queuedJobs.front();
+			imageLoader.queuedJobs.pop_front();
+			imageLoader.decodingJobs.push_back( job );
+		}
+
+		// The decode itself runs without the lock, which is the whole point.  Cancelled jobs are still decoded, and the result thrown away.
+		job->succeeded = DecodeImageFile( job->filename.c_str(), job->decoded, &job->failure );
+
+		std::lock_guard< std::mutex > lock( imageLoader.mutex );
+		imageLoader.decodingJobs.erase( std::find( imageLoader.decodingJobs.begin(), imageLoader.decodingJobs.end(), job ) );
+		imageLoader.finishedJobs.push_back( job );
+	}
+}
+
+void InitializeImageLoader() {
+	// Leave a core for the render thread.
+	const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+	const uint32_t workerCount = hardwareThreads > 2 ? hardwareThreads - 1 : 1;
+	for ( uint32_t i = 0; i < workerCount; ++i ) {
+		imageLoader.workers.push_back( std::thread( ImageLoaderWorker ) );
+	}
+}
+
+static void ReleaseJob( loadJob_t * job ) {
+	if ( job->succeeded == true && job->decoded.release != NULL ) {
+		job->decoded.release( job->decoded.releaseContext );
+	}
+	delete job;
+}
+
+void ShutdownImageLoader() {
+	{
+		std::lock_guard< std::mutex > lock( imageLoader.mutex );
+		imageLoader.stopping = true;
+	}
+	imageLoader.jobQueued.notify_all();
+	// Workers finish the file they're decoding first, so every job ends up queued or finished.
+	for ( size_t i = 0; i < imageLoader.workers.size(); ++i ) {
+		imageLoader.workers[ i ].join();
+	}
+	imageLoader.workers.clear();
+	for ( size_t i = 0; i < imageLoader.queuedJobs.size(); ++i ) {
+		delete imageLoader.queuedJobs[ i ];
+	}
+	imageLoader.queuedJobs.clear();
+	for ( size_t i = 0; i < imageLoader.finishedJobs.size(); ++i ) {
+		ReleaseJob( imageLoader.finishedJobs[ i ] );
+	}
+	imageLoader.finishedJobs.clear();
+	imageLoader.uploadingImages.clear();
+}
+
+void QueueImageLoad( Image * image, const char * filename ) {
+	loadJob_t * job = new loadJob_t;
+	job->filename = filename;
+	job->image = image;
+	job->decoded = {};
+	job->succeeded = false;
+	job->failure = NULL;
+	{
+		std::lock_guard< std::mutex > lock( imageLoader.mutex );
+		imageLoader.queuedJobs.push_back( job );
+	}
+	imageLoader.jobQueued.notify_one();
+}
+
+void WatchImageUpload( Image * image ) {
+	assert( image->IsLoading() == true );
+	imageLoader.uploadingImages.push_back( image );
+}
+
+static void ForgetImage( std::vector< loadJob_t * > & jobs, Image * image ) {
+	for ( size_t i = 0; i < jobs.size(); ++i ) {
+		if ( jobs[ i ]->image == image ) {
+			jobs[ i ]->image = NULL;
+		}
+	}
+}
+
+void CancelImageLoad( Image * image ) {
+	{
+		std::lock_guard< std::mutex > lock( imageLoader.mutex );
+		// Queued jobs haven't been started, so they can go right away.
+		for ( size_t i = 0; i < imageLoader.queuedJobs.size(); ++i ) {
+			if ( imageLoader.queuedJobs[ i ]->image == image ) {
+				delete imageLoader.queuedJobs[ i ];
+				imageLoader.queuedJobs.erase( imageLoader.queuedJobs.begin() + i );
+				break;
+			}
+		}
+		ForgetImage( imageLoader.decodingJobs, image );
+		ForgetImage( imageLoader.finishedJobs, image );
+	}
+	// Images already handed to the stager have their upload cancelled by Image::Destroy.
+	std::vector< Image * > & uploading = imageLoader.uploadingImages;
+	uploading.erase( std::remove( uploading.begin(), uploading.end(), image ), uploading.end() );
+}
+
+void UpdateImageLoader() {
+	std::vector< loadJob_t * > finished;
+	{
+		std::lock_guard< std::mutex > lock( imageLoader.mutex );
+		finished.swap( imageLoader.finishedJobs );
+	}
+	for ( size_t i = 0; i < finished.size(); ++i ) {
+		loadJob_t * job = finished[ i ];
+		if ( job->succeeded == false ) {
+			// A missing or corrupt file keeps showing the placeholder, rather than taking the whole program down.
+			extern void PrintDebugMessage( const char * message );
+			char message[ 512 ];
+			snprintf( message, sizeof( message ), "Couldn't load image %s: %s\n", job->filename.c_str(), job->failure );
+			PrintDebugMessage( message );
+		} else if ( job->image != NULL ) {
+			job->image->FinishAsyncLoad( job->decoded );
+			imageLoader.uploadingImages.push_back( job->image );
+			delete job;
+			continue;
+		}
+		ReleaseJob( job );
+	}
+
+	// The view only changes once the data is staged, since the stager leaves the image ready to sample in the same frame it finishes.
+	std::vector< Image * > & uploading = imageLoader.uploadingImages;
+	for ( size_t i = 0; i < uploading.size(); ) {
+		Image * image = uploading[ i ];
+		if ( image->IsUploadStaged() == false ) {
+			++i;
+			continue;
+		}
+		image->SetLoaded();
+		RefreshDescriptorSetsReferencing( image );
+		uploading[ i ] = uploading.back();
+		uploading.pop_back();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Renderer.h"
+
+class Image;
+
+// Image files are read and decoded on a pool of worker threads, so loading a level's worth of textures doesn't stall the frame.
+// The device is only touched on the render thread: UpdateImageLoader hands each decoded file to the stager and, once its data is
+// staged, lets the image be sampled in place of the placeholder.
+void InitializeImageLoader();
+// Stop and join the workers, and release everything they decoded that was never uploaded.  The images waiting on those loads keep
+// showing the placeholder.
+void ShutdownImageLoader();
+// Called by Image::CreateFromFileAsync.  The image has no storage until its file has been decoded.
+void QueueImageLoad( Image * image, const char * filename );
+// Called for images created on the render thread whose upload hasn't been staged yet.  They sample as the placeholder until it has.
+void WatchImageUpload( Image * image );
+// Called when an image is destroyed before its load finished.  Its decoded data is released without being uploaded.
+void CancelImageLoad( Image * image );
+// Create and stage images whose files have been decoded, and finish the loads whose uploads are staged.  Call after BeginStagingFrame.
+void UpdateImageLoader();
\ No newline at end of file
@@ -1,15 +1,149 @@
 #include "Memory.h"
 #include "Image.h"
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <set>
+#include <vector>
+#include <algorithm>
 
 stagingBuffer_t stagingBuffer;
 
-void AllocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, memoryOptions_t options, allocation_t & allocation ) {
+// Device memory is sub-allocated out of large blocks, because drivers limit the total number of allocations (maxMemoryAllocationCount
+// can be as low as 4096) and vkAllocateMemory is expensive.  Each block is managed by a buddy allocator: the block is recursively split
+// in halves down to a minimum node size, and a freed node merges back with its "buddy" whenever both halves are free.  Nodes at a level
+// are always aligned to their own size, so any power-of-two alignment up to the node size comes for free.
+// Linear resources (buffers) and optimally tiled images are kept in separate blocks, so bufferImageGranularity never has to be considered.
+static const uint32_t MEMORY_BLOCK_SHIFT = 26;	// 64MB blocks
+static const uint32_t MEMORY_MIN_NODE_SHIFT = 8;	// 256B smallest allocation
+static const uint32_t MEMORY_LEVEL_COUNT = MEMORY_BLOCK_SHIFT - MEMORY_MIN_NODE_SHIFT + 1;
+static const VkDeviceSize MEMORY_BLOCK_SIZE = 1ULL << MEMORY_BLOCK_SHIFT;
+static const VkDeviceSize MEMORY_DEDICATED_THRESHOLD = MEMORY_BLOCK_SIZE / 4;	// Anything larger wastes too much of a block, so it gets its own memory
+
+struct memoryBlock_t {
+	VkDeviceMemory				memory;
+	uint32_t					memoryTypeIndex;
+	bool						optimalTiling;
+	void *						mappedData;
+	uint32_t					allocationCount;
+	VkDeviceSize				allocatedBytes;
+	// Free node offsets per level, where level 0 is the whole block.  Sets keep the buddy lookup cheap and hand out low addresses first.
+	std::set< VkDeviceSize >	freeNodes[ MEMORY_LEVEL_COUNT ];
+};
+
+static std::vector< memoryBlock_t * > memoryBlocks;
+static uint32_t dedicatedAllocationCount = 0;
+static VkDeviceSize dedicatedAllocationBytes = 0;
+static memoryCategoryUsage_t categoryUsage[ MEMORY_CATEGORY_COUNT ];
+static VkDeviceSize heapAllocatedBytes[ VK_MAX_MEMORY_HEAPS ];
+static VkDeviceSize heapUsedBytes[ VK_MAX_MEMORY_HEAPS ];
+
+static VkDeviceSize NodeSize( uint32_t level ) {
+	return MEMORY_BLOCK_SIZE >> level;
+}
+
+static uint32_t FindMemoryType( uint32_t memoryTypeBits, VkMemoryPropertyFlags flags ) {
+	// Lazily allocated memory is only for transient attachments, so it's never picked unless it was asked for.
+	const VkMemoryPropertyFlags excludedFlags = ( flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT ) != 0 ? 0 : VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+	for ( uint32_t i = 0; i < renderObjects.memoryProperties.memoryTypeCount; ++i ) {
+		if ( ( ( 1 << i ) & memoryTypeBits ) != 0 ) {
+			const VkMemoryPropertyFlags propertyFlags = renderObjects.memoryProperties.memoryTypes[ i ].propertyFlags;
+			if ( ( propertyFlags & flags ) == flags && ( propertyFlags & excludedFlags ) == 0 ) {
+				return i;
+			}
+		}
+	}
+	return ~0U;
+}
+
+static VkDeviceMemory AllocateAndMap( VkDeviceSize size, uint32_t memoryTypeIndex, void ** mappedData ) {
 	VkMemoryAllocateInfo memoryAllocateInfo = {};
 	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocateInfo.allocationSize = memoryRequirements.size;
-	memoryAllocateInfo.memoryTypeIndex = -1;
+	memoryAllocateInfo.allocationSize = size;
+	memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	VK_CHECK( vkAllocateMemory( renderObjects.device, &memoryAllocateInfo, NULL, &memory ) );
+
+	// Host visible memory is mapped once for its whole lifetime.  Memory can only be mapped once at a time, and with many resources
+	// sharing one VkDeviceMemory, mapping per resource is no longer an option anyway.
+	heapAllocatedBytes[ renderObjects.memoryProperties.memoryTypes[ memoryTypeIndex ].heapIndex ] += size;
+	*mappedData = NULL;
+	if ( ( renderObjects.memoryProperties.memoryTypes[ memoryTypeIndex ].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ) != 0 ) {
+		VK_CHECK( vkMapMemory( renderObjects.device, memory, 0, VK_WHOLE_SIZE, 0, mappedData ) );
+	}
+	return memory;
+}
+
+static memoryBlock_t * CreateMemoryBlock( uint32_t memoryTypeIndex, bool optimalTiling ) {
+	memoryBlock_t * block = new memoryBlock_t;
+	block->memoryTypeIndex = memoryTypeIndex;
+	block->optimalTiling = optimalTiling;
+	block->allocationCount = 0;
+	block->allocatedBytes = 0;
+	block->memory = AllocateAndMap( MEMORY_BLOCK_SIZE, memoryTypeIndex, &block->mappedData );
+	block->freeNodes[ 0 ].insert( 0 );
+	memoryBlocks.push_back( block );
+	return block;
+}
+
+// Find a free node at the given level, splitting larger nodes as needed.  Returns false if the block has no room.
+static bool AllocateNode( memoryBlock_t * block, uint32_t level, VkDeviceSize & offset ) {
+	uint32_t sourceLevel = level;
+	while ( block->freeNodes[ sourceLevel ].empty() == true ) {
+		if ( sourceLevel == 0 ) {
+			return false;
+		}
+		--sourceLevel;
+	}
+	offset = *block->freeNodes[ sourceLevel ].begin();
+	block->freeNodes[ sourceLevel ].erase( block->freeNodes[ sourceLevel ].begin() );
+	// Split down to the requested level, keeping the lower half each time and freeing the upper half.
+	while ( sourceLevel < level ) {
+		++sourceLevel;
+		block->freeNodes[ sourceLevel ].insert( offset + NodeSize( sourceLevel ) );
+	}
+	return true;
+}
+
+static void FreeNode( memoryBlock_t * block, uint32_t level, VkDeviceSize offset ) {
+	while ( level > 0 ) {
+		const VkDeviceSize buddy = offset ^ NodeSize( level );
+		std::set< VkDeviceSize >::iterator buddyIt = block->freeNodes[ level ].find( buddy );
+		if ( buddyIt == block->freeNodes[ level ].end() ) {
+			break;
+		}
+		block->freeNodes[ level ].erase( buddyIt );
+		offset = offset < buddy ? offset : buddy;
+		--level;
+	}
+	block->freeNodes[ level ].insert( offset );
+}
 
+static void ReleaseMemory( VkDeviceMemory memory, VkDeviceSize size, uint32_t heapIndex ) {
+	vkFreeMemory( renderObjects.device, memory, NULL );	// Freeing implicitly unmaps
+	heapAllocatedBytes[ heapIndex ] -= size;
+}
+
+static void TrackAllocation( const allocation_t & allocation ) {
+	++categoryUsage[ allocation.category ].allocationCount;
+	categoryUsage[ allocation.category ].bytes += allocation.size;
+	heapUsedBytes[ allocation.heapIndex ] += allocation.size;
+}
+
+static void UntrackAllocation( const allocation_t & allocation ) {
+	--categoryUsage[ allocation.category ].allocationCount;
+	categoryUsage[ allocation.category ].bytes -= allocation.size;
+	heapUsedBytes[ allocation.heapIndex ] -= allocation.size;
+}
+
+static const VkMemoryPropertyFlags DEVICE_MAPPABLE_FLAGS = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+bool SupportsDeviceMappable( uint32_t memoryTypeBits ) {
+	return renderObjects.deviceLocalMappable == true && FindMemoryType( memoryTypeBits, DEVICE_MAPPABLE_FLAGS ) != ~0U;
+}
+
+void AllocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, memoryOptions_t options, memoryCategory_t category, allocation_t & allocation ) {
 	VkMemoryPropertyFlags flags = 0;
 	if ( ( options & MEMORY_MAPPABLE ) != 0 ) {
 		flags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
@@ -17,55 +151,680 @@ void AllocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, memo
 	} else {
 		flags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 	}
+	uint32_t memoryTypeIndex = ~0U;
+	if ( ( options & MEMORY_LAZILY_ALLOCATED ) != 0 ) {
+		// Tiled GPUs can keep transient attachments in on-chip memory and never commit any of this.  Desktop GPUs don't offer it.
+		memoryTypeIndex = FindMemoryType( memoryRequirements.memoryTypeBits, flags | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT );
+	}
+	if ( ( options & MEMORY_DEVICE_MAPPABLE ) != 0 && renderObjects.deviceLocalMappable == true ) {
+		memoryTypeIndex = FindMemoryType( memoryRequirements.memoryTypeBits, DEVICE_MAPPABLE_FLAGS );
+	}
+	if ( memoryTypeIndex == ~0U ) {
+		memoryTypeIndex = FindMemoryType( memoryRequirements.memoryTypeBits, flags );
+	}
+	assert( memoryTypeIndex != ~0U );
 
-	for ( uint32_t i = 0; i < renderObjects.memoryProperties.memoryTypeCount; ++i ) {
-		if ( ( ( 1 << i ) & memoryRequirements.memoryTypeBits ) != 0 ) {
-			if ( ( renderObjects.memoryProperties.memoryTypes[ i ].propertyFlags & flags ) == flags ) {
-				memoryAllocateInfo.memoryTypeIndex = i;
+	allocation = {};
+	allocation.category = category;
+	allocation.heapIndex = renderObjects.memoryProperties.memoryTypes[ memoryTypeIndex ].heapIndex;
+	if ( ( options & MEMORY_DEDICATED ) != 0 || memoryRequirements.size > MEMORY_DEDICATED_THRESHOLD ) {
+		allocation.memory = AllocateAndMap( memoryRequirements.size, memoryTypeIndex, &allocation.mappedData );
+		allocation.offset = 0;
+		allocation.size = memoryRequirements.size;
+		allocation.block = NULL;
+		++dedicatedAllocationCount;
+		dedicatedAllocationBytes += allocation.size;
+		TrackAllocation( allocation );
+		return;
+	}
+
+	// Pick the deepest level whose nodes can hold both the size and the alignment.
+	uint32_t level = MEMORY_LEVEL_COUNT - 1;
+	while ( level > 0 && ( NodeSize( level ) < memoryRequirements.size || NodeSize( level ) < memoryRequirements.alignment ) ) {
+		--level;
+	}
+
+	const bool optimalTiling = ( options & MEMORY_OPTIMAL_TILING ) != 0;
+	memoryBlock_t * block = NULL;
+	VkDeviceSize offset = 0;
+	for ( size_t i = 0; i < memoryBlocks.size(); ++i ) {
+		memoryBlock_t * candidate = memoryBlocks[ i ];
+		if ( candidate->memoryTypeIndex != memoryTypeIndex || candidate->optimalTiling != optimalTiling ) {
+			continue;
+		}
+		if ( AllocateNode( candidate, level, offset ) == true ) {
+			block = candidate;
+			break;
+		}
+	}
+	if ( block == NULL ) {
+		block = CreateMemoryBlock( memoryTypeIndex, optimalTiling );
+		const bool allocated = AllocateNode( block, level, offset );	// A fresh block always has room for anything under the dedicated threshold
+		assert( allocated == true );
+	}
+
+	++block->allocationCount;
+	block->allocatedBytes += NodeSize( level );
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = NodeSize( level );
+	allocation.mappedData = block->mappedData != NULL ? ( uint8_t * )block->mappedData + offset : NULL;
+	allocation.block = block;
+	TrackAllocation( allocation );
+}
+
+void FreeDeviceMemory( allocation_t & allocation ) {
+	if ( allocation.memory == VK_NULL_HANDLE ) {
+		return;
+	}
+
+	UntrackAllocation( allocation );
+	memoryBlock_t * block = allocation.block;
+	if ( block == NULL ) {
+		ReleaseMemory( allocation.memory, allocation.size, allocation.heapIndex );
+		--dedicatedAllocationCount;
+		dedicatedAllocationBytes -= allocation.size;
+		allocation = {};
+		return;
+	}
+
+	uint32_t level = 0;
+	while ( NodeSize( level ) > allocation.size ) {
+		++level;
+	}
+	FreeNode( block, level, allocation.offset );
+	--block->allocationCount;
+	block->allocatedBytes -= allocation.size;
+	allocation = {};
+
+	// Give an empty block back to the driver, but keep one around per memory type so that a single resource being
+	// created and destroyed repeatedly doesn't turn into a vkAllocateMemory/vkFreeMemory pair every time.
+	if ( block->allocationCount == 0 ) {
+		for ( size_t i = 0; i < memoryBlocks.size(); ++i ) {
+			memoryBlock_t * other = memoryBlocks[ i ];
+			if ( other != block && other->memoryTypeIndex == block->memoryTypeIndex && other->optimalTiling == block->optimalTiling ) {
+				ReleaseMemory( block->memory, MEMORY_BLOCK_SIZE, renderObjects.memoryProperties.memoryTypes[ block->memoryTypeIndex ].heapIndex );
+				memoryBlocks.erase( std::find( memoryBlocks.begin(), memoryBlocks.end(), block ) );
+				delete block;
+				break;
+			}
+		}
+	}
+}
+
+void GetMemoryStatistics( memoryStatistics_t & statistics ) {
+	statistics = {};
+	for ( size_t i = 0; i < memoryBlocks.size(); ++i ) {
+		const memoryBlock_t * block = memoryBlocks[ i ];
+		++statistics.blockCount;
+		statistics.blockBytes += MEMORY_BLOCK_SIZE;
+		statistics.allocationCount += block->allocationCount;
+		statistics.allocationBytes += block->allocatedBytes;
+		for ( uint32_t level = 0; level < MEMORY_LEVEL_COUNT; ++level ) {
+			if ( block->freeNodes[ level ].empty() == false ) {
+				if ( NodeSize( level ) > statistics.largestFreeRange ) {
+					statistics.largestFreeRange = NodeSize( level );
+				}
 				break;
 			}
 		}
 	}
+	statistics.dedicatedAllocationCount = dedicatedAllocationCount;
+	statistics.dedicatedAllocationBytes = dedicatedAllocationBytes;
+}
+
+// Blocks less full than this are evacuated by the defragmenter.
+static const float MEMORY_DEFRAGMENTATION_OCCUPANCY = 0.5f;
+
+static bool IsSameBlockKind( const memoryBlock_t * a, const memoryBlock_t * b ) {
+	return a->memoryTypeIndex == b->memoryTypeIndex && a->optimalTiling == b->optimalTiling;
+}
+
+void GetDefragmentationCandidates( std::vector< memoryBlock_t * > & blocks ) {
+	blocks.clear();
+	for ( size_t i = 0; i < memoryBlocks.size(); ++i ) {
+		memoryBlock_t * block = memoryBlocks[ i ];
+		if ( block->allocationCount == 0 || block->allocatedBytes > MEMORY_BLOCK_SIZE * MEMORY_DEFRAGMENTATION_OCCUPANCY ) {
+			continue;
+		}
+		for ( size_t j = 0; j < memoryBlocks.size(); ++j ) {
+			if ( memoryBlocks[ j ] != block && IsSameBlockKind( memoryBlocks[ j ], block ) == true ) {
+				blocks.push_back( block );
+				break;
+			}
+		}
+	}
+	std::sort( blocks.begin(), blocks.end(), []( const memoryBlock_t * a, const memoryBlock_t * b ) {
+		return a->allocatedBytes < b->allocatedBytes;
+	} );
+}
+
+bool ReallocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, const allocation_t & current, allocation_t & moved ) {
+	const memoryBlock_t * source = current.block;
+	assert( source != NULL );	// Dedicated allocations have nothing to be compacted into
+
+	uint32_t level = MEMORY_LEVEL_COUNT - 1;
+	while ( level > 0 && ( NodeSize( level ) < memoryRequirements.size || NodeSize( level ) < memoryRequirements.alignment ) ) {
+		--level;
+	}
+
+	// Fill the fullest blocks first, so the sparse ones drain and can be released.
+	std::vector< memoryBlock_t * > targets;
+	for ( size_t i = 0; i < memoryBlocks.size(); ++i ) {
+		memoryBlock_t * candidate = memoryBlocks[ i ];
+		if ( candidate != source && IsSameBlockKind( candidate, source ) == true && ( ( 1U << candidate->memoryTypeIndex ) & memoryRequirements.memoryTypeBits ) != 0 ) {
+			targets.push_back( candidate );
+		}
+	}
+	std::sort( targets.begin(), targets.end(), []( const memoryBlock_t * a, const memoryBlock_t * b ) {
+		return a->allocatedBytes > b->allocatedBytes;
+	} );
+
+	for ( size_t i = 0; i < targets.size(); ++i ) {
+		memoryBlock_t * block = targets[ i ];
+		VkDeviceSize offset;
+		if ( AllocateNode( block, level, offset ) == false ) {
+			continue;
+		}
+		++block->allocationCount;
+		block->allocatedBytes += NodeSize( level );
+		moved = {};
+		moved.memory = block->memory;
+		moved.offset = offset;
+		moved.size = NodeSize( level );
+		moved.mappedData = block->mappedData != NULL ? ( uint8_t * )block->mappedData + offset : NULL;
+		moved.block = block;
+		moved.category = current.category;
+		moved.heapIndex = current.heapIndex;
+		TrackAllocation( moved );
+		return true;
+	}
+	return false;
+}
+
+void GetMemoryUsage( memoryUsage_t & usage ) {
+	usage = {};
+	for ( uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i ) {
+		usage.categories[ i ] = categoryUsage[ i ];
+	}
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	if ( renderObjects.memoryBudgetSupported == true ) {
+		VkPhysicalDeviceMemoryProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties2.pNext = &budgetProperties;
+		renderObjects.getMemoryProperties2( renderObjects.physicalDevice, &properties2 );
+		usage.budgetFromDriver = true;
+	}
+
+	usage.heapCount = renderObjects.memoryProperties.memoryHeapCount;
+	for ( uint32_t i = 0; i < usage.heapCount; ++i ) {
+		const VkMemoryHeap & heap = renderObjects.memoryProperties.memoryHeaps[ i ];
+		memoryHeapUsage_t & heapUsage = usage.heaps[ i ];
+		heapUsage.size = heap.size;
+		heapUsage.deviceLocal = ( heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ) != 0;
+		heapUsage.allocatedBytes = heapAllocatedBytes[ i ];
+		heapUsage.usedBytes = heapUsedBytes[ i ];
+		if ( usage.budgetFromDriver == true ) {
+			heapUsage.budget = budgetProperties.heapBudget[ i ];
+			heapUsage.processUsage = budgetProperties.heapUsage[ i ];
+		} else {
+			// Without the extension, the usual rule of thumb is that about 80% of a heap is safe to use.  The OS and other
+			// processes take the rest, and we can't see them.
+			heapUsage.budget = heap.size / 10 * 8;
+			heapUsage.processUsage = heapAllocatedBytes[ i ];
+		}
+	}
+}
+
+const char * GetMemoryCategoryName( memoryCategory_t category ) {
+	switch ( category ) {
+		case MEMORY_CATEGORY_RENDER_TARGET: {
+			return "render target";
+		}
+		case MEMORY_CATEGORY_TEXTURE: {
+			return "texture";
+		}
+		case MEMORY_CATEGORY_VERTEX: {
+			return "vertex";
+		}
+		case MEMORY_CATEGORY_INDEX: {
+			return "index";
+		}
+		case MEMORY_CATEGORY_UNIFORM: {
+			return "uniform";
+		}
+		case MEMORY_CATEGORY_STAGING: {
+			return "staging";
+		}
+	}
+	return "unknown";
+}
+
+void DumpMemoryUsage() {
+	extern void PrintDebugMessage( const char * message );
+	const double megabyte = 1024.0 * 1024.0;
+	char line[ 256 ];
+	memoryUsage_t usage;
+	GetMemoryUsage( usage );
+
+	PrintDebugMessage( "Device memory by category:\n" );
+	for ( uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i ) {
+		snprintf( line, sizeof( line ), "  %-14s %6u allocations %10.2f MB\n", GetMemoryCategoryName( ( memoryCategory_t )i ),
+			usage.categories[ i ].allocationCount, usage.categories[ i ].bytes / megabyte );
+		PrintDebugMessage( line );
+	}
+
+	snprintf( line, sizeof( line ), "Device memory by heap (budget %s):\n", usage.budgetFromDriver == true ? "from driver" : "estimated" );
+	PrintDebugMessage( line );
+	for ( uint32_t i = 0; i < usage.heapCount; ++i ) {
+		const memoryHeapUsage_t & heap = usage.heaps[ i ];
+		snprintf( line, sizeof( line ), "  heap %u%s: used %.2f MB, allocated %.2f MB, process %.2f MB, budget %.2f MB, size %.2f MB\n", i,
+			heap.deviceLocal == true ? " (device local)" : "", heap.usedBytes / megabyte, heap.allocatedBytes / megabyte,
+			heap.processUsage / megabyte, heap.budget / megabyte, heap.size / megabyte );
+		PrintDebugMessage( line );
+	}
+}
+
+static const uint32_t STAGING_COPY_ALIGNMENT = 16;	// Satisfies the texel and block size of every format we stage
+static const uint32_t STAGING_MIN_BUFFER_CHUNK = 64 * 1024;	// Smaller pieces of a buffer upload wait for the ring to wrap instead
+
+// Reserve up to maxSize bytes of contiguous ring space, but no less than minSize.  Returns false if the ring is too full right now.
+static bool AllocateStagingSpace( uint32_t minSize, uint32_t maxSize, uint32_t & offset, uint32_t & size ) {
+	offset = stagingBuffer.head;
+	if ( ( offset % STAGING_COPY_ALIGNMENT ) != 0 ) {
+		offset += STAGING_COPY_ALIGNMENT - offset % STAGING_COPY_ALIGNMENT;
+	}
+	uint32_t padding = offset - stagingBuffer.head;
+	if ( offset + minSize > stagingBuffer.size ) {
+		// Allocations never straddle the end of the ring, so the remainder is wasted until this frame retires.
+		padding = stagingBuffer.size - stagingBuffer.head;
+		offset = 0;
+	}
+	const uint32_t freeBytes = stagingBuffer.size - stagingBuffer.inFlightBytes;
+	if ( padding + minSize > freeBytes ) {
+		return false;
+	}
+	size = maxSize;
+	if ( size > freeBytes - padding ) {
+		size = freeBytes - padding;
+	}
+	if ( size > stagingBuffer.size - offset ) {
+		size = stagingBuffer.size - offset;
+	}
+	return true;
+}
+
+static void CommitStagingSpace( uint32_t offset, uint32_t size ) {
+	const uint32_t consumed = offset >= stagingBuffer.head ? ( offset - stagingBuffer.head ) + size : ( stagingBuffer.size - stagingBuffer.head ) + size;
+	stagingBuffer.head = offset + size;
+	stagingBuffer.inFlightBytes += consumed;
+	stagingBuffer.frameBytes[ renderObjects.frameIndex ] += consumed;
+}
 
-	VK_CHECK( vkAllocateMemory( renderObjects.device, &memoryAllocateInfo, NULL, &allocation.memory ) );
-	allocation.offset = 0;
+// Fill the levels from firstLevel on by blitting each level into the next with a linear filter.  All levels start out in transfer
+// dst and end up in shader read.  Blits need a graphics queue, so this is recorded into the graphics staging command buffer.
+static void GenerateMipmaps( const Image * image, uint32_t firstLevel ) {
+	const VkCommandBuffer commandBuffer = stagingBuffer.graphicsCommandBuffer;
+	const uint32_t mipLevels = image->GetMipLevels();
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image->GetImage();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	barrier.subresourceRange.levelCount = 1;
+	for ( uint32_t level = firstLevel; level < mipLevels; ++level ) {
+		// The level above has just been written, by the last copy or the previous blit, and becomes the source.
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+
+		VkImageBlit blit = {};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.layerCount = 1;
+		blit.srcOffsets[ 1 ].x = GetMipExtent( image->GetWidth(), level - 1 );
+		blit.srcOffsets[ 1 ].y = GetMipExtent( image->GetHeight(), level - 1 );
+		blit.srcOffsets[ 1 ].z = 1;
+		blit.dstSubresource = blit.srcSubresource;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstOffsets[ 1 ].x = GetMipExtent( image->GetWidth(), level );
+		blit.dstOffsets[ 1 ].y = GetMipExtent( image->GetHeight(), level );
+		blit.dstOffsets[ 1 ].z = 1;
+		vkCmdBlitImage( commandBuffer, image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR );
+	}
+
+	// Uploaded levels other than the last are still in transfer dst, the levels that were blitted from are in transfer src, and the
+	// last level is in transfer dst.
+	VkImageMemoryBarrier barriers[ 3 ] = { barrier, barrier, barrier };
+	for ( uint32_t i = 0; i < ARRAY_COUNT( barriers ); ++i ) {
+		barriers[ i ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[ i ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers[ i ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[ i ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	barriers[ 0 ].subresourceRange.baseMipLevel = 0;
+	barriers[ 0 ].subresourceRange.levelCount = firstLevel - 1;
+	barriers[ 1 ].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[ 1 ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[ 1 ].subresourceRange.baseMipLevel = firstLevel - 1;
+	barriers[ 1 ].subresourceRange.levelCount = mipLevels - firstLevel;
+	barriers[ 2 ].subresourceRange.baseMipLevel = mipLevels - 1;
+	barriers[ 2 ].subresourceRange.levelCount = 1;
+	const uint32_t skipped = firstLevel > 1 ? 0 : 1;	// A zero level count isn't allowed
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ) - skipped, barriers + skipped );
 }
 
-void StageImageData( void * data, uint32_t size, uint32_t alignment, const Image * targetImage ) {
-	// Optionally advance allocator "pointer" to meet alignment requirement.
-	if ( ( stagingBuffer.currentOffset % alignment ) != 0 ) {
-		stagingBuffer.currentOffset += alignment - stagingBuffer.currentOffset % alignment;
+static void FinishUpload( const pendingUpload_t & upload ) {
+	if ( upload.finish != NULL ) {
+		upload.finish( upload.finishContext );
+	} else {
+		GenerateMipmaps( upload.targetImage, upload.levelCount );
 	}
-	memcpy( ( uint8_t * )stagingBuffer.memoryData + stagingBuffer.currentOffset, data, size );
+}
 
-	// Transition image to transfer dst so it can be filled with data.
+// Stage as many rows of the upload as fit, one level after another.  For compressed formats a row is a row of blocks.  Returns true once every row of every level has been staged.
+static bool ProcessUpload( pendingUpload_t & upload ) {
+	const Image * targetImage = upload.targetImage;
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	barrier.image = targetImage->GetImage();
-	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-	vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
-	
-	VkBufferImageCopy region = {};
-	region.bufferOffset = stagingBuffer.currentOffset;
-	stagingBuffer.currentOffset += size;
-	region.imageExtent.width = targetImage->GetWidth();
-	region.imageExtent.height = targetImage->GetHeight();
-	region.imageExtent.depth = 1;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// Currently no support for depth.  It's unlikely to be needed for a staged image
-	region.imageSubresource.layerCount = 1;
-	vkCmdCopyBufferToImage( stagingBuffer.commandBuffer, stagingBuffer.buffer, targetImage->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
-
-	// Transition to shader read layout, because that's the likely use of the image.
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	while ( upload.mipLevel < upload.levelCount ) {
+		const uint32_t levelWidth = GetMipExtent( targetImage->GetWidth(), upload.mipLevel );
+		const uint32_t levelHeight = GetMipExtent( targetImage->GetHeight(), upload.mipLevel );
+		const uint32_t levelRows = ( levelHeight + upload.blockExtent - 1 ) / upload.blockExtent;
+		const uint32_t rowPitch = ( levelWidth + upload.blockExtent - 1 ) / upload.blockExtent * upload.blockSize;
+		const uint32_t remainingRows = levelRows - upload.rowsStaged;
+		uint32_t offset;
+		uint32_t rowCount;
+		if ( upload.inPlace == true ) {
+			// The whole upload already sits in the ring, so every level goes in one copy.
+			offset = upload.stagingOffset + upload.levelOffset;
+			rowCount = remainingRows;
+		} else {
+			// Chunks start and end on a multiple of the queue's granularity, except for the last one of a level.  The full width is
+			// always copied, so only the height matters.  It's in blocks for compressed formats, which makes it a row count either way.
+			const uint32_t granularity = renderObjects.transferImageGranularity.height;
+			const uint32_t rowGranularity = granularity == 0 ? levelRows : std::min( granularity, levelRows );
+			assert( rowGranularity * rowPitch <= stagingBuffer.size );
+			uint32_t size;
+			if ( AllocateStagingSpace( std::min( rowGranularity, remainingRows ) * rowPitch, remainingRows * rowPitch, offset, size ) == false ) {
+				return false;
+			}
+			rowCount = size / rowPitch;
+			if ( rowCount < remainingRows ) {
+				rowCount -= rowCount % rowGranularity;
+			}
+			size = rowCount * rowPitch;
+			CommitStagingSpace( offset, size );
+			memcpy( ( uint8_t * )stagingBuffer.memoryData + offset, upload.data + upload.levelOffset + upload.rowsStaged * rowPitch, size );
+		}
+
+		if ( upload.mipLevel == 0 && upload.rowsStaged == 0 ) {
+			// Transition image to transfer dst so it can be filled with data.  It stays there until the last chunk lands.
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			// The old contents are discarded, so this is also fine on a queue family that has never owned the image.
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+		}
+
+		// Copies are in texels, and may only stop short of a whole block at the edge of the level.  The buffer offset is a multiple of
+		// STAGING_COPY_ALIGNMENT, which is also a multiple of every block size.
+		VkBufferImageCopy region = {};
+		region.bufferOffset = offset;
+		region.imageOffset.y = upload.rowsStaged * upload.blockExtent;
+		region.imageExtent.width = levelWidth;
+		region.imageExtent.height = std::min( rowCount * upload.blockExtent, levelHeight - region.imageOffset.y );
+		region.imageExtent.depth = 1;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// Currently no support for depth.  It's unlikely to be needed for a staged image
+		region.imageSubresource.mipLevel = upload.mipLevel;
+		region.imageSubresource.layerCount = 1;
+		vkCmdCopyBufferToImage( stagingBuffer.commandBuffer, stagingBuffer.buffer, targetImage->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+		upload.rowsStaged += rowCount;
+
+		if ( upload.rowsStaged == levelRows ) {
+			upload.levelOffset += levelRows * rowPitch;
+			upload.rowsStaged = 0;
+			++upload.mipLevel;
+		}
+	}
+
+	// Images that still need their mip levels, or that have a finish callback, get more work on the graphics queue.
+	const bool finishOnGraphicsQueue = upload.finish != NULL || upload.levelCount < targetImage->GetMipLevels();
+	if ( finishOnGraphicsQueue == true && stagingBuffer.dedicatedTransferQueue == false ) {
+		// Same queue, so the graphics staging command buffer is submitted after the copies and only needs the barriers in FinishUpload.
+		FinishUpload( upload );
+		return true;
+	}
+
+	// Transition to shader read layout, because that's the likely use of the image.  Images with more work on the graphics queue stay
+	// in transfer dst for it.
 	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+	barrier.newLayout = finishOnGraphicsQueue == true ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	if ( stagingBuffer.dedicatedTransferQueue == true ) {
+		// Hand the image over to the graphics queue.  The same barrier is recorded twice: the release half on the transfer queue and the
+		// acquire half on the graphics queue, which runs after the transfer semaphore.  Only the release makes the writes available, and
+		// only the acquire makes them visible to the shaders.  The layout transition happens once, between the two.
+		barrier.srcQueueFamilyIndex = renderObjects.transferQueueFamilyIndex;
+		barrier.dstQueueFamilyIndex = renderObjects.queueFamilyIndex;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+		barrier.srcAccessMask = 0;
+		if ( finishOnGraphicsQueue == true ) {
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+			FinishUpload( upload );
+		} else {
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+		}
+	} else {
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+	}
+	return true;
+}
+
+// Stage as much of a buffer upload as fits.  Returns true once all of it has been staged.
+static bool ProcessBufferUpload( pendingUpload_t & upload ) {
+	while ( upload.bytesStaged < upload.size ) {
+		const uint32_t remaining = upload.size - upload.bytesStaged;
+		uint32_t offset;
+		uint32_t size;
+		if ( AllocateStagingSpace( std::min( remaining, STAGING_MIN_BUFFER_CHUNK ), remaining, offset, size ) == false ) {
+			return false;
+		}
+		CommitStagingSpace( offset, size );
+		memcpy( ( uint8_t * )stagingBuffer.memoryData + offset, upload.data + upload.bytesStaged, size );
+
+		VkBufferCopy region = {};
+		region.srcOffset = offset;
+		region.dstOffset = upload.bytesStaged;
+		region.size = size;
+		vkCmdCopyBuffer( stagingBuffer.commandBuffer, stagingBuffer.buffer, upload.targetBuffer, 1, &region );
+		upload.bytesStaged += size;
+	}
+
+	// Buffers have no layout, so the barrier only has to order the copies before the reads, and hand the buffer over like an image.
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = upload.targetBuffer;
+	barrier.size = VK_WHOLE_SIZE;
+	if ( stagingBuffer.dedicatedTransferQueue == true ) {
+		barrier.srcQueueFamilyIndex = renderObjects.transferQueueFamilyIndex;
+		barrier.dstQueueFamilyIndex = renderObjects.queueFamilyIndex;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &barrier, 0, NULL );
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = upload.dstAccessMask;
+		vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, upload.dstStageMask, 0, 0, NULL, 1, &barrier, 0, NULL );
+	} else {
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = upload.dstAccessMask;
+		vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, upload.dstStageMask, 0, 0, NULL, 1, &barrier, 0, NULL );
+	}
+	return true;
+}
+
+static void ProcessPendingUploads() {
+	while ( stagingBuffer.pendingUploads.empty() == false ) {
+		pendingUpload_t & upload = stagingBuffer.pendingUploads.front();
+		const bool staged = upload.targetBuffer != VK_NULL_HANDLE ? ProcessBufferUpload( upload ) : ProcessUpload( upload );
+		if ( staged == false ) {
+			break;	// Out of ring space.  Later uploads wait their turn, so completion stays in order
+		}
+		if ( upload.release != NULL ) {
+			upload.release( upload.releaseContext );
+		}
+		stagingBuffer.lastStagedUpload = upload.handle;
+		stagingBuffer.pendingUploads.pop_front();
+	}
+}
+
+static void InitializeUpload( pendingUpload_t & upload, uint32_t size, const Image * targetImage, uint32_t levelCount ) {
+	assert( levelCount >= 1 && levelCount <= targetImage->GetMipLevels() );
+	upload = {};
+	upload.handle = stagingBuffer.nextUploadHandle++;
+	GetFormatBlockInfo( targetImage->GetFormat(), upload.blockExtent, upload.blockSize );
+	upload.levelCount = levelCount;
+	upload.targetImage = targetImage;
+	// A single row always has to fit, or the upload could never make progress.
+	const uint32_t blocksWide = ( targetImage->GetWidth() + upload.blockExtent - 1 ) / upload.blockExtent;
+	assert( blocksWide * upload.blockSize <= stagingBuffer.size );
+	assert( size >= blocksWide * ( ( targetImage->GetHeight() + upload.blockExtent - 1 ) / upload.blockExtent ) * upload.blockSize );
+	( void )size;
+}
+
+uploadHandle_t StageImageData( const void * data, uint32_t size, const Image * targetImage, uint32_t levelCount, uploadDataRelease_t release, void * releaseContext, uploadFinish_t finish, void * finishContext ) {
+	pendingUpload_t upload;
+	InitializeUpload( upload, size, targetImage, levelCount );
+	upload.data = ( const uint8_t * )data;
+	upload.release = release;
+	upload.releaseContext = releaseContext;
+	upload.finish = finish;
+	upload.finishContext = finishContext;
+	stagingBuffer.pendingUploads.push_back( upload );
+
+	ProcessPendingUploads();
+	return upload.handle;
+}
+
+static void ReleaseCopiedBufferData( void * data ) {
+	free( data );
+}
+
+uploadHandle_t StageBufferData( const void * data, uint32_t size, VkBuffer targetBuffer, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, uploadDataRelease_t release, void * releaseContext ) {
+	pendingUpload_t upload = {};
+	upload.handle = stagingBuffer.nextUploadHandle++;
+	upload.data = ( const uint8_t * )data;
+	upload.targetBuffer = targetBuffer;
+	upload.size = size;
+	upload.dstStageMask = dstStageMask;
+	upload.dstAccessMask = dstAccessMask;
+	upload.release = release;
+	upload.releaseContext = releaseContext;
+	stagingBuffer.pendingUploads.push_back( upload );
+
+	ProcessPendingUploads();
+	if ( release == NULL && GetUploadStatus( upload.handle ) == UPLOAD_PENDING ) {
+		// Still queued, so it's the last upload.  The copy saves the caller from keeping its data around, which it usually can't.
+		pendingUpload_t & queued = stagingBuffer.pendingUploads.back();
+		uint8_t * copy = ( uint8_t * )malloc( size );
+		memcpy( copy, data, size );
+		queued.data = copy;
+		queued.release = ReleaseCopiedBufferData;
+		queued.releaseContext = copy;
+	}
+	return upload.handle;
+}
+
+uint8_t * StageImageDataInPlace( uint32_t size, const Image * targetImage, uint32_t levelCount, uploadHandle_t & handle ) {
+	// Staging ahead of queued uploads would finish them out of order.
+	if ( stagingBuffer.pendingUploads.empty() == false ) {
+		return NULL;
+	}
+	uint32_t offset;
+	uint32_t reserved;
+	if ( AllocateStagingSpace( size, size, offset, reserved ) == false ) {
+		return NULL;
+	}
+	CommitStagingSpace( offset, size );
+
+	pendingUpload_t upload;
+	InitializeUpload( upload, size, targetImage, levelCount );
+	upload.inPlace = true;
+	upload.stagingOffset = offset;
+	const bool staged = ProcessUpload( upload );
+	assert( staged == true );
+	( void )staged;
+	// The copies are only submitted at the end of the frame, by which point the caller has filled the memory.
+	stagingBuffer.lastStagedUpload = upload.handle;
+	handle = upload.handle;
+	return ( uint8_t * )stagingBuffer.memoryData + offset;
+}
+
+uint8_t * AllocateStagingMemory( uint32_t size, uint32_t & offset ) {
+	uint32_t reserved;
+	if ( AllocateStagingSpace( size, size, offset, reserved ) == false ) {
+		return NULL;
+	}
+	CommitStagingSpace( offset, size );
+	return ( uint8_t * )stagingBuffer.memoryData + offset;
+}
+
+void CancelPendingUploads( const Image * targetImage ) {
+	for ( std::deque< pendingUpload_t >::iterator it = stagingBuffer.pendingUploads.begin(); it != stagingBuffer.pendingUploads.end(); ) {
+		if ( it->targetImage == targetImage ) {
+			if ( it->release != NULL ) {
+				it->release( it->releaseContext );
+			}
+			it = stagingBuffer.pendingUploads.erase( it );
+		} else {
+			++it;
+		}
+	}
+}
+
+void CancelPendingUploads( VkBuffer targetBuffer ) {
+	for ( std::deque< pendingUpload_t >::iterator it = stagingBuffer.pendingUploads.begin(); it != stagingBuffer.pendingUploads.end(); ) {
+		if ( it->targetBuffer == targetBuffer ) {
+			if ( it->release != NULL ) {
+				it->release( it->releaseContext );
+			}
+			it = stagingBuffer.pendingUploads.erase( it );
+		} else {
+			++it;
+		}
+	}
+}
+
+uploadStatus_t GetUploadStatus( uploadHandle_t handle ) {
+	if ( handle <= stagingBuffer.lastCompletedUpload ) {
+		return UPLOAD_COMPLETE;
+	}
+	if ( handle <= stagingBuffer.lastStagedUpload ) {
+		return UPLOAD_STAGED;
+	}
+	return UPLOAD_PENDING;
 }
 
 void BeginStagingFrame() {
@@ -73,12 +832,23 @@ void BeginStagingFrame() {
 		return;
 	}
 
-	stagingBuffer.currentOffset = 0;	// Reset the linear allocator
+	// The fence for this frame slot has been waited on, so the copies it submitted are done and its ring space can be reused.
+	stagingBuffer.inFlightBytes -= stagingBuffer.frameBytes[ renderObjects.frameIndex ];
+	stagingBuffer.frameBytes[ renderObjects.frameIndex ] = 0;
+	if ( stagingBuffer.frameLastStagedUpload[ renderObjects.frameIndex ] > stagingBuffer.lastCompletedUpload ) {
+		stagingBuffer.lastCompletedUpload = stagingBuffer.frameLastStagedUpload[ renderObjects.frameIndex ];
+	}
+
+	stagingBuffer.commandBuffer = stagingBuffer.commandBuffers[ renderObjects.frameIndex ];
+	stagingBuffer.graphicsCommandBuffer = stagingBuffer.graphicsCommandBuffers[ renderObjects.frameIndex ];
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	VK_CHECK( vkBeginCommandBuffer( stagingBuffer.commandBuffer, &beginInfo ) );
+	VK_CHECK( vkBeginCommandBuffer( stagingBuffer.graphicsCommandBuffer, &beginInfo ) );
 	stagingBuffer.inFrame = true;
+
+	ProcessPendingUploads();
 }
 
 void InitializeImageLayout( Image * image, imageUsageFlags_t usage ) {
@@ -101,15 +871,10 @@ void InitializeImageLayout( Image * image, imageUsageFlags_t usage ) {
 		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		image->SetLayout( IMAGE_LAYOUT_FRAGMENT_SHADER_READ );
 	}
-	if ( image->IsDepth() == true ) {
-		barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_DEPTH_BIT;
-	}
-	if ( image->IsColor() == true ) {
-		barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_COLOR_BIT;
-	}
+	barrier.subresourceRange.aspectMask = TranslateFormatToAspect( image->GetFormat() );
 	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-	vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+	vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
 }
 
 void InitializeSwapchainImageLayout( Image * image ) {
@@ -128,16 +893,23 @@ void InitializeSwapchainImageLayout( Image * image ) {
 		barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
 	}
 	image->SetLayout( IMAGE_LAYOUT_PRESENT );
-	vkCmdPipelineBarrier( stagingBuffer.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, SWAPCHAIN_IMAGE_COUNT, barriers );
+	vkCmdPipelineBarrier( stagingBuffer.graphicsCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, SWAPCHAIN_IMAGE_COUNT, barriers );
 }
 
 void EndStagingFrame() {
 	VK_CHECK( vkEndCommandBuffer( stagingBuffer.commandBuffer ) );
+	VK_CHECK( vkEndCommandBuffer( stagingBuffer.graphicsCommandBuffer ) );
 	stagingBuffer.inFrame = false;
+	stagingBuffer.frameLastStagedUpload[ renderObjects.frameIndex ] = stagingBuffer.lastStagedUpload;
 
+	// No fence here: the frame's graphics submission waits for the copies, so its fence covers them too.
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &stagingBuffer.commandBuffer;
-	VK_CHECK( vkQueueSubmit( renderObjects.queue, 1, &submitInfo, VK_NULL_HANDLE ) );
+	if ( stagingBuffer.dedicatedTransferQueue == true ) {
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &stagingBuffer.transferSemaphores[ renderObjects.frameIndex ];
+	}
+	VK_CHECK( vkQueueSubmit( renderObjects.transferQueue, 1, &submitInfo, VK_NULL_HANDLE ) );
 }
\ No newline at end of file
@@ -1,24 +1,146 @@
 #pragma once
 
 #include "Renderer.h"
+#include <deque>
+#include <vector>
 
+struct memoryBlock_t;
+
+// Every allocation is tagged with what it's for, so we can see where device memory goes and size content to a budget.
+enum memoryCategory_t {
+	MEMORY_CATEGORY_RENDER_TARGET,
+	MEMORY_CATEGORY_TEXTURE,
+	MEMORY_CATEGORY_VERTEX,
+	MEMORY_CATEGORY_INDEX,
+	MEMORY_CATEGORY_UNIFORM,
+	MEMORY_CATEGORY_STAGING,
+	MEMORY_CATEGORY_COUNT
+};
+
+// A range of device memory handed out by AllocateDeviceMemory.  Most allocations are carved out of a shared block, so the memory
+// handle is NOT unique to the resource and must never be freed, mapped or unmapped directly; use FreeDeviceMemory and mappedData instead.
 struct allocation_t {
 	VkDeviceMemory	memory;
 	uint64_t		offset;
+	uint64_t		size;		// The size actually reserved, which may be larger than requested
+	void *			mappedData;	// Persistent mapping of offset for MEMORY_MAPPABLE allocations, NULL otherwise
+	memoryBlock_t *	block;		// NULL for dedicated allocations
+	memoryCategory_t category;
+	uint32_t		heapIndex;
 };
 
 enum memoryOptions_t {
 	MEMORY_NONE = 0,
 	MEMORY_MAPPABLE = BIT( 0 ),
+	MEMORY_DEDICATED = BIT( 1 ),		// Skip the sub-allocator and get a VkDeviceMemory of our own
+	MEMORY_OPTIMAL_TILING = BIT( 2 ),	// Set for VK_IMAGE_TILING_OPTIMAL images, which never share a block with linear resources
+	MEMORY_LAZILY_ALLOCATED = BIT( 3 ),	// Prefer memory the driver may never back, for attachments that live only within a render pass
+	// Prefer device local memory the CPU can write, when renderObjects.deviceLocalMappable.  Otherwise it's plain device local memory,
+	// so check mappedData to see which it got, or host memory if MEMORY_MAPPABLE is set too.
+	MEMORY_DEVICE_MAPPABLE = BIT( 4 ),
+};
+inline memoryOptions_t operator |( memoryOptions_t left, memoryOptions_t right ) {
+	return ( memoryOptions_t )( ( int )left | ( int )right );
+}
+
+struct memoryStatistics_t {
+	uint32_t	blockCount;
+	uint64_t	blockBytes;
+	uint32_t	allocationCount;
+	uint64_t	allocationBytes;
+	uint32_t	dedicatedAllocationCount;
+	uint64_t	dedicatedAllocationBytes;
+	uint64_t	largestFreeRange;
+};
+
+struct memoryCategoryUsage_t {
+	uint32_t	allocationCount;
+	uint64_t	bytes;
+};
+
+struct memoryHeapUsage_t {
+	uint64_t	size;
+	bool		deviceLocal;
+	uint64_t	allocatedBytes;		// Device memory we hold from the driver, including unused space in blocks
+	uint64_t	usedBytes;			// The part of allocatedBytes handed out to resources
+	uint64_t	budget;				// How much this process can allocate before things start failing or getting paged out
+	uint64_t	processUsage;		// The driver's view of what this process uses, which includes allocations made outside of this file
+};
+
+struct memoryUsage_t {
+	memoryCategoryUsage_t	categories[ MEMORY_CATEGORY_COUNT ];
+	uint32_t				heapCount;
+	memoryHeapUsage_t		heaps[ VK_MAX_MEMORY_HEAPS ];
+	bool					budgetFromDriver;	// False means budget and processUsage are estimates, because VK_EXT_memory_budget isn't available
+};
+
+class Image;
+
+// Uploads are identified by a handle that increases with every call to StageImageData.  Uploads are processed and retired
+// in order, so the status of every upload can be tracked with just the newest handle to reach each state.
+typedef uint64_t uploadHandle_t;
+
+enum uploadStatus_t {
+	UPLOAD_PENDING,		// Some of the data is still waiting for room in the staging ring
+	UPLOAD_STAGED,		// All copies are recorded, so work submitted in this frame or later can use the image
+	UPLOAD_COMPLETE,	// The GPU has finished the copies
 };
 
+// Called with the releaseContext passed to StageImageData once the data has been completely copied into staging memory and is no
+// longer needed.  The context is usually the allocation the data lives in.
+typedef void ( * uploadDataRelease_t )( void * context );
+// Called once every row of an upload has been copied, in place of generating the mip levels that weren't in its data.  The graphics
+// staging command buffer is open, the image is in transfer dst and owned by the graphics queue, and the callback has to leave all of it
+// in shader read.
+typedef void ( * uploadFinish_t )( void * context );
+
+struct pendingUpload_t {
+	uploadHandle_t			handle;
+	const uint8_t *			data;
+	uint32_t				blockExtent;	// Texels per side of a block, 1 for uncompressed formats
+	uint32_t				blockSize;
+	uint32_t				levelCount;		// Levels present in data, back to back.  Any levels the image has beyond these are generated
+	uint32_t				mipLevel;		// The level being staged
+	uint32_t				levelOffset;	// Where mipLevel starts in data
+	uint32_t				rowsStaged;		// Rows of blocks of mipLevel staged so far
+	bool					inPlace;		// The data was written straight into the staging ring, at stagingOffset
+	uint32_t				stagingOffset;
+	const Image *			targetImage;
+	// Buffer uploads set these instead of targetImage, and copy bytes rather than rows.
+	VkBuffer				targetBuffer;
+	uint32_t				size;
+	uint32_t				bytesStaged;
+	VkPipelineStageFlags	dstStageMask;	// Where the buffer is read once it lands
+	VkAccessFlags			dstAccessMask;
+	uploadDataRelease_t		release;
+	void *					releaseContext;
+	uploadFinish_t			finish;
+	void *					finishContext;
+};
+
+// The staging buffer is a ring.  Each frame in flight remembers how many bytes it consumed, and those bytes are given back once
+// the frame's fence has signaled, so the CPU never overwrites data that a pending copy still has to read.
 struct stagingBuffer_t {
 	VkBuffer buffer = VK_NULL_HANDLE;
 	allocation_t memory = {};
 	void * memoryData = NULL;
-	uint32_t currentOffset = 0;
-	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	uint32_t size = 0;
+	uint32_t head = 0;
+	uint32_t inFlightBytes = 0;
+	uint32_t frameBytes[ FRAMES_IN_FLIGHT ] = {};
+	VkCommandBuffer commandBuffers[ FRAMES_IN_FLIGHT ] = {};
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;	// The transfer queue command buffer for the current frame, for copies only
+	VkCommandBuffer graphicsCommandBuffers[ FRAMES_IN_FLIGHT ] = {};
+	VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;	// Submitted by Renderer_EndFrame ahead of the frame's rendering
+	bool dedicatedTransferQueue = false;	// When set, uploaded images change queue family ownership and the graphics queue waits on transferSemaphores
+	VkSemaphore transferSemaphores[ FRAMES_IN_FLIGHT ] = {};
 	bool inFrame = false;
+
+	std::deque< pendingUpload_t > pendingUploads;
+	uploadHandle_t nextUploadHandle = 1;
+	uploadHandle_t lastStagedUpload = 0;
+	uploadHandle_t lastCompletedUpload = 0;
+	uploadHandle_t frameLastStagedUpload[ FRAMES_IN_FLIGHT ] = {};	// lastStagedUpload at the time each frame slot was submitted
 };
 
 enum imageUsageFlags_t {
@@ -26,6 +148,8 @@ enum imageUsageFlags_t {
 	IMAGE_USAGE_TRANSFER_SRC = BIT( 1 ),
 	IMAGE_USAGE_TRANSFER_DST = BIT( 2 ),
 	IMAGE_USAGE_SHADER = BIT( 3 ),
+	IMAGE_USAGE_TRANSIENT = BIT( 4 ),	// Contents never outlive a render pass, so they're neither loaded nor stored
+	IMAGE_USAGE_MIPMAPPED = BIT( 5 ),	// Allocate the full mip chain, down to 1x1
 };
 inline imageUsageFlags_t operator |( imageUsageFlags_t left, imageUsageFlags_t right ) {
 	return ( imageUsageFlags_t )( ( int )left | ( int )right );
@@ -33,16 +157,53 @@ inline imageUsageFlags_t operator |( imageUsageFlags_t left, imageUsageFlags_t r
 
 extern stagingBuffer_t stagingBuffer;
 class Buffer;
-class Image;
 
-void AllocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, memoryOptions_t options, allocation_t & allocation );
-// Copy the linear image data into the staging buffer and produce a copy command to fill the targetImage.
-void StageImageData( void * data, uint32_t size, uint32_t alignment, const Image * targetImage );
-// Start the command buffer and linear allocator in the staging buffer memory.
+void AllocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, memoryOptions_t options, memoryCategory_t category, allocation_t & allocation );
+// Whether a resource with these memory type bits would get device local memory the CPU can write with MEMORY_DEVICE_MAPPABLE.
+bool SupportsDeviceMappable( uint32_t memoryTypeBits );
+// Return the allocation to its block (or to the driver, for dedicated allocations).  The GPU must be done with it.
+void FreeDeviceMemory( allocation_t & allocation );
+// Gather the current block and allocation totals across all memory types.
+void GetMemoryStatistics( memoryStatistics_t & statistics );
+// Blocks worth evacuating, sparsest first.  Only blocks that share their memory type with another block qualify, since moving
+// allocations between blocks is the only way an allocation can leave one.
+void GetDefragmentationCandidates( std::vector< memoryBlock_t * > & blocks );
+// Allocate memory for a resource being moved out of current.block, in the fullest other block of the same kind that has room.
+// Never creates a block, so it returns false when the move wouldn't compact anything.
+bool ReallocateDeviceMemory( const VkMemoryRequirements & memoryRequirements, const allocation_t & current, allocation_t & moved );
+// Usage per category and per heap.  The heap budget is queried from the driver each call, so don't do it more than once a frame.
+void GetMemoryUsage( memoryUsage_t & usage );
+const char * GetMemoryCategoryName( memoryCategory_t category );
+// Write the current usage to the debug output.
+void DumpMemoryUsage();
+// Queue the linear image data to be copied into the staging ring, producing copy commands to fill the targetImage.  As much as fits
+// is staged right away; the rest follows in row-sized chunks over the next frames.  The data must remain valid until release is called.
+// The data holds the first levelCount mip levels back to back.  If the image has more, they're generated from the last one with
+// linear blits on the graphics queue, so the format has to support that (see SupportsLinearBlit), unless a finish callback fills them.
+uploadHandle_t StageImageData( const void * data, uint32_t size, const Image * targetImage, uint32_t levelCount, uploadDataRelease_t release, void * releaseContext, uploadFinish_t finish = NULL, void * finishContext = NULL );
+// Queue data to be copied into a device local buffer through the staging ring, in as many chunks and frames as it takes.  A barrier
+// makes the data visible to dstAccessMask at dstStageMask once the last chunk is copied, handing the buffer over to the graphics queue
+// if the copies ran on a dedicated transfer queue.  Without a release, the data only has to last for the call: whatever doesn't fit
+// right away is copied to the heap first.
+uploadHandle_t StageBufferData( const void * data, uint32_t size, VkBuffer targetBuffer, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, uploadDataRelease_t release = NULL, void * releaseContext = NULL );
+// Reserve size bytes of staging memory for levelCount mip levels of the targetImage, laid out as for StageImageData, and record the
+// copies out of it.  The caller writes the data through the returned pointer instead of handing over a copy, which saves a pass over
+// it; it must be written before EndStagingFrame.  Returns NULL if the ring doesn't have room for all of it right now, or if earlier
+// uploads are still waiting for room, in which case the data has to go through StageImageData.
+uint8_t * StageImageDataInPlace( uint32_t size, const Image * targetImage, uint32_t levelCount, uploadHandle_t & handle );
+// Reserve size bytes of staging memory for copies the caller records itself into stagingBuffer.graphicsCommandBuffer, for resources
+// that are updated while the graphics queue samples them, like virtual texture pages.  There's no upload handle; the copies are staged
+// once recorded.  Returns NULL if the ring doesn't have room right now.
+uint8_t * AllocateStagingMemory( uint32_t size, uint32_t & offset );
+uploadStatus_t GetUploadStatus( uploadHandle_t handle );
+// Drop whatever hasn't been staged yet for an image that's being destroyed, releasing its source data.
+void CancelPendingUploads( const Image * targetImage );
+void CancelPendingUploads( VkBuffer targetBuffer );
+// Start the command buffer, reclaim ring space from retired frames, and continue any uploads that didn't fit before.
 void BeginStagingFrame();
 // Transition image to a proper non-undefined layout before first use.
 void InitializeImageLayout( Image * image, imageUsageFlags_t usage );
 // Do a special transition for all swapchain images.
 void InitializeSwapchainImageLayout( Image * image );
-// Finish the staging buffer for this frame and submit any commands.
+// Finish the staging command buffers for this frame and submit the copies.  The graphics command buffer is submitted by Renderer_EndFrame.
 void EndStagingFrame();
\ No newline at end of file
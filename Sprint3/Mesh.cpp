@@ -12,4 +12,10 @@ Mesh * Mesh::Create( const vertex_t * vertexData, uint32_t vertexSize, const uin
 	result->m_indexCount = indexCount;
 
 	return result;
+}
+
+void Mesh::Destroy( Mesh * mesh ) {
+	Buffer::Destroy( mesh->m_vertexBuffer );
+	Buffer::Destroy( mesh->m_indexBuffer );
+	delete mesh;
 }
\ No newline at end of file
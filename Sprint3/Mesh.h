@@ -8,6 +8,7 @@ class Buffer;
 class Mesh {
 public:
 	static Mesh * Create( const vertex_t * vertexData, uint32_t vertexSize, const uint16_t * indexData, uint32_t indexSize, uint32_t indexCount );
+	static void Destroy( Mesh * mesh );
 	const Buffer * GetVertexBuffer() const { return m_vertexBuffer; }
 	const Buffer * GetIndexBuffer() const { return m_indexBuffer; }
 	uint32_t GetIndexCount() const { return m_indexCount; }
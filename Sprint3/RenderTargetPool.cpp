@@ -0,0 +1,99 @@
+#include "RenderTargetPool.h"
+#include <vector>
+
+struct pooledRenderTarget_t {
+	Image *				image;
+	uint32_t			width;
+	uint32_t			height;
+	imageFormat_t		format;
+	imageUsageFlags_t	usage;
+	bool				inUse;
+	uint64_t			lastUsedFrame;
+};
+
+struct renderTargetPool_t {
+	std::vector< pooledRenderTarget_t >	targets;
+	uint64_t							inUseBytes = 0;
+	renderTargetPoolStatistics_t		statistics = {};
+};
+
+static renderTargetPool_t renderTargetPool;
+
+Image * AcquireRenderTarget( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage ) {
+	renderTargetPoolStatistics_t & statistics = renderTargetPool.statistics;
+	++statistics.acquireCount;
+	pooledRenderTarget_t * target = NULL;
+	for ( size_t i = 0; i < renderTargetPool.targets.size(); ++i ) {
+		pooledRenderTarget_t & candidate = renderTargetPool.targets[ i ];
+		if ( candidate.inUse == false && candidate.width == width && candidate.height == height && candidate.format == format && candidate.usage == usage ) {
+			target = &candidate;
+			++statistics.hitCount;
+			break;
+		}
+	}
+	if ( target == NULL ) {
+		pooledRenderTarget_t created = {};
+		created.image = Image::Create( width, height, format, usage );
+		created.width = width;
+		created.height = height;
+		created.format = format;
+		created.usage = usage;
+		renderTargetPool.targets.push_back( created );
+		target = &renderTargetPool.targets.back();
+		++statistics.imageCount;
+		statistics.imageBytes += created.image->GetMemory().size;
+	}
+	target->inUse = true;
+	target->lastUsedFrame = renderObjects.frameNumber;
+	renderTargetPool.inUseBytes += target->image->GetMemory().size;
+	++statistics.inUseCount;
+	if ( statistics.inUseCount > statistics.peakInUseCount ) {
+		statistics.peakInUseCount = statistics.inUseCount;
+	}
+	if ( renderTargetPool.inUseBytes > statistics.peakInUseBytes ) {
+		statistics.peakInUseBytes = renderTargetPool.inUseBytes;
+	}
+	return target->image;
+}
+
+static void ReleaseTarget( pooledRenderTarget_t & target ) {
+	target.inUse = false;
+	renderTargetPool.inUseBytes -= target.image->GetMemory().size;
+	--renderTargetPool.statistics.inUseCount;
+}
+
+void ReleaseRenderTarget( Image * image ) {
+	for ( size_t i = 0; i < renderTargetPool.targets.size(); ++i ) {
+		pooledRenderTarget_t & target = renderTargetPool.targets[ i ];
+		if ( target.image == image ) {
+			assert( target.inUse == true );
+			ReleaseTarget( target );
+			return;
+		}
+	}
+	assert( false );	// Not from the pool
+}
+
+void BeginRenderTargetPoolFrame() {
+	std::vector< pooledRenderTarget_t > & targets = renderTargetPool.targets;
+	for ( size_t i = 0; i < targets.size(); ) {
+		pooledRenderTarget_t & target = targets[ i ];
+		if ( target.inUse == true ) {
+			ReleaseTarget( target );
+		}
+		// Destruction is deferred until the frames in flight are done with the image.
+		if ( target.lastUsedFrame + RENDER_TARGET_POOL_IDLE_FRAMES < renderObjects.frameNumber ) {
+			--renderTargetPool.statistics.imageCount;
+			renderTargetPool.statistics.imageBytes -= target.image->GetMemory().size;
+			Image::Destroy( target.image );
+			target = targets.back();
+			targets.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
+
+const renderTargetPoolStatistics_t & GetRenderTargetPoolStatistics() {
+	return renderTargetPool.statistics;
+}
\ No newline at end of file
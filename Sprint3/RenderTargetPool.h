@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Image.h"
+
+// Render targets that are only needed for a frame, or for a few passes of one, are borrowed from a pool instead of being created for
+// each effect.  AcquireRenderTarget hands out an idle image with the same size, format and usage, or creates one if there isn't any.
+// An image can be released as soon as its last pass has been recorded, so a later pass in the same frame can reuse it, and anything
+// still held when the next frame begins is released then.  Images left idle for RENDER_TARGET_POOL_IDLE_FRAMES frames are destroyed,
+// so targets for an old resolution don't outlive a resize.
+//
+// The contents of a pooled image are garbage when it's acquired, so its first use has to be a barrier with
+// BARRIER_DISCARD_AND_IGNORE_OLD_LAYOUT.  Descriptor sets that sample one have to be set every frame, from sets per frame in flight.
+const uint32_t RENDER_TARGET_POOL_IDLE_FRAMES = 60;
+
+struct renderTargetPoolStatistics_t {
+	uint64_t	acquireCount;
+	uint64_t	hitCount;			// Acquires served by an image already in the pool
+	uint32_t	imageCount;			// Images in the pool, in use or not
+	uint64_t	imageBytes;
+	uint32_t	inUseCount;
+	uint32_t	peakInUseCount;		// The most images held at once
+	uint64_t	peakInUseBytes;
+};
+
+Image * AcquireRenderTarget( uint32_t width, uint32_t height, imageFormat_t format, imageUsageFlags_t usage );
+void ReleaseRenderTarget( Image * image );
+// Release everything still held from the last frame and destroy images that have been idle for too long.  Call once per frame.
+void BeginRenderTargetPoolFrame();
+const renderTargetPoolStatistics_t & GetRenderTargetPoolStatistics();
\ No newline at end of file
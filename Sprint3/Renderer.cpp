@@ -3,18 +3,47 @@
 #include "CommandContext.h"
 #include "DescriptorSet.h"
 #include "Memory.h"
+#include "TransientAllocator.h"
+#include "Defragmenter.h"
+#include "DeletionQueue.h"
+#include "ImageLoader.h"
+#include "TextureStreaming.h"
+#include "TextureResidency.h"
+#include "RenderTargetPool.h"
+#include "VirtualTexture.h"
 #include <vector>
+#include <string.h>
+#include <algorithm>
 
 renderObjects_t renderObjects;
 
 #pragma comment( lib, "vulkan-1" )
 
+static bool HasExtension( const std::vector< VkExtensionProperties > & extensions, const char * name ) {
+	for ( size_t i = 0; i < extensions.size(); ++i ) {
+		if ( strcmp( extensions[ i ].extensionName, name ) == 0 ) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void CreateInstance() {
 	std::vector< const char * > instanceExtensionNames = {
 		VK_KHR_SURFACE_EXTENSION_NAME,
 	};
 	extern const char * GetPlatformSurfaceExtensionName();
 	instanceExtensionNames.push_back( GetPlatformSurfaceExtensionName() );
+
+	// The memory budget extension reports through vkGetPhysicalDeviceMemoryProperties2, which isn't core in Vulkan 1.0.  Both are optional.
+	uint32_t extensionCount;
+	VK_CHECK( vkEnumerateInstanceExtensionProperties( NULL, &extensionCount, NULL ) );
+	std::vector< VkExtensionProperties > extensions( extensionCount );
+	VK_CHECK( vkEnumerateInstanceExtensionProperties( NULL, &extensionCount, extensions.data() ) );
+	const bool hasProperties2 = HasExtension( extensions, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME );
+	if ( hasProperties2 == true ) {
+		instanceExtensionNames.push_back( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME );
+	}
 	std::vector< const char * > instanceLayerNames = {
 #if defined( _DEBUG )
 		"VK_LAYER_LUNARG_standard_validation",
@@ -36,6 +65,50 @@ static void CreateInstance() {
 	instanceCreateInfo.enabledExtensionCount = ( uint32_t )instanceExtensionNames.size();
 	instanceCreateInfo.ppEnabledExtensionNames = instanceExtensionNames.data();
 	VK_CHECK( vkCreateInstance( &instanceCreateInfo, NULL, &renderObjects.instance ) );
+
+	renderObjects.getMemoryProperties2 = NULL;
+	if ( hasProperties2 == true ) {
+		renderObjects.getMemoryProperties2 = ( PFN_vkGetPhysicalDeviceMemoryProperties2KHR )vkGetInstanceProcAddr( renderObjects.instance, "vkGetPhysicalDeviceMemoryProperties2KHR" );
+	}
+}
+
+// Only memory on the largest device local heap counts, so the small BAR window of discrete GPUs without resizable BAR isn't mistaken
+// for it.  That window is too small to put resources in wholesale.
+static void DetectMappableDeviceMemory() {
+	const VkPhysicalDeviceMemoryProperties & memoryProperties = renderObjects.memoryProperties;
+	VkDeviceSize largestDeviceHeap = 0;
+	for ( uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i ) {
+		if ( ( memoryProperties.memoryHeaps[ i ].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ) != 0 ) {
+			largestDeviceHeap = std::max( largestDeviceHeap, memoryProperties.memoryHeaps[ i ].size );
+		}
+	}
+	const VkMemoryPropertyFlags mappable = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	renderObjects.deviceLocalMappable = false;
+	for ( uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i ) {
+		const VkMemoryType & memoryType = memoryProperties.memoryTypes[ i ];
+		if ( ( memoryType.propertyFlags & mappable ) == mappable && memoryProperties.memoryHeaps[ memoryType.heapIndex ].size >= largestDeviceHeap ) {
+			renderObjects.deviceLocalMappable = true;
+		}
+	}
+}
+
+// Higher is better.  Integrated GPUs and software renderers like lavapipe are still picked when they're all there is, and are where
+// mappable device memory pays off most.
+static uint32_t GetPhysicalDeviceTypeRank( VkPhysicalDeviceType type ) {
+	switch ( type ) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: {
+			return 3;
+		}
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: {
+			return 2;
+		}
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: {
+			return 1;
+		}
+		default: {
+			return 0;
+		}
+	}
 }
 
 static void GetPhysicalDevice() {
@@ -43,29 +116,19 @@ static void GetPhysicalDevice() {
 	VK_CHECK( vkEnumeratePhysicalDevices( renderObjects.instance, &physicalDeviceCount, NULL ) );
 	VkPhysicalDevice * allPhysicalDevices = new VkPhysicalDevice[ physicalDeviceCount ];
 	VK_CHECK( vkEnumeratePhysicalDevices( renderObjects.instance, &physicalDeviceCount, allPhysicalDevices ) );
-	uint32_t hardwareVendors[] = {
-		0x1022,
-		0x1002, // AMD
-		0x10DE, // NVIDIA
-	};
+	// Discrete, then integrated, then CPU, then anything else.  The first of each kind wins, which is the order the loader lists them in.
 	for ( uint32_t i = 0; i < physicalDeviceCount; ++i ) {
 		VkPhysicalDeviceProperties props;
 		vkGetPhysicalDeviceProperties( allPhysicalDevices[ i ], &props );
-		bool foundHardwareVendor = false;
-		for ( uint32_t j = 0; j < ARRAY_COUNT( hardwareVendors ); ++j ) {
-			if ( props.vendorID == hardwareVendors[ j ] ) {
-				foundHardwareVendor = true;
-				break;
-			}
-		}
-		if ( foundHardwareVendor == true ) {
+		if ( renderObjects.physicalDevice == VK_NULL_HANDLE || GetPhysicalDeviceTypeRank( props.deviceType ) > GetPhysicalDeviceTypeRank( renderObjects.physicalDeviceProperties.deviceType ) ) {
 			renderObjects.physicalDevice = allPhysicalDevices[ i ];
-			break;
+			renderObjects.physicalDeviceProperties = props;	// Keep these around for limits like minUniformBufferOffsetAlignment
 		}
 	}
 	// We're not going to worry about not getting a physical device here.  It'll break if it's still NULL (the default value) when we use it
 	delete[] allPhysicalDevices; // They're just handles.  This doesn't actually invalidate any of the physical devices
 	vkGetPhysicalDeviceMemoryProperties( renderObjects.physicalDevice, &renderObjects.memoryProperties );
+	DetectMappableDeviceMemory();
 }
 
 static void CreateDevice() {
@@ -81,24 +144,61 @@ static void CreateDevice() {
 			break;
 		}
 	}
+	// A family with transfer but neither graphics nor compute is usually backed by the DMA engines, which copy without taking
+	// any time away from the graphics queue.
+	renderObjects.transferQueueFamilyIndex = renderObjects.queueFamilyIndex;
+	for ( uint32_t i = 0; i < queueFamilyCount; ++i ) {
+		const VkQueueFlags flags = queueFamilyProperties[ i ].queueFlags;
+		if ( ( flags & VK_QUEUE_TRANSFER_BIT ) != 0 && ( flags & ( VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT ) ) == 0 ) {
+			renderObjects.transferQueueFamilyIndex = i;
+			break;
+		}
+	}
+	renderObjects.transferImageGranularity = queueFamilyProperties[ renderObjects.transferQueueFamilyIndex ].minImageTransferGranularity;
 	delete[] queueFamilyProperties;
-	float queuePriority = 1.0f;	// This value must be between 0 and 1, by spec, but it's unimportant, because we'll only create the one
-	VkDeviceQueueCreateInfo queueCreateInfo = {};
-	queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queueCreateInfo.queueFamilyIndex = renderObjects.queueFamilyIndex;
-	queueCreateInfo.queueCount = 1;
-	queueCreateInfo.pQueuePriorities = &queuePriority;
-	const char * deviceExtensionNames[] = {
+	float queuePriority = 1.0f;	// This value must be between 0 and 1, by spec, but it's unimportant, because we only create one queue per family
+	VkDeviceQueueCreateInfo queueCreateInfos[ 2 ] = {};
+	uint32_t queueCreateInfoCount = 1;
+	queueCreateInfos[ 0 ].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueCreateInfos[ 0 ].queueFamilyIndex = renderObjects.queueFamilyIndex;
+	queueCreateInfos[ 0 ].queueCount = 1;
+	queueCreateInfos[ 0 ].pQueuePriorities = &queuePriority;
+	if ( renderObjects.transferQueueFamilyIndex != renderObjects.queueFamilyIndex ) {
+		queueCreateInfos[ 1 ] = queueCreateInfos[ 0 ];
+		queueCreateInfos[ 1 ].queueFamilyIndex = renderObjects.transferQueueFamilyIndex;
+		++queueCreateInfoCount;
+	}
+	std::vector< const char * > deviceExtensionNames = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 	};
+	uint32_t extensionCount;
+	VK_CHECK( vkEnumerateDeviceExtensionProperties( renderObjects.physicalDevice, NULL, &extensionCount, NULL ) );
+	std::vector< VkExtensionProperties > extensions( extensionCount );
+	VK_CHECK( vkEnumerateDeviceExtensionProperties( renderObjects.physicalDevice, NULL, &extensionCount, extensions.data() ) );
+	renderObjects.memoryBudgetSupported = renderObjects.getMemoryProperties2 != NULL && HasExtension( extensions, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+	if ( renderObjects.memoryBudgetSupported == true ) {
+		deviceExtensionNames.push_back( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+	}
+	// Only turn on the features we use.  Block compressed textures are universal on desktop, but not on mobile.
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures( renderObjects.physicalDevice, &supportedFeatures );
+	VkPhysicalDeviceFeatures enabledFeatures = {};
+	enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	enabledFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+	renderObjects.samplerAnisotropySupported = supportedFeatures.samplerAnisotropy == VK_TRUE;
+	// Texture feedback is written from fragment shaders.  Without it, textures only stream in what the CPU asks for.
+	enabledFeatures.fragmentStoresAndAtomics = supportedFeatures.fragmentStoresAndAtomics;
+	renderObjects.fragmentStoresSupported = supportedFeatures.fragmentStoresAndAtomics == VK_TRUE;
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	deviceCreateInfo.queueCreateInfoCount = 1;
-	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-	deviceCreateInfo.enabledExtensionCount = ARRAY_COUNT( deviceExtensionNames );
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensionNames;
+	deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
+	deviceCreateInfo.queueCreateInfoCount = queueCreateInfoCount;
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos;
+	deviceCreateInfo.enabledExtensionCount = ( uint32_t )deviceExtensionNames.size();
+	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensionNames.data();
 	VK_CHECK( vkCreateDevice( renderObjects.physicalDevice, &deviceCreateInfo, NULL, &renderObjects.device ) );
 	vkGetDeviceQueue( renderObjects.device, renderObjects.queueFamilyIndex, 0, &renderObjects.queue );
+	vkGetDeviceQueue( renderObjects.device, renderObjects.transferQueueFamilyIndex, 0, &renderObjects.transferQueue );
 }
 
 static void CreateSwapchain() {
@@ -149,25 +249,36 @@ static void CreateCommandContexts() {
 	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	VK_CHECK( vkCreateCommandPool( renderObjects.device, &commandPoolCreateInfo, NULL, &renderObjects.commandPool ) );
+	renderObjects.transferCommandPool = renderObjects.commandPool;
+	if ( renderObjects.transferQueueFamilyIndex != renderObjects.queueFamilyIndex ) {
+		commandPoolCreateInfo.queueFamilyIndex = renderObjects.transferQueueFamilyIndex;
+		VK_CHECK( vkCreateCommandPool( renderObjects.device, &commandPoolCreateInfo, NULL, &renderObjects.transferCommandPool ) );
+	}
 
-	renderObjects.commandContext = CommandContext::Create();
+	// Each frame in flight records into its own context, since a command buffer can't be reset while the GPU is still executing it.
+	for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+		renderObjects.commandContexts[ i ] = CommandContext::Create();
+	}
+	renderObjects.commandContext = renderObjects.commandContexts[ 0 ];
 }
 
 static void CreateSynchronizationPrimitives() {
 	VkFenceCreateInfo fenceCreateInfo = {};
 	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-	VK_CHECK( vkCreateFence( renderObjects.device, &fenceCreateInfo, NULL, &renderObjects.renderFence ) );
-
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
 	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	VK_CHECK( vkCreateSemaphore( renderObjects.device, &semaphoreCreateInfo, NULL, &renderObjects.imageAcquireSemaphore ) );
-	VK_CHECK( vkCreateSemaphore( renderObjects.device, &semaphoreCreateInfo, NULL, &renderObjects.renderCompleteSemaphore ) );
+	for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+		VK_CHECK( vkCreateFence( renderObjects.device, &fenceCreateInfo, NULL, &renderObjects.renderFences[ i ] ) );
+		VK_CHECK( vkCreateSemaphore( renderObjects.device, &semaphoreCreateInfo, NULL, &renderObjects.imageAcquireSemaphores[ i ] ) );
+		VK_CHECK( vkCreateSemaphore( renderObjects.device, &semaphoreCreateInfo, NULL, &renderObjects.renderCompleteSemaphores[ i ] ) );
+	}
+	renderObjects.frameNumber = 0;
+	renderObjects.frameIndex = 0;
 }
 
 static void CreateRenderTargets() {
 	renderObjects.colorImage = Image::Create( 1920, 1080, IMAGE_FORMAT_RGBA8, IMAGE_USAGE_RENDER_TARGET | IMAGE_USAGE_SHADER );
-	renderObjects.depthImage = Image::Create( 1920, 1080, IMAGE_FORMAT_DEPTH, IMAGE_USAGE_RENDER_TARGET );
 	renderObjects.swapchainImage = Image::CreateFromSwapchain();
 }
 
@@ -183,18 +294,25 @@ static void CreateUnifiedPipelineLayout() {
 	VkDescriptorSetLayoutBinding binding = {};
 	binding.descriptorCount = 1;
 	binding.stageFlags = VK_SHADER_STAGE_ALL;
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	// Uniform buffers are dynamic in every scope, so a set pointing at a dynamic Buffer can follow it to the current frame's region
+	// with an offset at bind time, instead of needing a set per frame in flight.  Static buffers are bound with an offset of 0.
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	for ( ; currentBinding < FRAME_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND; ++currentBinding ) {
 		binding.binding = currentBinding;
 		bindings.push_back( binding );
 	}
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	for ( ; currentBinding < FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_BOUND; ++currentBinding ) {
+		binding.binding = currentBinding;
+		bindings.push_back( binding );
+	}
 	setLayoutCreateInfo.bindingCount = ( uint32_t )bindings.size();
 	setLayoutCreateInfo.pBindings = bindings.data();
 	VK_CHECK( vkCreateDescriptorSetLayout( renderObjects.device, &setLayoutCreateInfo, NULL, &renderObjects.frameDescriptorSetLayout ) );
 
 	currentBinding = 0;
 	bindings.clear();
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	for ( ; currentBinding < VIEW_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND; ++currentBinding ) {
 		binding.binding = currentBinding;
 		bindings.push_back( binding );
@@ -205,7 +323,7 @@ static void CreateUnifiedPipelineLayout() {
 
 	currentBinding = 0;
 	bindings.clear();
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	for ( ; currentBinding < MESH_DESCRIPTOR_UNIFORM_BUFFER_SLOT_BOUND; ++currentBinding ) {
 		binding.binding = currentBinding;
 		bindings.push_back( binding );
@@ -228,26 +346,40 @@ static void CreateUnifiedPipelineLayout() {
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = ARRAY_COUNT( layouts );
 	pipelineLayoutCreateInfo.pSetLayouts = layouts;
+	// Every pipeline shares the one range, so the draw constants stay put across pipeline changes.
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof( drawConstants_t );
+	assert( pushConstantRange.size <= renderObjects.physicalDeviceProperties.limits.maxPushConstantsSize );
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 	VK_CHECK( vkCreatePipelineLayout( renderObjects.device, &pipelineLayoutCreateInfo, NULL, &renderObjects.unifiedPipelineLayout ) );
 }
 
 static void CreateDescriptorPool() {
 	const uint32_t unifiedCount = 64 * 1024;
 
-	// Only support uniform buffers and combined image samplers.  More pool sizes would be needed for, say, compute work.
+	// Only support dynamic uniform buffers and combined image samplers, plus the few storage buffers frame sets have.  More pool sizes would be
+	// needed for, say, compute work.
 	VkDescriptorPoolSize poolSizes[] = {
 		{
-			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 			unifiedCount,
 		},
 		{
 			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 			unifiedCount,
 		},
+		{
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			unifiedCount / 64,
+		},
 	};
 
 	VkDescriptorPoolCreateInfo poolCreateInfo = {};
 	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;	// So DescriptorSet::Free can give sets back individually
 	poolCreateInfo.maxSets = unifiedCount;
 	poolCreateInfo.poolSizeCount = ARRAY_COUNT( poolSizes );
 	poolCreateInfo.pPoolSizes = poolSizes;
@@ -255,48 +387,68 @@ static void CreateDescriptorPool() {
 	VK_CHECK( vkCreateDescriptorPool( renderObjects.device, &poolCreateInfo, NULL, &renderObjects.descriptorPool ) );
 }
 
-static void CreateSamplers() {
-	// We create global samplers for supported sampling types, then specify them by enumeration so they don't permute except by hardcoding.
-	VkSamplerCreateInfo samplerCreateInfo = {};
-	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
-	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
-	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-	VK_CHECK( vkCreateSampler( renderObjects.device, &samplerCreateInfo, NULL, &renderObjects.samplers[ SAMPLER_TYPE_LINEAR ] ) );
-}
-
 static void InitializeStagingBuffer() {
-	const VkDeviceSize stagingSize = 128 * 1024 * 1024;	// Large staging buffer, so it can stage a bunch of resources in a single frame.
+	// Uploads that don't fit are split across frames, so this only bounds how much can be uploaded per frame, not the size of a resource.
+	const VkDeviceSize stagingSize = 32 * 1024 * 1024;
 	VkBufferCreateInfo bufferCreateInfo = {};
 	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 	bufferCreateInfo.size = stagingSize;
+	// Most copies run on the transfer queue, but some resources are updated from the graphics queue, so both read the ring.
+	const uint32_t queueFamilyIndices[] = { renderObjects.queueFamilyIndex, renderObjects.transferQueueFamilyIndex };
+	if ( renderObjects.transferQueueFamilyIndex != renderObjects.queueFamilyIndex ) {
+		bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferCreateInfo.queueFamilyIndexCount = ARRAY_COUNT( queueFamilyIndices );
+		bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
 	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &stagingBuffer.buffer ) );
 
-	// Allocate the memory and map.  This buffer uses persistent mapping so that we don't have to call vkMapMemory and vkUnmapMemory a bunch.
+	// Allocate the memory.  Mappable allocations are persistently mapped, so that we don't have to call vkMapMemory and vkUnmapMemory a bunch.
 	VkMemoryRequirements memReq;
 	vkGetBufferMemoryRequirements( renderObjects.device, stagingBuffer.buffer, &memReq );
-	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE, stagingBuffer.memory );
+	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE | MEMORY_DEDICATED, MEMORY_CATEGORY_STAGING, stagingBuffer.memory );
 	VK_CHECK( vkBindBufferMemory( renderObjects.device, stagingBuffer.buffer, stagingBuffer.memory.memory, stagingBuffer.memory.offset ) );
-	VK_CHECK( vkMapMemory( renderObjects.device, stagingBuffer.memory.memory, stagingBuffer.memory.offset, stagingSize, 0, &stagingBuffer.memoryData ) );
-	stagingBuffer.currentOffset = 0;	// Linear allocation in the staging buffer means we only have to keep the current offset and adjust for resource size and alignment
+	stagingBuffer.memoryData = stagingBuffer.memory.mappedData;
+	stagingBuffer.size = ( uint32_t )stagingSize;
+	stagingBuffer.head = 0;	// Ring allocation in the staging buffer means we only have to keep the head and the bytes each frame consumed
 
-	// The staging buffer needs its own command buffer so that it can be submitted all at once before any rendering commands.
+	// The staging buffer needs its own command buffers so that they can be submitted all at once before any rendering commands.  One per frame in flight,
+	// for the same reason as the command contexts.  The copies go on the transfer queue, and everything that needs the graphics queue (layout setup,
+	// taking ownership of uploaded images) goes in a second command buffer submitted just ahead of the frame's rendering.
 	VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
 	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocateInfo.commandPool = renderObjects.commandPool;
+	commandBufferAllocateInfo.commandPool = renderObjects.transferCommandPool;
 	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferAllocateInfo.commandBufferCount = 1;
-	VK_CHECK( vkAllocateCommandBuffers( renderObjects.device, &commandBufferAllocateInfo, &stagingBuffer.commandBuffer ) );
+	commandBufferAllocateInfo.commandBufferCount = FRAMES_IN_FLIGHT;
+	VK_CHECK( vkAllocateCommandBuffers( renderObjects.device, &commandBufferAllocateInfo, stagingBuffer.commandBuffers ) );
+	commandBufferAllocateInfo.commandPool = renderObjects.commandPool;
+	VK_CHECK( vkAllocateCommandBuffers( renderObjects.device, &commandBufferAllocateInfo, stagingBuffer.graphicsCommandBuffers ) );
+
+	stagingBuffer.dedicatedTransferQueue = renderObjects.transferQueueFamilyIndex != renderObjects.queueFamilyIndex;
+	if ( stagingBuffer.dedicatedTransferQueue == true ) {
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+			VK_CHECK( vkCreateSemaphore( renderObjects.device, &semaphoreCreateInfo, NULL, &stagingBuffer.transferSemaphores[ i ] ) );
+		}
+	}
 
 	BeginStagingFrame();	// So we can stage resources during initialization
 }
 
+static void CreatePlaceholderImage() {
+	// A single mid grey texel stands out less than black or a checkerboard for the few frames most loads take.
+	static const uint8_t grey[ 4 ] = { 128, 128, 128, 255 };
+	decodedImage_t decoded = {};
+	decoded.data = grey;
+	decoded.size = sizeof( grey );
+	decoded.width = 1;
+	decoded.height = 1;
+	decoded.levelCount = 1;
+	decoded.format = IMAGE_FORMAT_RGBA8;
+	renderObjects.placeholderImage = Image::CreateFromData( decoded );
+}
+
 void Renderer_Init() {
 	CreateInstance();
 
@@ -317,25 +469,47 @@ void Renderer_Init() {
 
 	CreateRenderTargets();
 
+	CreatePlaceholderImage();
+
+	InitializeImageLoader();
+
+	InitializeTextureStreaming();
+
+	InitializeVirtualTexturing();
+
 	CreateUnifiedPipelineLayout();
 
 	CreateDescriptorPool();
 
-	CreateSamplers();
+	InitializeTransientAllocator();
 }
 
 void Renderer_BeginFrame() {
 	extern void PumpMessages();
 	PumpMessages();
-	VK_CHECK( vkWaitForFences( renderObjects.device, 1, &renderObjects.renderFence, VK_TRUE, VK_FOREVER ) );
-	VK_CHECK( vkResetFences( renderObjects.device, 1, &renderObjects.renderFence ) );
-
+	// Wait for the last frame that used this slot, rather than the previous frame, so the CPU can run up to FRAMES_IN_FLIGHT frames ahead.
+	renderObjects.frameIndex = ( uint32_t )( renderObjects.frameNumber % FRAMES_IN_FLIGHT );
+	VkFence renderFence = renderObjects.renderFences[ renderObjects.frameIndex ];
+	VK_CHECK( vkWaitForFences( renderObjects.device, 1, &renderFence, VK_TRUE, VK_FOREVER ) );
+	VK_CHECK( vkResetFences( renderObjects.device, 1, &renderFence ) );
+
+	// Everything the GPU used for this slot's previous frame is free now.
+	BeginTransientFrame();
+	FlushDeletionQueue();
+	BeginRenderTargetPoolFrame();
+
+	renderObjects.commandContext = renderObjects.commandContexts[ renderObjects.frameIndex ];
 	renderObjects.commandContext->Begin();
 	BeginStagingFrame();
+	UpdateImageLoader();	// Before the defragmenter, which rewrites the descriptor sets of images that have finished loading
+	UpdateTextureStreaming();
+	UpdateTextureResidency();
+	UpdateVirtualTexturing();
+	UpdateDefragmentation();
 }
 
 void Renderer_AcquireSwapchainImage() {
-	VK_CHECK( vkAcquireNextImageKHR( renderObjects.device, renderObjects.swapchain, VK_FOREVER, renderObjects.imageAcquireSemaphore, VK_NULL_HANDLE, &renderObjects.swapchainImageIndex ) );
+	VK_CHECK( vkAcquireNextImageKHR( renderObjects.device, renderObjects.swapchain, VK_FOREVER, renderObjects.imageAcquireSemaphores[ renderObjects.frameIndex ], VK_NULL_HANDLE, &renderObjects.swapchainImageIndex ) );
 
 	renderObjects.swapchainImage->SelectSwapchainImage( renderObjects.swapchainImageIndex );
 }
@@ -346,16 +520,28 @@ void Renderer_EndFrame() {
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	VkCommandBuffer commandBuffer = renderObjects.commandContext->GetCommandBuffer();
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &renderObjects.imageAcquireSemaphore;
-	submitInfo.pWaitDstStageMask = &waitStageMask;
+	// The staging graphics commands go first, so uploaded images are owned by this queue and in their final layout before rendering.
+	VkCommandBuffer commandBuffers[] = {
+		stagingBuffer.graphicsCommandBuffer,
+		renderObjects.commandContext->GetCommandBuffer(),
+	};
+	submitInfo.commandBufferCount = ARRAY_COUNT( commandBuffers );
+	submitInfo.pCommandBuffers = commandBuffers;
+	VkSemaphore waitSemaphores[] = {
+		renderObjects.imageAcquireSemaphores[ renderObjects.frameIndex ],
+		stagingBuffer.transferSemaphores[ renderObjects.frameIndex ],
+	};
+	// Only transfer work waits on the upload semaphore.  The ownership acquire barriers chain from it to the shaders that sample the images.
+	VkPipelineStageFlags waitStageMasks[] = {
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+	};
+	submitInfo.waitSemaphoreCount = stagingBuffer.dedicatedTransferQueue == true ? 2 : 1;
+	submitInfo.pWaitSemaphores = waitSemaphores;
+	submitInfo.pWaitDstStageMask = waitStageMasks;
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &renderObjects.renderCompleteSemaphore;
-	VK_CHECK( vkQueueSubmit( renderObjects.queue, 1, &submitInfo, renderObjects.renderFence ) );
+	submitInfo.pSignalSemaphores = &renderObjects.renderCompleteSemaphores[ renderObjects.frameIndex ];
+	VK_CHECK( vkQueueSubmit( renderObjects.queue, 1, &submitInfo, renderObjects.renderFences[ renderObjects.frameIndex ] ) );
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -363,6 +549,18 @@ void Renderer_EndFrame() {
 	presentInfo.pSwapchains = &renderObjects.swapchain;
 	presentInfo.pImageIndices = &renderObjects.swapchainImageIndex;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &renderObjects.renderCompleteSemaphore;
+	presentInfo.pWaitSemaphores = &renderObjects.renderCompleteSemaphores[ renderObjects.frameIndex ];
 	VK_CHECK( vkQueuePresentKHR( renderObjects.queue, &presentInfo ) );
+
+	++renderObjects.frameNumber;
+}
+
+bool Renderer_QuitRequested() {
+	extern bool IsQuitRequested();
+	return IsQuitRequested();
+}
+
+void Renderer_Shutdown() {
+	VK_CHECK( vkDeviceWaitIdle( renderObjects.device ) );
+	ShutdownImageLoader();
 }
\ No newline at end of file
@@ -35,44 +35,70 @@ struct Matrix44 {
 	float x[ 16 ];
 };
 
+// Matches DrawConstants in global.glslh.  Recorded straight into the command buffer with CommandContext::SetDrawConstants, so
+// per-object data doesn't cost a descriptor set bind per draw.  Vulkan only guarantees 128 bytes of push constants, so keep it small.
+struct drawConstants_t {
+	Matrix44	model;
+	uint32_t	objectIndex;	// For shaders that look their object's data up in a buffer
+	uint32_t	streamingFeedbackIndex;	// From GetStreamingFeedbackIndex, for shaders that record streaming feedback
+	uint32_t	padding[ 2 ];
+};
+
 const uint32_t SWAPCHAIN_IMAGE_COUNT = 2;
+// How many frames the CPU may record ahead of the GPU.  Anything the CPU writes per frame needs this many copies.
+const uint32_t FRAMES_IN_FLIGHT = 2;
 
 class Image;
 class CommandContext;
 
-enum samplerType_t {
-	SAMPLER_TYPE_LINEAR,
-	SAMPLER_TYPE_COUNT
-};
-
 struct renderObjects_t {
 	VkInstance							instance;
 	VkPhysicalDevice					physicalDevice;
+	VkPhysicalDeviceProperties			physicalDeviceProperties;
 	VkPhysicalDeviceMemoryProperties	memoryProperties;
+	// Set when VK_EXT_memory_budget is enabled, so the driver can tell us how much of each heap we may use
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR	getMemoryProperties2;
+	bool								memoryBudgetSupported;
+	// Integrated GPUs and software renderers have one pool of memory, and discrete GPUs with resizable BAR let the CPU write all of
+	// theirs.  Either way there's device local memory the CPU can write, as much of it as there is device local memory at all, so
+	// resources can be filled in place instead of through the staging ring.
+	bool								deviceLocalMappable;
+	bool								samplerAnisotropySupported;
+	// Fragment shaders may only write storage buffers with this, so shaders that record texture feedback need a variant without it.
+	bool								fragmentStoresSupported;
 	VkDevice							device;
 	uint32_t							queueFamilyIndex;
 	VkQueue								queue;
+	// Uploads go through a transfer-only queue family when the device has one, so they run alongside graphics work.
+	// Without one, these are the same as queueFamilyIndex and queue.
+	uint32_t							transferQueueFamilyIndex;
+	VkQueue								transferQueue;
+	// Partial image copies on the transfer queue must line up with this, in texels or compressed blocks.  Zero means whole levels only.
+	VkExtent3D							transferImageGranularity;
+	VkCommandPool						transferCommandPool;
 	VkSurfaceKHR						surface;
 	VkExtent2D							swapchainExtent;
 	VkFormat							swapchainFormat;
 	VkSwapchainKHR						swapchain;
 	VkFramebuffer						framebuffers[ SWAPCHAIN_IMAGE_COUNT ];
 	VkCommandPool						commandPool;
-	CommandContext *					commandContext;
-	VkFence								renderFence;
-	VkSemaphore							imageAcquireSemaphore;
-	VkSemaphore							renderCompleteSemaphore;
+	CommandContext *					commandContexts[ FRAMES_IN_FLIGHT ];
+	CommandContext *					commandContext;	// The context for the frame currently being recorded
+	VkFence								renderFences[ FRAMES_IN_FLIGHT ];
+	VkSemaphore							imageAcquireSemaphores[ FRAMES_IN_FLIGHT ];
+	VkSemaphore							renderCompleteSemaphores[ FRAMES_IN_FLIGHT ];
 	uint32_t							swapchainImageIndex;
+	uint64_t							frameNumber;	// Monotonic count of frames begun
+	uint32_t							frameIndex;		// frameNumber % FRAMES_IN_FLIGHT, selects per-frame resources
 	VkDescriptorPool					descriptorPool;
 	VkDescriptorSetLayout				frameDescriptorSetLayout;
 	VkDescriptorSetLayout				viewDescriptorSetLayout;
 	VkDescriptorSetLayout				meshDescriptorSetLayout;
 	VkPipelineLayout					unifiedPipelineLayout;
-	VkSampler							samplers[ SAMPLER_TYPE_COUNT ];
 	
 	Image *								colorImage;
-	Image *								depthImage;
 	Image *								swapchainImage;
+	Image *								placeholderImage;	// Sampled in place of images that are still loading
 };
 
 extern renderObjects_t renderObjects;
@@ -80,4 +106,8 @@ extern renderObjects_t renderObjects;
 void Renderer_Init();
 void Renderer_BeginFrame();
 void Renderer_AcquireSwapchainImage();
-void Renderer_EndFrame();
\ No newline at end of file
+void Renderer_EndFrame();
+// Whether the window has been closed, which should end the render loop.
+bool Renderer_QuitRequested();
+// Stop the threads that would otherwise outlive main.  The driver reclaims the device objects along with the process.
+void Renderer_Shutdown();
\ No newline at end of file
@@ -4,13 +4,23 @@
 #include <windows.h>
 
 static HWND hwnd;
+static bool quitRequested = false;
+
+// Closing the window only asks the render loop to stop, so the renderer can shut down while the window is still around.
+static LRESULT CALLBACK WindowProc( HWND window, UINT message, WPARAM wParam, LPARAM lParam ) {
+	if ( message == WM_CLOSE ) {
+		quitRequested = true;
+		return 0;
+	}
+	return DefWindowProcA( window, message, wParam, lParam );
+}
 
 void CreateSurface() {
 	HINSTANCE hInstance = GetModuleHandle( NULL );
 	char * className = "myClass";
 	WNDCLASSEXA myClass = {};
 	myClass.cbSize = sizeof( myClass );
-	myClass.lpfnWndProc = DefWindowProcA;
+	myClass.lpfnWndProc = WindowProc;
 	myClass.hInstance = hInstance;
 	myClass.hIcon = LoadIcon( NULL, IDI_APPLICATION );
 	myClass.hCursor = LoadCursor( NULL, IDC_ARROW );
@@ -44,4 +54,35 @@ void PumpMessages() {
 		TranslateMessage( &msg );
 		DispatchMessageA( &msg );
 	}
+}
+
+bool IsQuitRequested() {
+	return quitRequested;
+}
+
+void PrintDebugMessage( const char * message ) {
+	OutputDebugStringA( message );
+}
+
+// Map a whole file for reading.  Returns NULL if it can't be opened.  The view holds on to the file, so no handles need to be kept.
+const void * MapFile( const char * filename, uint64_t & size ) {
+	HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return NULL;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx( file, &fileSize );
+	size = ( uint64_t )fileSize.QuadPart;
+	HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if ( mapping == NULL ) {
+		return NULL;
+	}
+	const void * result = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	return result;
+}
+
+void UnmapFile( const void * data ) {
+	UnmapViewOfFile( data );
 }
\ No newline at end of file
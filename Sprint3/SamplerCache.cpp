@@ -0,0 +1,146 @@
+#include "SamplerCache.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+bool samplerDescription_t::operator ==( const samplerDescription_t & other ) const {
+	return minFilter == other.minFilter && magFilter == other.magFilter && mipFilter == other.mipFilter && addressU == other.addressU &&
+		addressV == other.addressV && addressW == other.addressW && maxAnisotropy == other.maxAnisotropy && lodBias == other.lodBias &&
+		minLod == other.minLod && maxLod == other.maxLod && compare == other.compare;
+}
+
+// FNV-1a over the fields one at a time, so padding never takes part.
+struct samplerDescriptionHash_t {
+	static void Combine( size_t & hash, const void * data, size_t size ) {
+		const uint8_t * bytes = ( const uint8_t * )data;
+		for ( size_t i = 0; i < size; ++i ) {
+			hash = ( hash ^ bytes[ i ] ) * 1099511628211ULL;
+		}
+	}
+
+	size_t operator ()( const samplerDescription_t & description ) const {
+		size_t hash = ( size_t )14695981039346656037ULL;
+		Combine( hash, &description.minFilter, sizeof( description.minFilter ) );
+		Combine( hash, &description.magFilter, sizeof( description.magFilter ) );
+		Combine( hash, &description.mipFilter, sizeof( description.mipFilter ) );
+		Combine( hash, &description.addressU, sizeof( description.addressU ) );
+		Combine( hash, &description.addressV, sizeof( description.addressV ) );
+		Combine( hash, &description.addressW, sizeof( description.addressW ) );
+		Combine( hash, &description.maxAnisotropy, sizeof( description.maxAnisotropy ) );
+		Combine( hash, &description.lodBias, sizeof( description.lodBias ) );
+		Combine( hash, &description.minLod, sizeof( description.minLod ) );
+		Combine( hash, &description.maxLod, sizeof( description.maxLod ) );
+		Combine( hash, &description.compare, sizeof( description.compare ) );
+		return hash;
+	}
+};
+
+struct samplerCache_t {
+	std::unordered_map< samplerDescription_t, samplerHandle_t, samplerDescriptionHash_t >	handles;
+	std::vector< VkSampler >																samplers;	// Indexed by handle
+};
+
+static samplerCache_t samplerCache;
+
+samplerDescription_t MakeSamplerDescription( samplerFilter_t filter, samplerFilter_t mipFilter, samplerAddressMode_t addressMode ) {
+	samplerDescription_t result = {};
+	result.minFilter = filter;
+	result.magFilter = filter;
+	result.mipFilter = mipFilter;
+	result.addressU = addressMode;
+	result.addressV = addressMode;
+	result.addressW = addressMode;
+	result.maxAnisotropy = 1.0f;
+	result.maxLod = SAMPLER_LOD_CLAMP_NONE;
+	result.compare = SAMPLER_COMPARE_NONE;
+	return result;
+}
+
+static VkFilter TranslateFilter( samplerFilter_t filter ) {
+	return filter == SAMPLER_FILTER_LINEAR ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+}
+
+static VkSamplerAddressMode TranslateAddressMode( samplerAddressMode_t addressMode ) {
+	switch ( addressMode ) {
+		case SAMPLER_ADDRESS_REPEAT: {
+			return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		}
+		case SAMPLER_ADDRESS_MIRRORED_REPEAT: {
+			return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+		}
+		case SAMPLER_ADDRESS_CLAMP_TO_EDGE: {
+			return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		}
+		case SAMPLER_ADDRESS_CLAMP_TO_BORDER: {
+			return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		}
+	}
+	return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+}
+
+static VkCompareOp TranslateCompare( samplerCompare_t compare ) {
+	switch ( compare ) {
+		case SAMPLER_COMPARE_NONE: {
+			return VK_COMPARE_OP_ALWAYS;
+		}
+		case SAMPLER_COMPARE_LESS: {
+			return VK_COMPARE_OP_LESS;
+		}
+		case SAMPLER_COMPARE_LESS_OR_EQUAL: {
+			return VK_COMPARE_OP_LESS_OR_EQUAL;
+		}
+		case SAMPLER_COMPARE_GREATER: {
+			return VK_COMPARE_OP_GREATER;
+		}
+		case SAMPLER_COMPARE_GREATER_OR_EQUAL: {
+			return VK_COMPARE_OP_GREATER_OR_EQUAL;
+		}
+	}
+	return VK_COMPARE_OP_ALWAYS;
+}
+
+samplerHandle_t GetSampler( const samplerDescription_t & description ) {
+	std::unordered_map< samplerDescription_t, samplerHandle_t, samplerDescriptionHash_t >::const_iterator it = samplerCache.handles.find( description );
+	if ( it != samplerCache.handles.end() ) {
+		return it->second;
+	}
+
+	const VkPhysicalDeviceLimits & limits = renderObjects.physicalDeviceProperties.limits;
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.minFilter = TranslateFilter( description.minFilter );
+	samplerCreateInfo.magFilter = TranslateFilter( description.magFilter );
+	samplerCreateInfo.mipmapMode = description.mipFilter == SAMPLER_FILTER_LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = TranslateAddressMode( description.addressU );
+	samplerCreateInfo.addressModeV = TranslateAddressMode( description.addressV );
+	samplerCreateInfo.addressModeW = TranslateAddressMode( description.addressW );
+	samplerCreateInfo.mipLodBias = std::min( std::max( description.lodBias, -limits.maxSamplerLodBias ), limits.maxSamplerLodBias );
+	// Without the feature, anisotropic descriptions quietly get the plain filter rather than failing.
+	if ( description.maxAnisotropy > 1.0f && renderObjects.samplerAnisotropySupported == true ) {
+		samplerCreateInfo.anisotropyEnable = VK_TRUE;
+		samplerCreateInfo.maxAnisotropy = std::min( description.maxAnisotropy, limits.maxSamplerAnisotropy );
+	}
+	if ( description.compare != SAMPLER_COMPARE_NONE ) {
+		samplerCreateInfo.compareEnable = VK_TRUE;
+		samplerCreateInfo.compareOp = TranslateCompare( description.compare );
+	}
+	samplerCreateInfo.minLod = description.minLod;
+	samplerCreateInfo.maxLod = description.maxLod;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+	VkSampler sampler;
+	VK_CHECK( vkCreateSampler( renderObjects.device, &samplerCreateInfo, NULL, &sampler ) );
+
+	const samplerHandle_t handle = ( samplerHandle_t )samplerCache.samplers.size();
+	samplerCache.samplers.push_back( sampler );
+	samplerCache.handles[ description ] = handle;
+	return handle;
+}
+
+VkSampler GetVkSampler( samplerHandle_t handle ) {
+	return samplerCache.samplers[ handle ];
+}
+
+uint32_t GetSamplerCount() {
+	return ( uint32_t )samplerCache.samplers.size();
+}
\ No newline at end of file
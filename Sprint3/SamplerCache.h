@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Renderer.h"
+
+// Samplers are described by their state and made on first use.  Descriptions that match share one VkSampler, so materials can ask for
+// whatever sampling they need without creating duplicates, and hold on to the handle.
+enum samplerFilter_t {
+	SAMPLER_FILTER_NEAREST,
+	SAMPLER_FILTER_LINEAR,
+};
+
+enum samplerAddressMode_t {
+	SAMPLER_ADDRESS_REPEAT,
+	SAMPLER_ADDRESS_MIRRORED_REPEAT,
+	SAMPLER_ADDRESS_CLAMP_TO_EDGE,
+	SAMPLER_ADDRESS_CLAMP_TO_BORDER,	// The border is opaque black
+};
+
+// For shadow maps and other depth comparisons.  Anything but SAMPLER_COMPARE_NONE needs a sampler2DShadow in the shader.
+enum samplerCompare_t {
+	SAMPLER_COMPARE_NONE,
+	SAMPLER_COMPARE_LESS,
+	SAMPLER_COMPARE_LESS_OR_EQUAL,
+	SAMPLER_COMPARE_GREATER,
+	SAMPLER_COMPARE_GREATER_OR_EQUAL,
+};
+
+const float SAMPLER_LOD_CLAMP_NONE = 1000.0f;	// Same as VK_LOD_CLAMP_NONE
+
+struct samplerDescription_t {
+	samplerFilter_t			minFilter;
+	samplerFilter_t			magFilter;
+	samplerFilter_t			mipFilter;
+	samplerAddressMode_t	addressU;
+	samplerAddressMode_t	addressV;
+	samplerAddressMode_t	addressW;
+	float					maxAnisotropy;	// 1 turns anisotropic filtering off.  Clamped to what the device supports
+	float					lodBias;
+	float					minLod;
+	float					maxLod;			// 0 samples only the base level
+	samplerCompare_t		compare;
+
+	bool operator ==( const samplerDescription_t & other ) const;
+};
+
+typedef uint32_t samplerHandle_t;
+
+// Everything filtered the same way and addressed the same way on all axes, across the whole mip chain, without anisotropy.  The other
+// fields can be changed before calling GetSampler.
+samplerDescription_t MakeSamplerDescription( samplerFilter_t filter, samplerFilter_t mipFilter, samplerAddressMode_t addressMode );
+samplerHandle_t GetSampler( const samplerDescription_t & description );
+VkSampler GetVkSampler( samplerHandle_t handle );
+uint32_t GetSamplerCount();
\ No newline at end of file
@@ -1,15 +1,12 @@
 #include "ShaderProgram.h"
+#include "CommandContext.h"
+#include "DeletionQueue.h"
 #include <string>
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
-ShaderProgram * ShaderProgram::Create( const char * shaderName ) {
-	ShaderProgram * result = new ShaderProgram;
-
-	std::string filename = shaderName;
-	filename.append( ".vspv" );
-
-	HANDLE fileHandle = CreateFile( filename.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+static VkShaderModule CreateShaderModule( const char * filename ) {
+	HANDLE fileHandle = CreateFile( filename, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
 	DWORD fileSize = GetFileSize( fileHandle, NULL );
 
 	char * spirvBuffer = new char[ fileSize ];
@@ -20,26 +17,35 @@ ShaderProgram * ShaderProgram::Create( const char * shaderName ) {
 	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	shaderModuleCreateInfo.codeSize = fileSize;
 	shaderModuleCreateInfo.pCode = ( uint32_t * )spirvBuffer;
-	VK_CHECK( vkCreateShaderModule( renderObjects.device, &shaderModuleCreateInfo, NULL, &result->m_vertexShader ) );
+	VkShaderModule result;
+	VK_CHECK( vkCreateShaderModule( renderObjects.device, &shaderModuleCreateInfo, NULL, &result ) );
 
 	delete[] spirvBuffer;
 	CloseHandle( fileHandle );
-	
-	filename = shaderName;
-	filename.append( ".fspv" );
+	return result;
+}
 
-	fileHandle = CreateFile( filename.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
-	fileSize = GetFileSize( fileHandle, NULL );
+ShaderProgram * ShaderProgram::Create( const char * shaderName ) {
+	return Create( shaderName, shaderName );
+}
 
-	spirvBuffer = new char[ fileSize ];
-	ReadFile( fileHandle, spirvBuffer, fileSize, &bytesRead, NULL );
+ShaderProgram * ShaderProgram::Create( const char * vertexShaderName, const char * fragmentShaderName ) {
+	ShaderProgram * result = new ShaderProgram;
 
-	shaderModuleCreateInfo.codeSize = fileSize;
-	shaderModuleCreateInfo.pCode = ( uint32_t * )spirvBuffer;
-	VK_CHECK( vkCreateShaderModule( renderObjects.device, &shaderModuleCreateInfo, NULL, &result->m_fragmentShader ) );
+	std::string filename = vertexShaderName;
+	filename.append( ".vspv" );
+	result->m_vertexShader = CreateShaderModule( filename.c_str() );
 
-	delete[] spirvBuffer;
-	CloseHandle( fileHandle );
+	filename = fragmentShaderName;
+	filename.append( ".fspv" );
+	result->m_fragmentShader = CreateShaderModule( filename.c_str() );
 
 	return result;
+}
+
+void ShaderProgram::Destroy( ShaderProgram * shader ) {
+	ReleasePipelinesUsingShader( shader );
+	DeferDestroyShaderModule( shader->m_vertexShader );
+	DeferDestroyShaderModule( shader->m_fragmentShader );
+	delete shader;
 }
\ No newline at end of file
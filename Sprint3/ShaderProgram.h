@@ -5,6 +5,10 @@
 class ShaderProgram {
 public:
 	static ShaderProgram * Create( const char * shaderName );
+	// For variants of a fragment shader built with different defines, which share the vertex shader.
+	static ShaderProgram * Create( const char * vertexShaderName, const char * fragmentShaderName );
+	// Also releases every pipeline that was created with the program.
+	static void Destroy( ShaderProgram * shader );
 	VkShaderModule GetVertexModule() const { return m_vertexShader; }
 	VkShaderModule GetFragmentModule() const { return m_fragmentShader; }
 
@@ -0,0 +1,258 @@
+#include "TextureAtlas.h"
+#include "Image.h"
+#include "TextureProcessing.h"
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+// Bottom-left skyline packing.  The top edge of everything placed so far is kept as a list of horizontal segments, and each rectangle
+// goes where its bottom ends up lowest, breaking ties to the left.  It wastes the space under overhangs, but for small images sorted
+// by height that's very little, and it's much cheaper than keeping free rectangles.
+struct skylineSegment_t {
+	uint32_t	x;
+	uint32_t	y;
+	uint32_t	width;
+};
+
+struct skyline_t {
+	uint32_t							extent;
+	std::vector< skylineSegment_t >		segments;
+};
+
+static void InitializeSkyline( skyline_t & skyline, uint32_t extent ) {
+	skyline.extent = extent;
+	skyline.segments.clear();
+	skyline.segments.push_back( { 0, 0, extent } );
+}
+
+// The height a rectangle starting at the segment would rest at, or false if it runs off the page.
+static bool FitSkyline( const skyline_t & skyline, size_t segment, uint32_t width, uint32_t height, uint32_t & y ) {
+	const uint32_t x = skyline.segments[ segment ].x;
+	if ( x + width > skyline.extent ) {
+		return false;
+	}
+	y = 0;
+	uint32_t remaining = width;
+	for ( size_t i = segment; remaining > 0; ++i ) {
+		y = std::max( y, skyline.segments[ i ].y );
+		remaining -= std::min( remaining, skyline.segments[ i ].width );
+	}
+	return y + height <= skyline.extent;
+}
+
+static bool InsertSkyline( skyline_t & skyline, uint32_t width, uint32_t height, uint32_t & x, uint32_t & y ) {
+	size_t bestSegment = skyline.segments.size();
+	uint32_t bestY = ~0U;
+	for ( size_t i = 0; i < skyline.segments.size(); ++i ) {
+		uint32_t segmentY;
+		if ( FitSkyline( skyline, i, width, height, segmentY ) == true && segmentY + height < bestY ) {
+			bestSegment = i;
+			bestY = segmentY + height;
+		}
+	}
+	if ( bestSegment == skyline.segments.size() ) {
+		return false;
+	}
+	x = skyline.segments[ bestSegment ].x;
+	y = bestY - height;
+
+	// The new segment replaces what it covers, and trims the segment it ends partway across.
+	std::vector< skylineSegment_t > & segments = skyline.segments;
+	segments.insert( segments.begin() + bestSegment, { x, bestY, width } );
+	const uint32_t right = x + width;
+	size_t i = bestSegment + 1;
+	while ( i < segments.size() && segments[ i ].x < right ) {
+		const uint32_t segmentRight = segments[ i ].x + segments[ i ].width;
+		if ( segmentRight <= right ) {
+			segments.erase( segments.begin() + i );
+		} else {
+			segments[ i ].width = segmentRight - right;
+			segments[ i ].x = right;
+			break;
+		}
+	}
+	// Neighbours at the same height merge, so the list stays short.
+	for ( size_t j = 0; j + 1 < segments.size(); ) {
+		if ( segments[ j ].y == segments[ j + 1 ].y ) {
+			segments[ j ].width += segments[ j + 1 ].width;
+			segments.erase( segments.begin() + j + 1 );
+		} else {
+			++j;
+		}
+	}
+	return true;
+}
+
+struct atlasSource_t {
+	decodedImage_t	decoded;
+	uint32_t		index;
+	uint32_t		cellWidth;	// With the gutter, rounded up to the padding
+	uint32_t		cellHeight;
+};
+
+static uint32_t AlignUp( uint32_t value, uint32_t alignment ) {
+	return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+static void ReleaseAtlasPage( void * data ) {
+	free( data );
+}
+
+// Fill the gutter of an entry at one level of the chain with the nearest texel of the image at that level.  The cell is the image
+// and its gutter, which at this level starts and ends on whole texels because cells are placed on the padding.
+static void FillGutter( uint8_t * level, uint32_t levelExtent, const atlasEntry_t & entry, uint32_t padding, uint32_t mipLevel ) {
+	const uint32_t cellX = ( entry.x - padding ) >> mipLevel;
+	const uint32_t cellY = ( entry.y - padding ) >> mipLevel;
+	const uint32_t cellRight = std::min( AlignUp( entry.x + entry.width + padding, padding ) >> mipLevel, levelExtent );
+	const uint32_t cellBottom = std::min( AlignUp( entry.y + entry.height + padding, padding ) >> mipLevel, levelExtent );
+	// The image covers any texel it partly covers at this level.
+	const uint32_t scale = 1U << mipLevel;
+	const uint32_t imageX = entry.x >> mipLevel;
+	const uint32_t imageY = entry.y >> mipLevel;
+	const uint32_t imageRight = std::max( ( entry.x + entry.width + scale - 1 ) >> mipLevel, imageX + 1 );
+	const uint32_t imageBottom = std::max( ( entry.y + entry.height + scale - 1 ) >> mipLevel, imageY + 1 );
+	for ( uint32_t y = cellY; y < cellBottom; ++y ) {
+		const uint32_t sourceY = std::min( std::max( y, imageY ), imageBottom - 1 );
+		for ( uint32_t x = cellX; x < cellRight; ++x ) {
+			if ( y >= imageY && y < imageBottom && x >= imageX && x < imageRight ) {
+				continue;
+			}
+			const uint32_t sourceX = std::min( std::max( x, imageX ), imageRight - 1 );
+			memcpy( level + ( y * levelExtent + x ) * 4, level + ( sourceY * levelExtent + sourceX ) * 4, 4 );
+		}
+	}
+}
+
+TextureAtlas * TextureAtlas::Create( const char * const * filenames, uint32_t fileCount, uint32_t pageExtent, uint32_t padding ) {
+	assert( padding > 0 && ( padding & ( padding - 1 ) ) == 0 );
+	assert( ( pageExtent & ( pageExtent - 1 ) ) == 0 );
+	std::vector< atlasSource_t > sources( fileCount );
+	for ( uint32_t i = 0; i < fileCount; ++i ) {
+		atlasSource_t & source = sources[ i ];
+		const bool decoded = DecodeImageFile( filenames[ i ], source.decoded );
+		assert( decoded == true );
+		( void )decoded;
+		assert( source.decoded.format == IMAGE_FORMAT_RGBA8 );
+		source.index = i;
+		source.cellWidth = AlignUp( source.decoded.width + 2 * padding, padding );
+		source.cellHeight = AlignUp( source.decoded.height + 2 * padding, padding );
+		assert( source.cellWidth <= pageExtent && source.cellHeight <= pageExtent );
+	}
+	std::sort( sources.begin(), sources.end(), []( const atlasSource_t & a, const atlasSource_t & b ) {
+		return a.cellHeight != b.cellHeight ? a.cellHeight > b.cellHeight : a.cellWidth > b.cellWidth;
+	} );
+
+	TextureAtlas * result = new TextureAtlas;
+	result->m_pageExtent = pageExtent;
+	result->m_entries.resize( fileCount );
+	// The gutter is at least a texel wide down to the level where it's been halved to one.
+	uint32_t gutterLevels = 1;
+	while ( ( padding >> gutterLevels ) > 0 ) {
+		++gutterLevels;
+	}
+	result->m_maxLod = ( float )( gutterLevels - 1 );
+
+	// Every page is packed until something doesn't fit, then the rest go on a new page.  Sorted by height, what didn't fit is usually
+	// no smaller than anything after it, so earlier pages aren't revisited.
+	std::vector< skyline_t > skylines;
+	for ( size_t i = 0; i < sources.size(); ++i ) {
+		const atlasSource_t & source = sources[ i ];
+		uint32_t x;
+		uint32_t y;
+		if ( skylines.empty() == true || InsertSkyline( skylines.back(), source.cellWidth / padding, source.cellHeight / padding, x, y ) == false ) {
+			skylines.push_back( skyline_t() );
+			InitializeSkyline( skylines.back(), pageExtent / padding );	// In units of the padding, so cells stay aligned to it
+			const bool inserted = InsertSkyline( skylines.back(), source.cellWidth / padding, source.cellHeight / padding, x, y );
+			assert( inserted == true );
+			( void )inserted;
+		}
+		atlasEntry_t & entry = result->m_entries[ source.index ];
+		entry.page = ( uint32_t )skylines.size() - 1;
+		entry.x = x * padding + padding;
+		entry.y = y * padding + padding;
+		entry.width = source.decoded.width;
+		entry.height = source.decoded.height;
+		entry.uvOffset.x = ( float )entry.x / pageExtent;
+		entry.uvOffset.y = ( float )entry.y / pageExtent;
+		entry.uvScale.x = ( float )entry.width / pageExtent;
+		entry.uvScale.y = ( float )entry.height / pageExtent;
+	}
+
+	// The chain is built on the CPU rather than blitted, so the gutters can be rebuilt at every level before they're uploaded.
+	const uint32_t mipLevels = GetMipLevelCount( pageExtent, pageExtent );
+	const uint32_t baseSize = pageExtent * pageExtent * 4;
+	uint8_t * base = ( uint8_t * )malloc( baseSize );
+	for ( uint32_t page = 0; page < ( uint32_t )skylines.size(); ++page ) {
+		memset( base, 0, baseSize );
+		for ( size_t i = 0; i < sources.size(); ++i ) {
+			const atlasSource_t & source = sources[ i ];
+			const atlasEntry_t & entry = result->m_entries[ source.index ];
+			if ( entry.page != page ) {
+				continue;
+			}
+			const uint8_t * texels = ( const uint8_t * )source.decoded.data;
+			for ( uint32_t y = 0; y < entry.height; ++y ) {
+				memcpy( base + ( ( entry.y + y ) * pageExtent + entry.x ) * 4, texels + y * entry.width * 4, entry.width * 4 );
+			}
+			FillGutter( base, pageExtent, entry, padding, 0 );
+		}
+
+		uint32_t chainSize;
+		uint8_t * chain = BuildMipChain( base, pageExtent, pageExtent, mipLevels, 4, chainSize );
+		uint8_t * level = chain + baseSize;
+		for ( uint32_t mipLevel = 1; mipLevel < gutterLevels; ++mipLevel ) {
+			const uint32_t levelExtent = GetMipExtent( pageExtent, mipLevel );
+			for ( size_t i = 0; i < result->m_entries.size(); ++i ) {
+				if ( result->m_entries[ i ].page == page ) {
+					FillGutter( level, levelExtent, result->m_entries[ i ], padding, mipLevel );
+				}
+			}
+			level += levelExtent * levelExtent * 4;
+		}
+		// The levels past the gutters were filtered from gutters that hadn't been rebuilt yet, but the sampler never reaches them.
+
+		decodedImage_t decoded = {};
+		decoded.data = chain;
+		decoded.size = chainSize;
+		decoded.width = pageExtent;
+		decoded.height = pageExtent;
+		decoded.levelCount = mipLevels;
+		decoded.format = IMAGE_FORMAT_RGBA8;
+		decoded.release = ReleaseAtlasPage;
+		decoded.releaseContext = chain;
+		result->m_pages.push_back( Image::CreateFromData( decoded ) );
+	}
+	free( base );
+
+	for ( size_t i = 0; i < sources.size(); ++i ) {
+		sources[ i ].decoded.release( sources[ i ].decoded.releaseContext );
+	}
+	return result;
+}
+
+void TextureAtlas::Destroy( TextureAtlas * atlas ) {
+	for ( size_t i = 0; i < atlas->m_pages.size(); ++i ) {
+		Image::Destroy( atlas->m_pages[ i ] );
+	}
+	delete atlas;
+}
+
+void TextureAtlas::RemapUVs( uint32_t entry, vertex_t * vertices, uint32_t vertexCount ) const {
+	const atlasEntry_t & atlasEntry = m_entries[ entry ];
+	for ( uint32_t i = 0; i < vertexCount; ++i ) {
+		assert( vertices[ i ].uv.x >= 0.0f && vertices[ i ].uv.x <= 1.0f && vertices[ i ].uv.y >= 0.0f && vertices[ i ].uv.y <= 1.0f );
+		vertices[ i ].uv.x = atlasEntry.uvOffset.x + vertices[ i ].uv.x * atlasEntry.uvScale.x;
+		vertices[ i ].uv.y = atlasEntry.uvOffset.y + vertices[ i ].uv.y * atlasEntry.uvScale.y;
+	}
+}
+
+float TextureAtlas::GetOccupancy() const {
+	if ( m_pages.empty() == true ) {
+		return 0.0f;
+	}
+	uint64_t imageTexels = 0;
+	for ( size_t i = 0; i < m_entries.size(); ++i ) {
+		imageTexels += ( uint64_t )m_entries[ i ].width * m_entries[ i ].height;
+	}
+	return ( float )( ( double )imageTexels / ( ( double )m_pageExtent * m_pageExtent * m_pages.size() ) );
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Renderer.h"
+#include <vector>
+
+class Image;
+
+// Small textures, like UI icons and prop decals, are packed into shared atlas pages, so draws that use different ones can share an
+// image and a descriptor set.  Every image gets a gutter of ATLAS_PADDING texels of its own edge texels around it, which is rebuilt
+// at every mip level the atlas allows, so filtering never picks up a neighbour.  Only UVs within [0, 1] can be remapped into an atlas,
+// so textures that repeat have to stay on their own.
+const uint32_t ATLAS_PAGE_EXTENT = 2048;
+const uint32_t ATLAS_PADDING = 4;		// A power of two.  Images are placed on this boundary so their gutters stay whole down the chain
+
+// Where an image ended up.  Its UVs become uvOffset + uv * uvScale, on the given page.
+struct atlasEntry_t {
+	uint32_t	page;
+	uint32_t	x;			// Texels of the image within the page, without the gutter
+	uint32_t	y;
+	uint32_t	width;
+	uint32_t	height;
+	Vector2		uvOffset;
+	Vector2		uvScale;
+};
+
+class TextureAtlas {
+public:
+	// Pack the images of the files into as few pages as they fit, using a skyline packer, tallest images first.  The files must be
+	// source images, or RGBA8 baked textures, of which only the base level is used.  Every image must fit on a page with its gutter.
+	static TextureAtlas * Create( const char * const * filenames, uint32_t fileCount, uint32_t pageExtent = ATLAS_PAGE_EXTENT, uint32_t padding = ATLAS_PADDING );
+	static void Destroy( TextureAtlas * atlas );
+	uint32_t GetPageCount() const { return ( uint32_t )m_pages.size(); }
+	const Image * GetPage( uint32_t page ) const { return m_pages[ page ]; }
+	// In the order the files were given.
+	const atlasEntry_t & GetEntry( uint32_t index ) const { return m_entries[ index ]; }
+	uint32_t GetEntryCount() const { return ( uint32_t )m_entries.size(); }
+	// Below this level the gutters are less than a texel wide.  Use it as the maxLod of the atlas's sampler.
+	float GetMaxLod() const { return m_maxLod; }
+	// Move the UVs of vertices that sample the entry's image into the atlas, before the mesh is created.
+	void RemapUVs( uint32_t entry, vertex_t * vertices, uint32_t vertexCount ) const;
+	// How much of the pages is taken by images rather than gutters and empty space, to see how well the packer is doing.
+	float GetOccupancy() const;
+
+private:
+	std::vector< Image * > m_pages;
+	std::vector< atlasEntry_t > m_entries;
+	uint32_t m_pageExtent = 0;
+	float m_maxLod = 0.0f;
+
+private:
+	TextureAtlas() = default;
+};
\ No newline at end of file
@@ -0,0 +1,106 @@
+// Offline tool that converts a source image into a baked texture: the full mip chain, block compressed ahead of time, in the
+// container described in TextureFile.h, which DecodeImageFile maps and stages without decoding anything.
+//
+// Usage: TextureBaker <source image> <output file> <bc1|bc3|bc4|bc5|bc7|rgba8>
+#include <vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "TextureFile.h"
+#include "TextureProcessing.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.c"
+
+struct bakeFormat_t {
+	const char *		name;
+	VkFormat			vkFormat;
+	blockCompression_t	compression;
+	bool				compressed;
+};
+
+static const bakeFormat_t bakeFormats[] = {
+	{ "bc1", VK_FORMAT_BC1_RGB_UNORM_BLOCK, BLOCK_COMPRESSION_BC1, true },
+	{ "bc3", VK_FORMAT_BC3_UNORM_BLOCK, BLOCK_COMPRESSION_BC3, true },
+	{ "bc4", VK_FORMAT_BC4_UNORM_BLOCK, BLOCK_COMPRESSION_BC4, true },
+	{ "bc5", VK_FORMAT_BC5_UNORM_BLOCK, BLOCK_COMPRESSION_BC5, true },
+	{ "bc7", VK_FORMAT_BC7_UNORM_BLOCK, BLOCK_COMPRESSION_BC7, true },
+	{ "rgba8", VK_FORMAT_R8G8B8A8_UNORM, BLOCK_COMPRESSION_COUNT, false },
+};
+
+int main( int argc, char ** argv ) {
+	if ( argc != 4 ) {
+		fprintf( stderr, "Usage: TextureBaker <source image> <output file> <bc1|bc3|bc4|bc5|bc7|rgba8>\n" );
+		return 1;
+	}
+	const bakeFormat_t * format = NULL;
+	for ( uint32_t i = 0; i < sizeof( bakeFormats ) / sizeof( bakeFormats[ 0 ] ); ++i ) {
+		if ( strcmp( argv[ 3 ], bakeFormats[ i ].name ) == 0 ) {
+			format = &bakeFormats[ i ];
+		}
+	}
+	if ( format == NULL ) {
+		fprintf( stderr, "Unknown format %s\n", argv[ 3 ] );
+		return 1;
+	}
+
+	int x;
+	int y;
+	int comp;
+	uint8_t * source = stbi_load( argv[ 1 ], &x, &y, &comp, 4 );
+	if ( source == NULL ) {
+		fprintf( stderr, "Couldn't load %s: %s\n", argv[ 1 ], stbi_failure_reason() );
+		return 1;
+	}
+	const uint32_t width = ( uint32_t )x;
+	const uint32_t height = ( uint32_t )y;
+
+	// The mip levels are filtered from the uncompressed image, so compression errors don't add up from one level to the next.
+	const uint32_t mipLevels = GetMipLevelCount( width, height );
+	uint32_t chainSize;
+	uint8_t * chain = BuildMipChain( source, width, height, mipLevels, 4, chainSize );
+	stbi_image_free( source );
+
+	// The level data is gathered first, so the level index can be filled in before anything is written.
+	std::vector< uint8_t > data;
+	std::vector< textureFileLevel_t > levels( mipLevels );
+	const uint64_t dataOffset = GetTextureFileDataOffset( mipLevels );
+	const uint8_t * level = chain;
+	for ( uint32_t i = 0; i < mipLevels; ++i ) {
+		const uint32_t levelWidth = GetMipExtent( width, i );
+		const uint32_t levelHeight = GetMipExtent( height, i );
+		const size_t offset = data.size();
+		if ( format->compressed == true ) {
+			data.resize( offset + GetCompressedSize( format->compression, levelWidth, levelHeight ) );
+			CompressImage( format->compression, level, levelWidth, levelHeight, data.data() + offset );
+		} else {
+			data.insert( data.end(), level, level + levelWidth * levelHeight * 4 );
+		}
+		levels[ i ].offset = dataOffset + offset;
+		levels[ i ].size = data.size() - offset;
+		level += levelWidth * levelHeight * 4;
+	}
+	free( chain );
+
+	textureFileHeader_t header = {};
+	header.magic = TEXTURE_FILE_MAGIC;
+	header.version = TEXTURE_FILE_VERSION;
+	header.vkFormat = format->vkFormat;
+	header.width = width;
+	header.height = height;
+	header.mipLevels = mipLevels;
+	FILE * file = fopen( argv[ 2 ], "wb" );
+	if ( file == NULL ) {
+		fprintf( stderr, "Couldn't open %s for writing\n", argv[ 2 ] );
+		return 1;
+	}
+	const uint8_t padding[ TEXTURE_FILE_DATA_ALIGNMENT ] = {};
+	fwrite( &header, sizeof( header ), 1, file );
+	fwrite( levels.data(), sizeof( textureFileLevel_t ), levels.size(), file );
+	fwrite( padding, 1, ( size_t )( dataOffset - sizeof( header ) - levels.size() * sizeof( textureFileLevel_t ) ), file );
+	fwrite( data.data(), 1, data.size(), file );
+	fclose( file );
+	printf( "%s: %ux%u, %u levels, %s, %u bytes (%u uncompressed)\n", argv[ 2 ], width, height, mipLevels, format->name, ( uint32_t )data.size(), chainSize );
+	return 0;
+}
\ No newline at end of file
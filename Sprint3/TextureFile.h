@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Baked textures are written by the TextureBaker tool, with every mip level already encoded in its final format, so loading one is
+// a matter of mapping the file and copying straight out of it into staging memory.  The layout follows KTX2: a header, then a level
+// index with the location of each mip level in the file, then the level data.  Unlike KTX2 the levels are stored largest first and
+// tightly packed, which is the order the stager consumes them in, so a whole chain is a single contiguous range.
+const uint32_t TEXTURE_FILE_MAGIC = 0x58455442;	// "BTEX"
+const uint32_t TEXTURE_FILE_VERSION = 2;
+const uint32_t TEXTURE_FILE_DATA_ALIGNMENT = 16;	// Level data starts on this boundary, so a mapped file can be copied with wide loads
+
+struct textureFileHeader_t {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	vkFormat;	// Like KTX2, the format is stored as a VkFormat value
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	mipLevels;	// The number of entries in the level index that follows
+};
+
+struct textureFileLevel_t {
+	uint64_t	offset;		// From the start of the file
+	uint64_t	size;
+};
+
+inline uint64_t GetTextureFileDataOffset( uint32_t mipLevels ) {
+	const uint64_t indexEnd = sizeof( textureFileHeader_t ) + mipLevels * sizeof( textureFileLevel_t );
+	return ( indexEnd + TEXTURE_FILE_DATA_ALIGNMENT - 1 ) / TEXTURE_FILE_DATA_ALIGNMENT * TEXTURE_FILE_DATA_ALIGNMENT;
+}
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "TextureProcessing.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+uint32_t GetMipLevelCount( uint32_t width, uint32_t height ) {
+	// Every level halves the larger side, rounding down, until it's 1.
+	uint32_t result = 1;
+	for ( uint32_t extent = std::max( width, height ); extent > 1; extent >>= 1 ) {
+		++result;
+	}
+	return result;
+}
+
+uint8_t * BuildMipChain( const uint8_t * base, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, uint32_t & chainSize ) {
+	chainSize = 0;
+	for ( uint32_t level = 0; level < mipLevels; ++level ) {
+		chainSize += GetMipExtent( width, level ) * GetMipExtent( height, level ) * texelSize;
+	}
+	uint8_t * chain = ( uint8_t * )malloc( chainSize );
+	memcpy( chain, base, width * height * texelSize );
+
+	const uint8_t * src = chain;
+	uint8_t * dst = chain + width * height * texelSize;
+	for ( uint32_t level = 1; level < mipLevels; ++level ) {
+		const uint32_t srcWidth = GetMipExtent( width, level - 1 );
+		const uint32_t srcHeight = GetMipExtent( height, level - 1 );
+		const uint32_t dstWidth = GetMipExtent( width, level );
+		const uint32_t dstHeight = GetMipExtent( height, level );
+		for ( uint32_t y = 0; y < dstHeight; ++y ) {
+			// A side that's already 1 can't be halved, so the same source row or column is used twice.
+			const uint32_t y0 = std::min( y * 2, srcHeight - 1 );
+			const uint32_t y1 = std::min( y * 2 + 1, srcHeight - 1 );
+			for ( uint32_t x = 0; x < dstWidth; ++x ) {
+				const uint32_t x0 = std::min( x * 2, srcWidth - 1 );
+				const uint32_t x1 = std::min( x * 2 + 1, srcWidth - 1 );
+				for ( uint32_t c = 0; c < texelSize; ++c ) {
+					const uint32_t sum = src[ ( y0 * srcWidth + x0 ) * texelSize + c ] + src[ ( y0 * srcWidth + x1 ) * texelSize + c ] +
+						src[ ( y1 * srcWidth + x0 ) * texelSize + c ] + src[ ( y1 * srcWidth + x1 ) * texelSize + c ];
+					dst[ ( y * dstWidth + x ) * texelSize + c ] = ( uint8_t )( ( sum + 2 ) / 4 );
+				}
+			}
+		}
+		src = dst;
+		dst += dstWidth * dstHeight * texelSize;
+	}
+	return chain;
+}
+
+static const uint32_t BLOCK_TEXEL_COUNT = COMPRESSION_BLOCK_EXTENT * COMPRESSION_BLOCK_EXTENT;
+
+// Pick two endpoints for the first channelCount channels of the block.  The texels are projected onto the direction in which they
+// vary the most, found by power iteration on their covariance, and the extremes of the projection become the endpoints.  This is
+// a lot better than the corners of the bounding box whenever the colors of a block run diagonally, which they usually do.
+static void FindEndpoints( const uint8_t texels[ BLOCK_TEXEL_COUNT ][ 4 ], uint32_t channelCount, float endpoint0[ 4 ], float endpoint1[ 4 ] ) {
+	float mean[ 4 ] = {};
+	for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+		for ( uint32_t c = 0; c < channelCount; ++c ) {
+			mean[ c ] += texels[ i ][ c ] / ( float )BLOCK_TEXEL_COUNT;
+		}
+	}
+	float covariance[ 4 ][ 4 ] = {};
+	for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+		for ( uint32_t a = 0; a < channelCount; ++a ) {
+			for ( uint32_t b = 0; b < channelCount; ++b ) {
+				covariance[ a ][ b ] += ( texels[ i ][ a ] - mean[ a ] ) * ( texels[ i ][ b ] - mean[ b ] );
+			}
+		}
+	}
+	float axis[ 4 ] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for ( uint32_t iteration = 0; iteration < 8; ++iteration ) {
+		float next[ 4 ] = {};
+		float length = 0.0f;
+		for ( uint32_t a = 0; a < channelCount; ++a ) {
+			for ( uint32_t b = 0; b < channelCount; ++b ) {
+				next[ a ] += covariance[ a ][ b ] * axis[ b ];
+			}
+			length += next[ a ] * next[ a ];
+		}
+		if ( length < 1e-6f ) {
+			break;	// Every texel is the same, so any direction will do
+		}
+		length = sqrtf( length );
+		for ( uint32_t c = 0; c < channelCount; ++c ) {
+			axis[ c ] = next[ c ] / length;
+		}
+	}
+	float minProjection = 0.0f;
+	float maxProjection = 0.0f;
+	for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+		float projection = 0.0f;
+		for ( uint32_t c = 0; c < channelCount; ++c ) {
+			projection += ( texels[ i ][ c ] - mean[ c ] ) * axis[ c ];
+		}
+		minProjection = std::min( minProjection, projection );
+		maxProjection = std::max( maxProjection, projection );
+	}
+	for ( uint32_t c = 0; c < channelCount; ++c ) {
+		endpoint0[ c ] = std::min( std::max( mean[ c ] + axis[ c ] * maxProjection, 0.0f ), 255.0f );
+		endpoint1[ c ] = std::min( std::max( mean[ c ] + axis[ c ] * minProjection, 0.0f ), 255.0f );
+	}
+}
+
+// Index of the palette entry closest to the texel, over the first channelCount channels.
+static uint32_t FindClosest( const uint8_t texel[ 4 ], const uint32_t palette[][ 4 ], uint32_t paletteSize, uint32_t channelCount ) {
+	uint32_t best = 0;
+	uint32_t bestError = ~0U;
+	for ( uint32_t p = 0; p < paletteSize; ++p ) {
+		uint32_t error = 0;
+		for ( uint32_t c = 0; c < channelCount; ++c ) {
+			const int32_t difference = ( int32_t )texel[ c ] - ( int32_t )palette[ p ][ c ];
+			error += ( uint32_t )( difference * difference );
+		}
+		if ( error < bestError ) {
+			best = p;
+			bestError = error;
+		}
+	}
+	return best;
+}
+
+static uint16_t PackRGB565( const float color[ 4 ] ) {
+	const uint32_t r = ( uint32_t )( color[ 0 ] * 31.0f / 255.0f + 0.5f );
+	const uint32_t g = ( uint32_t )( color[ 1 ] * 63.0f / 255.0f + 0.5f );
+	const uint32_t b = ( uint32_t )( color[ 2 ] * 31.0f / 255.0f + 0.5f );
+	return ( uint16_t )( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+static void UnpackRGB565( uint16_t packed, uint32_t color[ 4 ] ) {
+	const uint32_t r = ( packed >> 11 ) & 31;
+	const uint32_t g = ( packed >> 5 ) & 63;
+	const uint32_t b = packed & 31;
+	color[ 0 ] = ( r << 3 ) | ( r >> 2 );
+	color[ 1 ] = ( g << 2 ) | ( g >> 4 );
+	color[ 2 ] = ( b << 3 ) | ( b >> 2 );
+	color[ 3 ] = 255;
+}
+
+// Two 565 endpoints and a 2-bit index per texel.  Putting the larger endpoint first selects the four color mode, which is the
+// only mode BC3 supports for its color half.
+static void CompressBC1Block( const uint8_t texels[ BLOCK_TEXEL_COUNT ][ 4 ], uint8_t * block ) {
+	float endpoint0[ 4 ];
+	float endpoint1[ 4 ];
+	FindEndpoints( texels, 3, endpoint0, endpoint1 );
+	uint16_t color0 = PackRGB565( endpoint0 );
+	uint16_t color1 = PackRGB565( endpoint1 );
+	if ( color0 < color1 ) {
+		std::swap( color0, color1 );
+	}
+
+	uint32_t indices = 0;
+	if ( color0 != color1 ) {
+		uint32_t palette[ 4 ][ 4 ];
+		UnpackRGB565( color0, palette[ 0 ] );
+		UnpackRGB565( color1, palette[ 1 ] );
+		for ( uint32_t c = 0; c < 3; ++c ) {
+			palette[ 2 ][ c ] = ( 2 * palette[ 0 ][ c ] + palette[ 1 ][ c ] ) / 3;
+			palette[ 3 ][ c ] = ( palette[ 0 ][ c ] + 2 * palette[ 1 ][ c ] ) / 3;
+		}
+		for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+			indices |= FindClosest( texels[ i ], palette, 4, 3 ) << ( i * 2 );
+		}
+	}
+	block[ 0 ] = ( uint8_t )color0;
+	block[ 1 ] = ( uint8_t )( color0 >> 8 );
+	block[ 2 ] = ( uint8_t )color1;
+	block[ 3 ] = ( uint8_t )( color1 >> 8 );
+	for ( uint32_t i = 0; i < 4; ++i ) {
+		block[ 4 + i ] = ( uint8_t )( indices >> ( i * 8 ) );
+	}
+}
+
+// Two 8-bit endpoints and a 3-bit index per texel for a single channel.  The larger endpoint goes first, which selects the mode
+// with six interpolated values between them.
+static void CompressBC4Block( const uint8_t texels[ BLOCK_TEXEL_COUNT ][ 4 ], uint32_t channel, uint8_t * block ) {
+	uint32_t value0 = 0;
+	uint32_t value1 = 255;
+	for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+		value0 = std::max( value0, ( uint32_t )texels[ i ][ channel ] );
+		value1 = std::min( value1, ( uint32_t )texels[ i ][ channel ] );
+	}
+
+	uint64_t indices = 0;
+	if ( value0 != value1 ) {
+		// Index 0 and 1 are the endpoints themselves, and 2 to 7 step from the first toward the second.
+		uint32_t palette[ 8 ][ 4 ];
+		palette[ 0 ][ 0 ] = value0;
+		palette[ 1 ][ 0 ] = value1;
+		for ( uint32_t p = 2; p < 8; ++p ) {
+			palette[ p ][ 0 ] = ( ( 8 - p ) * value0 + ( p - 1 ) * value1 ) / 7;
+		}
+		for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+			const uint8_t texel[ 4 ] = { texels[ i ][ channel ] };
+			indices |= ( uint64_t )FindClosest( texel, palette, 8, 1 ) << ( i * 3 );
+		}
+	}
+	block[ 0 ] = ( uint8_t )value0;
+	block[ 1 ] = ( uint8_t )value1;
+	for ( uint32_t i = 0; i < 6; ++i ) {
+		block[ 2 + i ] = ( uint8_t )( indices >> ( i * 8 ) );
+	}
+}
+
+// Appends values to a block from the least significant bit up, which is how BC7 fields are laid out.
+struct bitWriter_t {
+	uint8_t *	block;
+	uint32_t	position;
+
+	void Write( uint32_t value, uint32_t bitCount ) {
+		for ( uint32_t i = 0; i < bitCount; ++i, ++position ) {
+			if ( ( ( value >> i ) & 1 ) != 0 ) {
+				block[ position / 8 ] |= ( uint8_t )( 1 << ( position % 8 ) );
+			}
+		}
+	}
+};
+
+// Quantize an endpoint to BC7 mode 6 precision: seven bits per channel plus a low bit shared by all four channels.  Both values
+// of the shared bit are tried.
+static void QuantizeBC7Endpoint( const float endpoint[ 4 ], uint32_t quantized[ 4 ], uint32_t & pBit ) {
+	float bestError = 1e30f;
+	for ( uint32_t p = 0; p < 2; ++p ) {
+		uint32_t candidate[ 4 ];
+		float error = 0.0f;
+		for ( uint32_t c = 0; c < 4; ++c ) {
+			const float value = ( endpoint[ c ] - p ) / 2.0f + 0.5f;
+			candidate[ c ] = value < 0.0f ? 0 : std::min( ( uint32_t )value, 127U );
+			const float difference = ( float )( ( candidate[ c ] << 1 ) | p ) - endpoint[ c ];
+			error += difference * difference;
+		}
+		if ( error < bestError ) {
+			bestError = error;
+			pBit = p;
+			memcpy( quantized, candidate, sizeof( candidate ) );
+		}
+	}
+}
+
+// BC7 has eight modes that trade partitions against endpoint and index precision.  Only mode 6 is used: one subset, RGBA endpoints
+// of 7 bits plus a p-bit, and 4-bit indices.  It's the mode that suits smooth content best and keeps the encoder small, at the
+// cost of blocks that hold two unrelated colors, which the partitioned modes would handle better.
+static void CompressBC7Block( const uint8_t texels[ BLOCK_TEXEL_COUNT ][ 4 ], uint8_t * block ) {
+	static const uint32_t weights[ 16 ] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	float endpoint0[ 4 ];
+	float endpoint1[ 4 ];
+	FindEndpoints( texels, 4, endpoint0, endpoint1 );
+	uint32_t quantized[ 2 ][ 4 ];
+	uint32_t pBits[ 2 ];
+	QuantizeBC7Endpoint( endpoint0, quantized[ 0 ], pBits[ 0 ] );
+	QuantizeBC7Endpoint( endpoint1, quantized[ 1 ], pBits[ 1 ] );
+
+	uint32_t palette[ 16 ][ 4 ];
+	for ( uint32_t c = 0; c < 4; ++c ) {
+		const uint32_t value0 = ( quantized[ 0 ][ c ] << 1 ) | pBits[ 0 ];
+		const uint32_t value1 = ( quantized[ 1 ][ c ] << 1 ) | pBits[ 1 ];
+		for ( uint32_t p = 0; p < 16; ++p ) {
+			palette[ p ][ c ] = ( ( 64 - weights[ p ] ) * value0 + weights[ p ] * value1 + 32 ) >> 6;
+		}
+	}
+	uint32_t indices[ BLOCK_TEXEL_COUNT ];
+	for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+		indices[ i ] = FindClosest( texels[ i ], palette, 16, 4 );
+	}
+	// The first index is stored without its top bit, so it has to be below 8.  Swapping the endpoints mirrors the palette.
+	if ( indices[ 0 ] >= 8 ) {
+		for ( uint32_t c = 0; c < 4; ++c ) {
+			std::swap( quantized[ 0 ][ c ], quantized[ 1 ][ c ] );
+		}
+		std::swap( pBits[ 0 ], pBits[ 1 ] );
+		for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+			indices[ i ] = 15 - indices[ i ];
+		}
+	}
+
+	memset( block, 0, 16 );
+	bitWriter_t writer = { block, 0 };
+	writer.Write( 1 << 6, 7 );	// Mode 6 is six zeros and a one
+	for ( uint32_t c = 0; c < 4; ++c ) {
+		writer.Write( quantized[ 0 ][ c ], 7 );
+		writer.Write( quantized[ 1 ][ c ], 7 );
+	}
+	writer.Write( pBits[ 0 ], 1 );
+	writer.Write( pBits[ 1 ], 1 );
+	writer.Write( indices[ 0 ], 3 );
+	for ( uint32_t i = 1; i < BLOCK_TEXEL_COUNT; ++i ) {
+		writer.Write( indices[ i ], 4 );
+	}
+}
+
+uint32_t GetCompressedBlockSize( blockCompression_t compression ) {
+	switch ( compression ) {
+		case BLOCK_COMPRESSION_BC1:
+		case BLOCK_COMPRESSION_BC4: {
+			return 8;
+		}
+		case BLOCK_COMPRESSION_BC3:
+		case BLOCK_COMPRESSION_BC5:
+		case BLOCK_COMPRESSION_BC7: {
+			return 16;
+		}
+		case BLOCK_COMPRESSION_COUNT: {
+			break;
+		}
+	}
+	return 0;
+}
+
+uint32_t GetCompressedSize( blockCompression_t compression, uint32_t width, uint32_t height ) {
+	const uint32_t blocksWide = ( width + COMPRESSION_BLOCK_EXTENT - 1 ) / COMPRESSION_BLOCK_EXTENT;
+	const uint32_t blocksHigh = ( height + COMPRESSION_BLOCK_EXTENT - 1 ) / COMPRESSION_BLOCK_EXTENT;
+	return blocksWide * blocksHigh * GetCompressedBlockSize( compression );
+}
+
+void CompressImage( blockCompression_t compression, const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * output ) {
+	const uint32_t blockSize = GetCompressedBlockSize( compression );
+	for ( uint32_t blockY = 0; blockY < height; blockY += COMPRESSION_BLOCK_EXTENT ) {
+		for ( uint32_t blockX = 0; blockX < width; blockX += COMPRESSION_BLOCK_EXTENT ) {
+			uint8_t texels[ BLOCK_TEXEL_COUNT ][ 4 ];
+			for ( uint32_t i = 0; i < BLOCK_TEXEL_COUNT; ++i ) {
+				const uint32_t x = std::min( blockX + i % COMPRESSION_BLOCK_EXTENT, width - 1 );
+				const uint32_t y = std::min( blockY + i / COMPRESSION_BLOCK_EXTENT, height - 1 );
+				memcpy( texels[ i ], rgba + ( y * width + x ) * 4, 4 );
+			}
+			switch ( compression ) {
+				case BLOCK_COMPRESSION_BC1: {
+					CompressBC1Block( texels, output );
+					break;
+				}
+				case BLOCK_COMPRESSION_BC3: {
+					CompressBC4Block( texels, 3, output );	// Alpha comes first
+					CompressBC1Block( texels, output + 8 );
+					break;
+				}
+				case BLOCK_COMPRESSION_BC4: {
+					CompressBC4Block( texels, 0, output );
+					break;
+				}
+				case BLOCK_COMPRESSION_BC5: {
+					CompressBC4Block( texels, 0, output );
+					CompressBC4Block( texels, 1, output + 8 );
+					break;
+				}
+				case BLOCK_COMPRESSION_BC7: {
+					CompressBC7Block( texels, output );
+					break;
+				}
+				case BLOCK_COMPRESSION_COUNT: {
+					break;	// Uncompressed, so there's nothing to write
+				}
+			}
+			output += blockSize;
+		}
+	}
+}
\ No newline at end of file
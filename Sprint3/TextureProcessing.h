@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// CPU side texel work that doesn't touch Vulkan, shared by the renderer and the offline TextureBaker tool.
+
+uint32_t GetMipLevelCount( uint32_t width, uint32_t height );
+inline uint32_t GetMipExtent( uint32_t extent, uint32_t level ) {
+	const uint32_t result = extent >> level;
+	return result > 0 ? result : 1;
+}
+
+// Box filter every level from the one above it.  All levels go back to back into one malloc'ed allocation, which is how
+// StageImageData wants them.  Each byte of a texel is filtered on its own, which suits 8-bit formats.
+uint8_t * BuildMipChain( const uint8_t * base, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, uint32_t & chainSize );
+
+// Block compression works on 4x4 texel blocks.  Every encoder takes RGBA8 texels and ignores the channels its format doesn't have.
+enum blockCompression_t {
+	BLOCK_COMPRESSION_BC1,	// RGB, 8 bytes per block.  Alpha is dropped
+	BLOCK_COMPRESSION_BC3,	// RGBA, 16 bytes per block: BC1 color plus BC4 alpha
+	BLOCK_COMPRESSION_BC4,	// R, 8 bytes per block.  For masks and single channel data
+	BLOCK_COMPRESSION_BC5,	// RG, 16 bytes per block: two BC4 channels.  For normal maps
+	BLOCK_COMPRESSION_BC7,	// RGBA, 16 bytes per block.  Much better quality than BC1 and BC3 for the same or twice the size
+	BLOCK_COMPRESSION_COUNT
+};
+
+const uint32_t COMPRESSION_BLOCK_EXTENT = 4;
+
+uint32_t GetCompressedBlockSize( blockCompression_t compression );
+// The size of the compressed image.  Partial blocks at the right and bottom edges take a whole block.
+uint32_t GetCompressedSize( blockCompression_t compression, uint32_t width, uint32_t height );
+// Encode a whole RGBA8 image, one row of blocks after another, which is the layout vkCmdCopyBufferToImage expects.  Texels past
+// the edge of the image are filled in by repeating the last row and column.
+void CompressImage( blockCompression_t compression, const uint8_t * rgba, uint32_t width, uint32_t height, uint8_t * output );
\ No newline at end of file
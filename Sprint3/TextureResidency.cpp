@@ -0,0 +1,89 @@
+#include "TextureResidency.h"
+#include "Image.h"
+#include <vector>
+#include <algorithm>
+
+struct textureResidency_t {
+	std::vector< Image * >	images;
+	uint64_t				budget = 512 * 1024 * 1024;
+};
+
+static textureResidency_t textureResidency;
+
+void SetTextureBudget( uint64_t bytes ) {
+	textureResidency.budget = bytes;
+}
+
+uint64_t GetResidentTextureBytes() {
+	uint64_t result = 0;
+	for ( size_t i = 0; i < textureResidency.images.size(); ++i ) {
+		result += textureResidency.images[ i ]->GetResidentBytes();
+	}
+	return result;
+}
+
+void RegisterResidentImage( Image * image ) {
+	textureResidency.images.push_back( image );
+}
+
+void UnregisterResidentImage( Image * image ) {
+	std::vector< Image * > & images = textureResidency.images;
+	images.erase( std::remove( images.begin(), images.end(), image ), images.end() );
+}
+
+static bool IsInFlight( const Image * image ) {
+	return image->GetLastUsedFrame() + FRAMES_IN_FLIGHT > renderObjects.frameNumber;
+}
+
+static bool ByLastUse( const Image * left, const Image * right ) {
+	return left->GetLastUsedFrame() < right->GetLastUsedFrame();
+}
+
+// Evict least recently used images until at most limit bytes are resident, or nothing else can go.
+static uint64_t EvictDownTo( uint64_t limit ) {
+	uint64_t resident = GetResidentTextureBytes();
+	if ( resident <= limit ) {
+		return resident;
+	}
+	std::vector< Image * > candidates;
+	for ( size_t i = 0; i < textureResidency.images.size(); ++i ) {
+		Image * image = textureResidency.images[ i ];
+		if ( image->CanEvict() == true && IsInFlight( image ) == false ) {
+			candidates.push_back( image );
+		}
+	}
+	std::sort( candidates.begin(), candidates.end(), ByLastUse );
+	// A streamed image can lose several levels in a row, one at a time, before the next image is touched.
+	for ( size_t i = 0; i < candidates.size() && resident > limit; ) {
+		Image * image = candidates[ i ];
+		const uint64_t before = image->GetResidentBytes();
+		image->Evict();
+		resident -= before - image->GetResidentBytes();
+		if ( image->CanEvict() == false ) {
+			++i;
+		}
+	}
+	return resident;
+}
+
+bool ReserveTextureMemory( uint64_t bytes ) {
+	if ( textureResidency.budget == 0 ) {
+		return true;
+	}
+	if ( bytes > textureResidency.budget ) {
+		return false;
+	}
+	return EvictDownTo( textureResidency.budget - bytes ) + bytes <= textureResidency.budget;
+}
+
+void UpdateTextureResidency() {
+	for ( size_t i = 0; i < textureResidency.images.size(); ++i ) {
+		Image * image = textureResidency.images[ i ];
+		if ( image->WantsReload() == true && ReserveTextureMemory( image->GetEvictedBytes() ) == true ) {
+			image->Reload();
+		}
+	}
+	if ( textureResidency.budget != 0 ) {
+		EvictDownTo( textureResidency.budget );
+	}
+}
\ No newline at end of file
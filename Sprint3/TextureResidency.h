@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Renderer.h"
+
+class Image;
+
+// Keeps the textures loaded from files within a memory budget.  Every image remembers the last frame it was used in, and when the
+// total goes over the budget, the least recently used ones are evicted: streamed images lose their most detailed level, and other
+// images are released entirely.  An evicted image that's used again is reloaded, and samples as the placeholder in the meantime.
+// Images used by the frames in flight are never evicted, so a frame that needs more than the budget goes over it rather than thrashing.
+
+// Zero turns the budget off.
+void SetTextureBudget( uint64_t bytes );
+uint64_t GetResidentTextureBytes();
+// Called by images loaded from files on creation and destruction.
+void RegisterResidentImage( Image * image );
+void UnregisterResidentImage( Image * image );
+// Make room for an allocation of bytes, evicting what's needed.  Returns false if it still wouldn't fit within the budget.
+bool ReserveTextureMemory( uint64_t bytes );
+// Reload evicted images that have been used again, then evict down to the budget.  Call after BeginStagingFrame, since evicting a
+// level records a copy into the staging graphics command buffer.
+void UpdateTextureResidency();
\ No newline at end of file
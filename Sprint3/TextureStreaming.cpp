@@ -0,0 +1,133 @@
+#include "TextureStreaming.h"
+#include "Image.h"
+#include "Memory.h"
+#include "TextureResidency.h"
+#include <vector>
+#include <deque>
+#include <limits.h>
+
+// Shaders write the level they wanted relative to the most detailed resident level, since that's level 0 of the image they sample,
+// and negative values ask for more detail.  Slots are combined with atomicMin, so an untouched slot holds the largest int.
+static const int32_t STREAMING_NO_REQUEST = INT_MAX;
+
+// Frames recorded before an image was destroyed may still write its slot, so the slot isn't handed out again until they're done.
+struct freedStreamingId_t {
+	uint32_t	id;
+	uint64_t	reusableFrame;
+};
+
+struct textureStreaming_t {
+	VkBuffer					feedbackBuffer = VK_NULL_HANDLE;
+	allocation_t				feedbackMemory = {};
+	int32_t *					feedback = NULL;	// FRAMES_IN_FLIGHT regions of STREAMING_MAX_IMAGES slots
+	std::vector< Image * >		images;				// Indexed by streaming id.  Destroyed images leave a NULL
+	std::deque< freedStreamingId_t >	freeIds;		// In the order they were freed, so the oldest is reusable first
+	std::vector< uint32_t >		requestedLevels;	// From RequestStreamingLevel, by streaming id
+};
+
+static textureStreaming_t textureStreaming;
+
+static void ResetFeedback( uint32_t frameIndex ) {
+	int32_t * feedback = textureStreaming.feedback + frameIndex * STREAMING_MAX_IMAGES;
+	for ( uint32_t i = 0; i < STREAMING_MAX_IMAGES; ++i ) {
+		feedback[ i ] = STREAMING_NO_REQUEST;
+	}
+}
+
+void InitializeTextureStreaming() {
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferCreateInfo.size = FRAMES_IN_FLIGHT * STREAMING_MAX_IMAGES * sizeof( int32_t );
+	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &textureStreaming.feedbackBuffer ) );
+
+	// Read back by the CPU every frame, so it lives in host memory like the staging buffer.
+	VkMemoryRequirements memReq;
+	vkGetBufferMemoryRequirements( renderObjects.device, textureStreaming.feedbackBuffer, &memReq );
+	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE, MEMORY_CATEGORY_STAGING, textureStreaming.feedbackMemory );
+	VK_CHECK( vkBindBufferMemory( renderObjects.device, textureStreaming.feedbackBuffer, textureStreaming.feedbackMemory.memory, textureStreaming.feedbackMemory.offset ) );
+	textureStreaming.feedback = ( int32_t * )textureStreaming.feedbackMemory.mappedData;
+	for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+		ResetFeedback( i );
+	}
+}
+
+uint32_t RegisterStreamedImage( Image * image ) {
+	uint32_t id;
+	if ( textureStreaming.freeIds.empty() == false && textureStreaming.freeIds.front().reusableFrame <= renderObjects.frameNumber ) {
+		id = textureStreaming.freeIds.front().id;
+		textureStreaming.freeIds.pop_front();
+		textureStreaming.images[ id ] = image;
+		// Nothing writes the slot anymore, but the old owner's last requests may not have been read back yet.
+		for ( uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i ) {
+			textureStreaming.feedback[ i * STREAMING_MAX_IMAGES + id ] = STREAMING_NO_REQUEST;
+		}
+	} else {
+		id = ( uint32_t )textureStreaming.images.size();
+		assert( id < STREAMING_MAX_IMAGES );
+		textureStreaming.images.push_back( image );
+		textureStreaming.requestedLevels.push_back( UINT_MAX );
+	}
+	textureStreaming.requestedLevels[ id ] = UINT_MAX;
+	return id;
+}
+
+void UnregisterStreamedImage( Image * image ) {
+	const uint32_t id = image->GetStreamingId();
+	textureStreaming.images[ id ] = NULL;
+	freedStreamingId_t freed;
+	freed.id = id;
+	freed.reusableFrame = renderObjects.frameNumber + FRAMES_IN_FLIGHT;	// This frame may write it too
+	textureStreaming.freeIds.push_back( freed );
+}
+
+VkBuffer GetStreamingFeedbackBuffer() {
+	return textureStreaming.feedbackBuffer;
+}
+
+uint32_t GetStreamingFeedbackIndex( const Image * image ) {
+	return renderObjects.frameIndex * STREAMING_MAX_IMAGES + image->GetStreamingId();
+}
+
+void RequestStreamingLevel( Image * image, uint32_t level ) {
+	uint32_t & requested = textureStreaming.requestedLevels[ image->GetStreamingId() ];
+	if ( level < requested ) {
+		requested = level;
+	}
+}
+
+void UpdateTextureStreaming() {
+	// This frame slot's fence has signaled, so the feedback of the last frame to use it is complete.  It's reset before this frame writes it.
+	int32_t * feedback = textureStreaming.feedback + renderObjects.frameIndex * STREAMING_MAX_IMAGES;
+	uint32_t started = 0;
+	for ( size_t id = 0; id < textureStreaming.images.size(); ++id ) {
+		Image * image = textureStreaming.images[ id ];
+		uint32_t & requested = textureStreaming.requestedLevels[ id ];
+		if ( image != NULL && feedback[ id ] != STREAMING_NO_REQUEST ) {
+			// Relative to the level that was resident when the frame was recorded, which may have moved since.  The error only lasts
+			// a few frames, and at worst starts one extra stream-in.
+			const int32_t wanted = ( int32_t )image->GetResidentLevel() + feedback[ id ];
+			const uint32_t level = wanted > 0 ? ( uint32_t )wanted : 0;
+			if ( level < requested ) {
+				requested = level;
+			}
+		}
+		feedback[ id ] = STREAMING_NO_REQUEST;
+		// Requests that can't start this frame come back with the next frame's feedback.
+		if ( image != NULL && requested < image->GetResidentLevel() && started < STREAMING_LEVELS_PER_FRAME && image->IsStreamingIn() == false ) {
+			// Over budget, the level waits until something else can be evicted.
+			if ( ReserveTextureMemory( image->GetStreamInBytes() ) == true && image->StreamInLevel() == true ) {
+				++started;
+			}
+		}
+		requested = UINT_MAX;
+	}
+}
+
+void EndTextureStreamingFrame( VkCommandBuffer commandBuffer ) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL );
+}
\ No newline at end of file
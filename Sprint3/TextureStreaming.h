@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Renderer.h"
+
+class Image;
+
+// Streamed images (Image::CreateStreamed) start out with only their smallest levels, and get more detailed ones as the fragment shaders
+// ask for them.  Each streamed image has a slot in a feedback buffer, where shaders write the most detailed level they wanted to
+// sample with RecordStreamingFeedback from global.glslh.  Once a frame's fence has signaled, its slots are read back, and every image
+// that wanted more detail than it has streams in the next level, one level at a time.  Without renderObjects.fragmentStoresSupported
+// shaders can't record feedback, and levels only stream in when asked for with RequestStreamingLevel.
+const uint32_t STREAMING_MAX_IMAGES = 4096;
+const uint32_t STREAMING_RESIDENT_EXTENT = 64;		// Levels this size and smaller are loaded with the image and never streamed
+const uint32_t STREAMING_LEVELS_PER_FRAME = 8;		// How many stream-ins may start each frame, to spread the uploads out
+
+// Create the feedback buffer.  Call after the staging buffer is up.
+void InitializeTextureStreaming();
+// Called by streamed images on creation and destruction.  Returns the image's slot in the feedback buffer.
+uint32_t RegisterStreamedImage( Image * image );
+void UnregisterStreamedImage( Image * image );
+// The buffer to bind at FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_0.  It has a region per frame in flight, so it can stay bound.
+VkBuffer GetStreamingFeedbackBuffer();
+// The index a shader passes to RecordStreamingFeedback for the image this frame.  It changes every frame, so it belongs with the
+// per-draw constants.
+uint32_t GetStreamingFeedbackIndex( const Image * image );
+// Ask for a level from the CPU, for the next update only, as if a shader had.  Useful for textures about to come into view.
+void RequestStreamingLevel( Image * image, uint32_t level );
+// Read back the feedback of the frame that last used this slot and start stream-ins.  Call after BeginStagingFrame.
+void UpdateTextureStreaming();
+// Make this frame's feedback writes visible to the CPU.  Recorded at the end of the frame's rendering.
+void EndTextureStreamingFrame( VkCommandBuffer commandBuffer );
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "TransientAllocator.h"
+#include <string.h>
+
+// Per-frame data goes through one big persistently mapped ring, instead of a Buffer per piece of data.  Allocation is just
+// bumping the head.  Each frame remembers where the head was when it ended, and once that frame's fence signals, the tail
+// catches up to that point.  Frames retire in order, so the tail only ever moves forward.
+struct transientRing_t {
+	VkBuffer		buffer = VK_NULL_HANDLE;
+	allocation_t	memory = {};
+	uint32_t		size = 0;
+	uint32_t		head = 0;
+	uint32_t		inFlightBytes = 0;	// Everything between tail and head, including padding, so a full ring isn't mistaken for an empty one
+	uint32_t		frameBytes[ FRAMES_IN_FLIGHT ] = {};
+};
+
+static transientRing_t transientRing;
+
+void InitializeTransientAllocator() {
+	const uint32_t ringSize = 16 * 1024 * 1024;	// Shared by all frames in flight, so a frame can use more than its even share
+
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	bufferCreateInfo.size = ringSize;
+	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &transientRing.buffer ) );
+
+	VkMemoryRequirements memReq;
+	vkGetBufferMemoryRequirements( renderObjects.device, transientRing.buffer, &memReq );
+	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE | MEMORY_DEDICATED, MEMORY_CATEGORY_UNIFORM, transientRing.memory );	// Mostly per-draw constants
+	VK_CHECK( vkBindBufferMemory( renderObjects.device, transientRing.buffer, transientRing.memory.memory, transientRing.memory.offset ) );
+	transientRing.size = ringSize;
+}
+
+void BeginTransientFrame() {
+	uint32_t & retiredBytes = transientRing.frameBytes[ renderObjects.frameIndex ];
+	transientRing.inFlightBytes -= retiredBytes;
+	retiredBytes = 0;
+}
+
+transientAllocation_t AllocateTransient( uint32_t size, bufferUsageFlags_t usage, const void * data ) {
+	uint32_t alignment = 4;	// Enough for vertex and 32-bit index data
+	if ( ( usage & BUFFER_USAGE_UNIFORM_BUFFER ) != 0 ) {
+		alignment = ( uint32_t )renderObjects.physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+	}
+
+	uint32_t offset = transientRing.head;
+	if ( ( offset % alignment ) != 0 ) {
+		offset += alignment - offset % alignment;
+	}
+	if ( offset + size > transientRing.size ) {
+		offset = 0;	// Slices never straddle the end of the ring, so the remainder is wasted until this frame retires
+	}
+	const uint32_t consumed = offset >= transientRing.head ? ( offset - transientRing.head ) + size : ( transientRing.size - transientRing.head ) + size;
+	transientAllocation_t result = {};
+	if ( size > transientRing.size || transientRing.inFlightBytes + consumed > transientRing.size ) {
+		// The frames in flight asked for more than the ring holds, and the rest of it is still being read.  Grow ringSize rather than
+		// stalling here.
+		extern void PrintDebugMessage( const char * message );
+		PrintDebugMessage( "Transient ring is full\n" );
+		return result;
+	}
+
+	transientRing.head = offset + size;
+	transientRing.inFlightBytes += consumed;
+	transientRing.frameBytes[ renderObjects.frameIndex ] += consumed;
+
+	result.buffer = transientRing.buffer;
+	result.offset = offset;
+	result.size = size;
+	result.data = ( uint8_t * )transientRing.memory.mappedData + offset;
+	if ( data != NULL ) {
+		memcpy( result.data, data, size );
+	}
+	return result;
+}
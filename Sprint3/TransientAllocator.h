@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Buffer.h"
+
+// A slice of the transient ring buffer.  It's only valid for the frame in which it was allocated; the memory is recycled
+// once the GPU has finished that frame, so anything written here has to be written again every frame.
+struct transientAllocation_t {
+	VkBuffer	buffer;
+	uint32_t	offset;
+	uint32_t	size;
+	void *		data;	// Persistently mapped, write-only from the CPU's perspective
+};
+
+// Create the ring buffer that backs all transient allocations.
+void InitializeTransientAllocator();
+// Recycle everything allocated the last time this frame slot was used.  Only valid once that frame's fence has signaled.
+void BeginTransientFrame();
+// Get a slice of the ring aligned for the given usage, e.g. per-draw constants or dynamic geometry.  Optionally copies data into it.
+// If the ring is full, the buffer is VK_NULL_HANDLE and data is NULL, and the caller has to make do without it.
+transientAllocation_t AllocateTransient( uint32_t size, bufferUsageFlags_t usage, const void * data = NULL );
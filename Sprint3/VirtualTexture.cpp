@@ -0,0 +1,384 @@
+#include "VirtualTexture.h"
+#include "Memory.h"
+#include "TextureFile.h"
+#include "TextureProcessing.h"
+#include <algorithm>
+#include <functional>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+static const uint32_t NO_SLOT = UINT_MAX;
+
+struct virtualTexturing_t {
+	VkBuffer						feedbackBuffer = VK_NULL_HANDLE;
+	allocation_t					feedbackMemory = {};
+	uint32_t *						feedback = NULL;	// FRAMES_IN_FLIGHT regions of VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES flags
+	std::vector< VirtualTexture * >	textures;
+};
+
+static virtualTexturing_t virtualTexturing;
+
+void InitializeVirtualTexturing() {
+	VkBufferCreateInfo bufferCreateInfo = {};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferCreateInfo.size = FRAMES_IN_FLIGHT * VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES * sizeof( uint32_t );
+	VK_CHECK( vkCreateBuffer( renderObjects.device, &bufferCreateInfo, NULL, &virtualTexturing.feedbackBuffer ) );
+
+	// Read back by the CPU every frame, like the streaming feedback.
+	VkMemoryRequirements memReq;
+	vkGetBufferMemoryRequirements( renderObjects.device, virtualTexturing.feedbackBuffer, &memReq );
+	AllocateDeviceMemory( memReq, MEMORY_MAPPABLE, MEMORY_CATEGORY_STAGING, virtualTexturing.feedbackMemory );
+	VK_CHECK( vkBindBufferMemory( renderObjects.device, virtualTexturing.feedbackBuffer, virtualTexturing.feedbackMemory.memory, virtualTexturing.feedbackMemory.offset ) );
+	virtualTexturing.feedback = ( uint32_t * )virtualTexturing.feedbackMemory.mappedData;
+	memset( virtualTexturing.feedback, 0, ( size_t )bufferCreateInfo.size );
+}
+
+VkBuffer GetVirtualTextureFeedbackBuffer() {
+	return virtualTexturing.feedbackBuffer;
+}
+
+void UpdateVirtualTexturing() {
+	// This frame slot's fence has signaled, so the feedback of the last frame to use it is complete.  Each texture clears its flags
+	// as it reads them, before this frame writes them.
+	uint32_t * feedback = virtualTexturing.feedback + renderObjects.frameIndex * VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES;
+	uint32_t pageBudget = VIRTUAL_TEXTURE_PAGES_PER_FRAME;
+	for ( size_t i = 0; i < virtualTexturing.textures.size(); ++i ) {
+		virtualTexturing.textures[ i ]->Update( feedback, pageBudget );
+	}
+}
+
+uint32_t VirtualTexture::AllocateFeedbackRange( uint32_t pageCount ) {
+	// First fit, in the gaps between the ranges of the textures that exist.  Frames in flight may still flag pages in the range of a
+	// destroyed texture, which at worst uploads a few pages the next owner didn't need.
+	uint32_t base = 0;
+	bool moved = true;
+	while ( moved == true ) {
+		moved = false;
+		for ( size_t i = 0; i < virtualTexturing.textures.size(); ++i ) {
+			const VirtualTexture * texture = virtualTexturing.textures[ i ];
+			if ( base < texture->m_feedbackBase + texture->m_pageCount && texture->m_feedbackBase < base + pageCount ) {
+				base = texture->m_feedbackBase + texture->m_pageCount;
+				moved = true;
+			}
+		}
+	}
+	assert( base + pageCount <= VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES );
+	return base;
+}
+
+VirtualTexture * VirtualTexture::Create( const char * filename ) {
+	extern const void * MapFile( const char * filename, uint64_t & size );
+	extern void UnmapFile( const void * data );
+	uint64_t fileSize;
+	const uint8_t * file = ( const uint8_t * )MapFile( filename, fileSize );
+	// A power of two number of pages on each side means the page grid of every level is exactly half the one above, like the indirection
+	// texture's mip levels.
+	decodedImage_t decoded;
+	const char * failure = NULL;
+	if ( file == NULL ) {
+		failure = "the file couldn't be opened";
+	} else if ( renderObjects.fragmentStoresSupported == false ) {
+		failure = "the device can't write feedback from fragment shaders, so no pages would ever be asked for";
+	} else if ( DecodeBakedImageFile( file, fileSize, decoded, &failure ) == true ) {
+		const uint32_t pagesWide = decoded.width / VIRTUAL_TEXTURE_PAGE_EXTENT;
+		const uint32_t pagesHigh = decoded.height / VIRTUAL_TEXTURE_PAGE_EXTENT;
+		if ( decoded.levelCount != GetMipLevelCount( decoded.width, decoded.height ) ) {
+			failure = "it was baked without the full mip chain";
+		} else if ( SupportsSampling( decoded.format ) == false ) {
+			failure = "the device can't sample its format";
+		} else if ( pagesWide == 0 || pagesWide * VIRTUAL_TEXTURE_PAGE_EXTENT != decoded.width || ( pagesWide & ( pagesWide - 1 ) ) != 0 ||
+				pagesHigh == 0 || pagesHigh * VIRTUAL_TEXTURE_PAGE_EXTENT != decoded.height || ( pagesHigh & ( pagesHigh - 1 ) ) != 0 ) {
+			failure = "its sides aren't VIRTUAL_TEXTURE_PAGE_EXTENT texels times a power of two";
+		}
+	}
+	if ( failure != NULL ) {
+		if ( file != NULL ) {
+			UnmapFile( file );
+		}
+		extern void PrintDebugMessage( const char * message );
+		char message[ 512 ];
+		snprintf( message, sizeof( message ), "Couldn't create virtual texture %s: %s\n", filename, failure );
+		PrintDebugMessage( message );
+		return NULL;
+	}
+
+	VirtualTexture * result = new VirtualTexture;
+	result->m_file = ( const textureFileHeader_t * )file;
+	result->m_format = decoded.format;
+	// Levels stop once the whole texture fits in one page, and the levels past that are left out.
+	result->m_pagesWide = decoded.width / VIRTUAL_TEXTURE_PAGE_EXTENT;
+	result->m_pagesHigh = decoded.height / VIRTUAL_TEXTURE_PAGE_EXTENT;
+	result->m_levelCount = GetMipLevelCount( result->m_pagesWide, result->m_pagesHigh );
+	for ( uint32_t level = 0; level < result->m_levelCount; ++level ) {
+		result->m_levelFirstPages.push_back( result->m_pageCount );
+		result->m_pageCount += GetMipExtent( result->m_pagesWide, level ) * GetMipExtent( result->m_pagesHigh, level );
+	}
+	result->m_levelFirstPages.push_back( result->m_pageCount );
+	uint32_t blockExtent;
+	uint32_t blockSize;
+	GetFormatBlockInfo( result->m_format, blockExtent, blockSize );
+	result->m_pageSize = ( VIRTUAL_TEXTURE_SLOT_EXTENT / blockExtent ) * ( VIRTUAL_TEXTURE_SLOT_EXTENT / blockExtent ) * blockSize;
+
+	const uint32_t slotCount = VIRTUAL_TEXTURE_CACHE_SLOTS * VIRTUAL_TEXTURE_CACHE_SLOTS;
+	result->m_pageSlots.resize( result->m_pageCount, NO_SLOT );
+	result->m_slotPages.resize( slotCount, NO_SLOT );
+	result->m_slotLastUsedFrames.resize( slotCount, 0 );
+	result->m_indirectionData.resize( result->m_pageCount * 4, 0 );
+	result->m_feedbackBase = AllocateFeedbackRange( result->m_pageCount );
+
+	// The page cache is only ever written a slot at a time, so its contents start out undefined.  The indirection texture starts out
+	// cleared, which the shader reads as nothing resident until the first pages land.
+	const uint32_t cacheExtent = VIRTUAL_TEXTURE_CACHE_SLOTS * VIRTUAL_TEXTURE_SLOT_EXTENT;
+	result->m_pageCache = Image::Create( cacheExtent, cacheExtent, result->m_format, IMAGE_USAGE_SHADER );
+	result->m_indirection = Image::Create( result->m_pagesWide, result->m_pagesHigh, IMAGE_FORMAT_RGBA8, IMAGE_USAGE_SHADER | IMAGE_USAGE_MIPMAPPED );
+	const VkCommandBuffer commandBuffer = stagingBuffer.graphicsCommandBuffer;
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = result->m_indirection->GetImage();
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+	barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+	const VkClearColorValue clearColor = {};
+	vkCmdClearColorImage( commandBuffer, result->m_indirection->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &barrier.subresourceRange );
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier );
+
+	virtualTexturing.textures.push_back( result );
+	return result;
+}
+
+void VirtualTexture::Destroy( VirtualTexture * texture ) {
+	extern void UnmapFile( const void * data );
+	std::vector< VirtualTexture * > & textures = virtualTexturing.textures;
+	textures.erase( std::remove( textures.begin(), textures.end(), texture ), textures.end() );
+	Image::Destroy( texture->m_pageCache );
+	Image::Destroy( texture->m_indirection );
+	UnmapFile( texture->m_file );	// Pages are written into staging memory as soon as they're cut out, so nothing reads it anymore
+	delete texture;
+}
+
+void VirtualTexture::GetShaderParameters( virtualTextureParameters_t & parameters ) const {
+	parameters = {};
+	parameters.pagesWide = m_pagesWide;
+	parameters.pagesHigh = m_pagesHigh;
+	parameters.levelCount = m_levelCount;
+	parameters.feedbackIndex = renderObjects.frameIndex * VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES + m_feedbackBase;
+	parameters.cacheExtent = ( float )m_pageCache->GetWidth();
+	parameters.inverseCacheExtent = 1.0f / parameters.cacheExtent;
+}
+
+void VirtualTexture::GetPageLocation( uint32_t page, uint32_t & level, uint32_t & x, uint32_t & y ) const {
+	level = 0;
+	while ( page >= m_levelFirstPages[ level + 1 ] ) {
+		++level;
+	}
+	const uint32_t levelPagesWide = GetMipExtent( m_pagesWide, level );
+	x = ( page - m_levelFirstPages[ level ] ) % levelPagesWide;
+	y = ( page - m_levelFirstPages[ level ] ) / levelPagesWide;
+}
+
+uint32_t VirtualTexture::GetParentPage( uint32_t page ) const {
+	uint32_t level;
+	uint32_t x;
+	uint32_t y;
+	GetPageLocation( page, level, x, y );
+	assert( level + 1 < m_levelCount );
+	return m_levelFirstPages[ level + 1 ] + ( y >> 1 ) * GetMipExtent( m_pagesWide, level + 1 ) + ( x >> 1 );
+}
+
+// Cut a page and its border out of its level in the mapped file, in blocks.  Blocks past the edge of the level repeat the edge block,
+// which for compressed formats is a few texels off from clamping, but only the half texel nearest the page edge is ever filtered in.
+// Levels smaller than a page fill its top left corner, and the rest of the page is clamped too.
+void VirtualTexture::WritePage( uint32_t page, uint8_t * destination ) const {
+	uint32_t level;
+	uint32_t pageX;
+	uint32_t pageY;
+	GetPageLocation( page, level, pageX, pageY );
+	uint32_t blockExtent;
+	uint32_t blockSize;
+	GetFormatBlockInfo( m_format, blockExtent, blockSize );
+	const textureFileLevel_t * levels = ( const textureFileLevel_t * )( m_file + 1 );
+	const uint8_t * source = ( const uint8_t * )m_file + levels[ level ].offset;
+	const int32_t levelBlocksWide = ( int32_t )( ( GetMipExtent( m_file->width, level ) + blockExtent - 1 ) / blockExtent );
+	const int32_t levelBlocksHigh = ( int32_t )( ( GetMipExtent( m_file->height, level ) + blockExtent - 1 ) / blockExtent );
+	const int32_t slotBlocks = ( int32_t )( VIRTUAL_TEXTURE_SLOT_EXTENT / blockExtent );
+	const int32_t borderBlocks = ( int32_t )( VIRTUAL_TEXTURE_PAGE_BORDER / blockExtent );
+	const int32_t pageBlocks = ( int32_t )( VIRTUAL_TEXTURE_PAGE_EXTENT / blockExtent );
+	const int32_t firstX = ( int32_t )pageX * pageBlocks - borderBlocks;
+	const int32_t firstY = ( int32_t )pageY * pageBlocks - borderBlocks;
+	// The part of each row that's inside the level is a straight copy, and only the blocks either side of it are repeated.
+	const int32_t insideBegin = std::min( std::max( firstX, 0 ), levelBlocksWide - 1 );
+	const int32_t insideEnd = std::max( std::min( firstX + slotBlocks, levelBlocksWide ), insideBegin + 1 );
+	const int32_t leftBlocks = std::max( insideBegin - firstX, 0 );
+	const int32_t insideBlocks = std::min( insideEnd - insideBegin, slotBlocks - leftBlocks );
+	const int32_t rightBlocks = slotBlocks - leftBlocks - insideBlocks;
+	for ( int32_t row = 0; row < slotBlocks; ++row ) {
+		const int32_t sourceY = std::min( std::max( firstY + row, 0 ), levelBlocksHigh - 1 );
+		const uint8_t * sourceRow = source + ( size_t )sourceY * levelBlocksWide * blockSize;
+		for ( int32_t i = 0; i < leftBlocks; ++i ) {
+			memcpy( destination, sourceRow + insideBegin * blockSize, blockSize );
+			destination += blockSize;
+		}
+		memcpy( destination, sourceRow + insideBegin * blockSize, insideBlocks * blockSize );
+		destination += insideBlocks * blockSize;
+		for ( int32_t i = 0; i < rightBlocks; ++i ) {
+			memcpy( destination, sourceRow + ( insideBegin + insideBlocks - 1 ) * blockSize, blockSize );
+			destination += blockSize;
+		}
+	}
+}
+
+// Every page points at its own slot if it's resident, or else at whatever its parent points at, so the coarsest levels go first.
+void VirtualTexture::BuildIndirection() {
+	for ( uint32_t level = m_levelCount; level-- > 0; ) {
+		for ( uint32_t page = m_levelFirstPages[ level ]; page < m_levelFirstPages[ level + 1 ]; ++page ) {
+			uint8_t * entry = &m_indirectionData[ page * 4 ];
+			const uint32_t slot = m_pageSlots[ page ];
+			if ( slot != NO_SLOT ) {
+				entry[ 0 ] = ( uint8_t )( slot % VIRTUAL_TEXTURE_CACHE_SLOTS );
+				entry[ 1 ] = ( uint8_t )( slot / VIRTUAL_TEXTURE_CACHE_SLOTS );
+				entry[ 2 ] = ( uint8_t )level;
+				entry[ 3 ] = 255;
+			} else if ( level + 1 < m_levelCount ) {
+				memcpy( entry, &m_indirectionData[ GetParentPage( page ) * 4 ], 4 );
+			} else {
+				memset( entry, 0, 4 );
+			}
+		}
+	}
+}
+
+void VirtualTexture::Update( uint32_t * feedback, uint32_t & pageBudget ) {
+	const uint64_t frameNumber = renderObjects.frameNumber;
+	feedback += m_feedbackBase;
+	// The single page of the coarsest level is what everything falls back to, so it's always wanted, and never evicted.
+	const uint32_t rootPage = m_pageCount - 1;
+	std::vector< uint32_t > missingPages;
+	if ( m_pageSlots[ rootPage ] == NO_SLOT ) {
+		missingPages.push_back( rootPage );
+	}
+	for ( uint32_t page = 0; page < m_pageCount; ++page ) {
+		if ( feedback[ page ] == 0 ) {
+			continue;
+		}
+		feedback[ page ] = 0;
+		// The shader sampled the nearest resident ancestor of the page it wanted, so that's the one in use.
+		uint32_t sampled = page;
+		while ( m_pageSlots[ sampled ] == NO_SLOT && sampled != rootPage ) {
+			sampled = GetParentPage( sampled );
+		}
+		if ( m_pageSlots[ sampled ] != NO_SLOT ) {
+			m_slotLastUsedFrames[ m_pageSlots[ sampled ] ] = frameNumber;
+		}
+		if ( sampled != page ) {
+			missingPages.push_back( page );
+		}
+	}
+	if ( missingPages.empty() == true || pageBudget == 0 ) {
+		return;
+	}
+
+	// Coarse pages first, since they cover the most and finer pages fall back to them.  They only go into slots nothing was sampled
+	// from in this feedback, least recently used first, so a page never pushes out another that's on screen.  Empty slots have never
+	// been used, so they come first.
+	std::sort( missingPages.begin(), missingPages.end(), std::greater< uint32_t >() );
+	std::vector< uint32_t > freeSlots;
+	for ( uint32_t slot = 0; slot < m_slotPages.size(); ++slot ) {
+		if ( m_slotLastUsedFrames[ slot ] < frameNumber && m_slotPages[ slot ] != rootPage ) {
+			freeSlots.push_back( slot );
+		}
+	}
+	std::stable_sort( freeSlots.begin(), freeSlots.end(), [ this ]( uint32_t left, uint32_t right ) {
+		return m_slotLastUsedFrames[ left ] < m_slotLastUsedFrames[ right ];
+	} );
+	const uint32_t uploadCount = ( uint32_t )std::min( std::min( missingPages.size(), freeSlots.size() ), ( size_t )pageBudget );
+	if ( uploadCount == 0 ) {
+		return;
+	}
+	// The pages and the whole indirection chain go in one piece of staging memory, so the indirection never points at a slot whose
+	// page didn't make it.  If the ring is full, the feedback asks again next frame.
+	const uint32_t indirectionSize = ( uint32_t )m_indirectionData.size();
+	uint32_t stagingOffset;
+	uint8_t * staging = AllocateStagingMemory( uploadCount * m_pageSize + indirectionSize, stagingOffset );
+	if ( staging == NULL ) {
+		return;
+	}
+	pageBudget -= uploadCount;
+
+	std::vector< VkBufferImageCopy > pageRegions( uploadCount );
+	for ( uint32_t i = 0; i < uploadCount; ++i ) {
+		const uint32_t page = missingPages[ i ];
+		const uint32_t slot = freeSlots[ i ];
+		if ( m_slotPages[ slot ] != NO_SLOT ) {
+			m_pageSlots[ m_slotPages[ slot ] ] = NO_SLOT;
+		} else {
+			++m_residentPageCount;
+		}
+		m_slotPages[ slot ] = page;
+		m_pageSlots[ page ] = slot;
+		m_slotLastUsedFrames[ slot ] = frameNumber;
+		WritePage( page, staging + i * m_pageSize );
+
+		VkBufferImageCopy & region = pageRegions[ i ];
+		region.bufferOffset = stagingOffset + i * m_pageSize;
+		region.imageOffset.x = ( int32_t )( ( slot % VIRTUAL_TEXTURE_CACHE_SLOTS ) * VIRTUAL_TEXTURE_SLOT_EXTENT );
+		region.imageOffset.y = ( int32_t )( ( slot / VIRTUAL_TEXTURE_CACHE_SLOTS ) * VIRTUAL_TEXTURE_SLOT_EXTENT );
+		region.imageExtent.width = VIRTUAL_TEXTURE_SLOT_EXTENT;
+		region.imageExtent.height = VIRTUAL_TEXTURE_SLOT_EXTENT;
+		region.imageExtent.depth = 1;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+	}
+	BuildIndirection();
+	memcpy( staging + uploadCount * m_pageSize, m_indirectionData.data(), indirectionSize );
+	std::vector< VkBufferImageCopy > indirectionRegions( m_levelCount );
+	for ( uint32_t level = 0; level < m_levelCount; ++level ) {
+		VkBufferImageCopy & region = indirectionRegions[ level ];
+		region.bufferOffset = stagingOffset + uploadCount * m_pageSize + m_levelFirstPages[ level ] * 4;
+		region.imageExtent.width = GetMipExtent( m_pagesWide, level );
+		region.imageExtent.height = GetMipExtent( m_pagesHigh, level );
+		region.imageExtent.depth = 1;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.layerCount = 1;
+	}
+
+	// Both images are sampled while they're updated, so the copies go on the graphics queue, and earlier frames that may still be
+	// sampling the slots being replaced were submitted to it first.  Waiting for their fragment shaders is all it takes.
+	const VkCommandBuffer commandBuffer = stagingBuffer.graphicsCommandBuffer;
+	VkImageMemoryBarrier barriers[ 2 ] = {};
+	for ( uint32_t i = 0; i < ARRAY_COUNT( barriers ); ++i ) {
+		barriers[ i ].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[ i ].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[ i ].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[ i ].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[ i ].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barriers[ i ].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[ i ].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barriers[ i ].subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		barriers[ i ].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	}
+	barriers[ 0 ].image = m_pageCache->GetImage();
+	barriers[ 1 ].image = m_indirection->GetImage();
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ), barriers );
+	vkCmdCopyBufferToImage( commandBuffer, stagingBuffer.buffer, m_pageCache->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uploadCount, pageRegions.data() );
+	vkCmdCopyBufferToImage( commandBuffer, stagingBuffer.buffer, m_indirection->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_levelCount, indirectionRegions.data() );
+	for ( uint32_t i = 0; i < ARRAY_COUNT( barriers ); ++i ) {
+		barriers[ i ].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[ i ].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers[ i ].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[ i ].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	vkCmdPipelineBarrier( commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, ARRAY_COUNT( barriers ), barriers );
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Image.h"
+#include <vector>
+
+struct textureFileHeader_t;
+
+// Virtual textures are for textures too large to keep resident, like unique terrain texels.  The texture is cut into pages of
+// VIRTUAL_TEXTURE_PAGE_EXTENT texels at every mip level, and only the pages the shaders have asked for are kept, in slots of a page
+// cache image.  An indirection texture, with a texel per page and a mip level per level, tells the shader which slot holds each page,
+// or the slot of its nearest resident ancestor, so there's always something to sample.  It's done entirely in the shader, so it works
+// without sparse binding.
+//
+// SampleVirtualTexture in global.glslh does the lookup, and writes the page it wanted into a feedback buffer.  Once a frame's fence has
+// signaled, the feedback is read back and the missing pages are cut out of the mapped file straight into staging memory, a few per frame,
+// pushing out the pages used least recently.  The feedback is made visible to the CPU by the barrier in EndTextureStreamingFrame.
+const uint32_t VIRTUAL_TEXTURE_PAGE_EXTENT = 128;
+const uint32_t VIRTUAL_TEXTURE_PAGE_BORDER = 4;		// Texels repeated from the neighbouring pages on each side, for filtering.  A whole block, for compressed formats
+const uint32_t VIRTUAL_TEXTURE_SLOT_EXTENT = VIRTUAL_TEXTURE_PAGE_EXTENT + 2 * VIRTUAL_TEXTURE_PAGE_BORDER;
+const uint32_t VIRTUAL_TEXTURE_CACHE_SLOTS = 16;		// Slots per side of a page cache
+const uint32_t VIRTUAL_TEXTURE_MAX_FEEDBACK_PAGES = 64 * 1024;	// Pages of every virtual texture together, per frame in flight
+const uint32_t VIRTUAL_TEXTURE_PAGES_PER_FRAME = 16;	// How many pages may be uploaded each frame, to spread the uploads out
+
+// Matches VirtualTexture in global.glslh, and goes in a uniform buffer with the draw's other constants.
+struct virtualTextureParameters_t {
+	uint32_t	pagesWide;
+	uint32_t	pagesHigh;
+	uint32_t	levelCount;
+	uint32_t	feedbackIndex;
+	float		cacheExtent;
+	float		inverseCacheExtent;
+	float		padding[ 2 ];
+};
+
+class VirtualTexture {
+public:
+	// Only for files written by TextureBaker, whose width and height are VIRTUAL_TEXTURE_PAGE_EXTENT times a power of two.  The file
+	// stays mapped for as long as the texture lives.  Returns NULL if the file can't be used, or if the device can't write the feedback.
+	static VirtualTexture * Create( const char * filename );
+	static void Destroy( VirtualTexture * texture );
+	// Bind these to two sampler slots of the set the shader reads them from.
+	const Image * GetIndirection() const { return m_indirection; }
+	const Image * GetPageCache() const { return m_pageCache; }
+	// The feedback index changes every frame, so the parameters belong with the per-draw constants.
+	void GetShaderParameters( virtualTextureParameters_t & parameters ) const;
+	uint32_t GetPageCount() const { return m_pageCount; }
+	uint32_t GetResidentPageCount() const { return m_residentPageCount; }
+	// Called by UpdateVirtualTexturing with this frame slot's feedback, of which the texture reads its own range.  Uploads at most
+	// pageBudget pages, and takes off what it used.
+	void Update( uint32_t * feedback, uint32_t & pageBudget );
+
+private:
+	const textureFileHeader_t * m_file = NULL;
+	imageFormat_t m_format = IMAGE_FORMAT_RGBA8;
+	uint32_t m_pagesWide = 0;
+	uint32_t m_pagesHigh = 0;
+	uint32_t m_levelCount = 0;
+	uint32_t m_pageCount = 0;	// Across every level
+	uint32_t m_pageSize = 0;	// Bytes of a page with its border
+	uint32_t m_feedbackBase = 0;
+	uint32_t m_residentPageCount = 0;
+	// Pages are numbered level by level, most detailed first, and row by row within a level, which is also how the indirection
+	// texture's levels are laid out back to back.
+	std::vector< uint32_t > m_levelFirstPages;	// One past the end too
+	std::vector< uint32_t > m_pageSlots;		// Cache slot of every page, or NO_SLOT
+	std::vector< uint32_t > m_slotPages;		// Page in every cache slot, or NO_SLOT
+	std::vector< uint64_t > m_slotLastUsedFrames;
+	std::vector< uint8_t > m_indirectionData;	// RGBA8: slot column, slot row, level of the page in the slot, and 255 once anything is resident
+	Image * m_pageCache = NULL;
+	Image * m_indirection = NULL;
+
+private:
+	static uint32_t AllocateFeedbackRange( uint32_t pageCount );
+	void GetPageLocation( uint32_t page, uint32_t & level, uint32_t & x, uint32_t & y ) const;
+	uint32_t GetParentPage( uint32_t page ) const;
+	void WritePage( uint32_t page, uint8_t * destination ) const;
+	void BuildIndirection();
+
+private:
+	VirtualTexture() = default;
+};
+
+// Create the feedback buffer.  Call after the staging buffer is up.
+void InitializeVirtualTexturing();
+// The buffer to bind at FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_1.  It has a region per frame in flight, so it can stay bound.
+VkBuffer GetVirtualTextureFeedbackBuffer();
+// Read back the feedback of the frame that last used this slot and upload the pages it asked for.  Call after BeginStagingFrame, since
+// the copies are recorded into the staging graphics command buffer.
+void UpdateVirtualTexturing();
\ No newline at end of file
@@ -1,5 +1,7 @@
 #version 450 core
 
+// Built as simpleMesh.fspv, and with STREAMING_FEEDBACK defined as simpleMeshFeedback.fspv.
+
 #include "global.glslh"
 
 layout( set = SCOPE_MESH, binding = MESH_SAMPLER_SLOT_0 ) uniform sampler2D gTexture;
@@ -11,4 +13,7 @@ layout( location = 0 ) out vec4 outColor;
 
 void main() {
 	outColor = inColor * texture( gTexture, inUV0 );
+#ifdef STREAMING_FEEDBACK
+	RecordStreamingFeedback( gTexture, inUV0, gDrawConstants.streamingFeedbackIndex );
+#endif
 }
\ No newline at end of file
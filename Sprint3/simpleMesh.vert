@@ -10,10 +10,6 @@ layout( set = SCOPE_VIEW, binding = VIEW_UNIFORM_BUFFER_SLOT_0 ) uniform ViewDat
 	layout( row_major ) mat4 gView;
 };
 
-layout( set = SCOPE_MESH, binding = MESH_UNIFORM_BUFFER_SLOT_0 ) uniform MeshData {
-	layout( row_major ) mat4 gModel;
-};
-
 layout( location = LOC_POSITION ) in vec3 inPosition;
 layout( location = LOC_UV ) in vec2 inUV0;
 layout( location = LOC_COLOR ) in vec4 inColor;
@@ -23,7 +19,7 @@ layout( location = 1 ) out vec4 outColor;
 
 void main() {
 	vec4 position = vec4( inPosition, 1.0f );
-	position *= gModel * gView * gProjection;
+	position *= gDrawConstants.model * gView * gProjection;
 	gl_Position = position;
 	gl_Position.y *= -1.0f;
 
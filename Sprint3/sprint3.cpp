@@ -6,6 +6,9 @@
 #include "CommandContext.h"
 #include "Buffer.h"
 #include "DescriptorSet.h"
+#include "TextureStreaming.h"
+#include "RenderTargetPool.h"
+#include "VirtualTexture.h"
 #include <math.h>
 
 int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd ) {
@@ -256,9 +259,8 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 	Mesh * tri = Mesh::Create( fullscreenTriVerts, sizeof( fullscreenTriVerts ), fullscreenTriIndices, sizeof( fullscreenTriIndices ), ARRAY_COUNT( fullscreenTriIndices ) );
 	// Cube mesh for perspective draw.
 	Mesh * cube = Mesh::Create( cubeVerts, sizeof( cubeVerts ), cubeIndices, sizeof( cubeIndices ), ARRAY_COUNT( cubeIndices ) );
-	// Matching shaders for above meshes.
+	// Matching shaders for above meshes.  The cube's comes after its texture, below.
 	ShaderProgram * triShader = ShaderProgram::Create( "simpleTri" );
-	ShaderProgram * meshShader = ShaderProgram::Create( "simpleMesh" );
 
 	// To test uniform buffers, we make MVP matrices and bind them to different descriptor scopes.
 	float nearZ = 0.2f;
@@ -280,44 +282,58 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 		0.0f, 0.0f, 0.0f, 1.0f
 	};
 
-	Matrix44 model = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		1.5f, 0.0f, 3.0f, 1.0f
-	};
-
-	// The objects to hold the data.
+	// The objects to hold the data.  The model matrices change every draw, so they're pushed as draw constants instead.
+	const uint32_t cubeCount = 2;
 	Buffer * projectionBuffer = Buffer::Create( &projection, sizeof( projection ), BUFFER_USAGE_UNIFORM_BUFFER );
 	Buffer * viewBuffer = Buffer::Create( &view, sizeof( view ), BUFFER_USAGE_UNIFORM_BUFFER );
-	Buffer * modelBuffer = Buffer::Create( &model, sizeof( model ), BUFFER_USAGE_UNIFORM_BUFFER );
 
-	// The descriptor sets that bind the resources to slots in the shaders.
+	// The descriptor sets that bind the resources to slots in the shaders.  Nothing in the mesh set changes between the cubes, so it's
+	// bound once for all of them.
 	DescriptorSet * frameSet = DescriptorSet::Allocate( DESCRIPTOR_SCOPE_FRAME );
 	DescriptorSet * viewSet = DescriptorSet::Allocate( DESCRIPTOR_SCOPE_VIEW );
 	DescriptorSet * meshSet = DescriptorSet::Allocate( DESCRIPTOR_SCOPE_MESH );
 
 	// Setting the resources on the sets as an initialization step.
 	frameSet->SetUniformBuffer( FRAME_DESCRIPTOR_UNIFORM_BUFFER_SLOT_0, projectionBuffer );
+	frameSet->SetStorageBuffer( FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_0, GetStreamingFeedbackBuffer() );
+	frameSet->SetStorageBuffer( FRAME_DESCRIPTOR_STORAGE_BUFFER_SLOT_1, GetVirtualTextureFeedbackBuffer() );
 	viewSet->SetUniformBuffer( VIEW_DESCRIPTOR_UNIFORM_BUFFER_SLOT_0, viewBuffer );
-	meshSet->SetUniformBuffer( MESH_DESCRIPTOR_UNIFORM_BUFFER_SLOT_0, modelBuffer );
 
-	// Sampled image to test texture descriptor and staging pipeline.
-	Image * vulkanImage = Image::CreateFromFile( "vulkanLogo.jpg" );
-	meshSet->SetImageSampler( MESH_DESCRIPTOR_SAMPLER_SLOT_0, SAMPLER_TYPE_LINEAR, vulkanImage );
+	// Sampled image to test texture descriptor and streaming.  Only its smallest levels are loaded up front, and the rest stream in as
+	// the cube's fragment shader asks for them.  Devices that can't sample the baked BC1 file load the JPEG asynchronously instead, so
+	// the cube is grey for the first few frames.  Trilinear with anisotropy, so the faces stay sharp at glancing angles.  Clamped to
+	// what the device supports.
+	Image * vulkanImage = Image::CreateStreamed( "vulkanLogo.ktex" );
+	if ( vulkanImage == NULL ) {
+		vulkanImage = Image::CreateFromFileAsync( "vulkanLogo.jpg" );
+	}
+	// Recording feedback needs fragment shaders that write storage buffers.  Without them, the streamed levels are asked for from
+	// the CPU instead.
+	const bool streamingFeedback = vulkanImage->IsStreamed() == true && renderObjects.fragmentStoresSupported == true;
+	ShaderProgram * meshShader = ShaderProgram::Create( "simpleMesh", streamingFeedback == true ? "simpleMeshFeedback" : "simpleMesh" );
+	samplerDescription_t anisotropicDescription = MakeSamplerDescription( SAMPLER_FILTER_LINEAR, SAMPLER_FILTER_LINEAR, SAMPLER_ADDRESS_REPEAT );
+	anisotropicDescription.maxAnisotropy = 8.0f;
+	const samplerHandle_t anisotropicSampler = GetSampler( anisotropicDescription );
+	meshSet->SetImageSampler( MESH_DESCRIPTOR_SAMPLER_SLOT_0, anisotropicSampler, vulkanImage );
 
 	// Sampled attachment to test mid-frame layout transition.
 	DescriptorSet * triSet = DescriptorSet::Allocate( DESCRIPTOR_SCOPE_MESH );
-	triSet->SetImageSampler( MESH_DESCRIPTOR_SAMPLER_SLOT_0, SAMPLER_TYPE_LINEAR, renderObjects.colorImage );
+	// The attachment has a single level, so the sampler stays on the base level.
+	samplerDescription_t linearDescription = MakeSamplerDescription( SAMPLER_FILTER_LINEAR, SAMPLER_FILTER_NEAREST, SAMPLER_ADDRESS_REPEAT );
+	linearDescription.maxLod = 0.0f;
+	triSet->SetImageSampler( MESH_DESCRIPTOR_SAMPLER_SLOT_0, GetSampler( linearDescription ), renderObjects.colorImage );
 
-	while ( true ) {
-		// Local pointer variables to make writing the render loop more succinct.
+	while ( Renderer_QuitRequested() == false ) {
+		Renderer_BeginFrame();
+
+		// Local pointer variables to make writing the render loop more succinct.  The context changes per frame in flight, so grab it after beginning the frame.
 		CommandContext * context = renderObjects.commandContext;
 		Image * colorImage = renderObjects.colorImage;
-		Image * depthImage = renderObjects.depthImage;
+		// Depth is discarded at the start of every frame and never read after the scene pass, so it doesn't have to be stored, and
+		// it goes back to the pool as soon as the pass is recorded.
+		Image * depthImage = AcquireRenderTarget( colorImage->GetWidth(), colorImage->GetHeight(), IMAGE_FORMAT_DEPTH, IMAGE_USAGE_RENDER_TARGET | IMAGE_USAGE_TRANSIENT );
 		Image * swapchainImage = renderObjects.swapchainImage;
 
-		Renderer_BeginFrame();
 		// We bind descriptor sets at different frequencies based on scope.  In a single-view scene, frame and view
 		// sets have to be bound exactly once per context.
 		context->PipelineBarrier( colorImage, IMAGE_LAYOUT_COLOR_ATTACHMENT, BARRIER_DISCARD_AND_IGNORE_OLD_LAYOUT );
@@ -328,7 +344,28 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 		context->Clear( true, true, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f );
 		context->SetViewportAndScissor( colorImage->GetWidth(), colorImage->GetHeight() );
 		context->BindDescriptorSet( meshSet );
-		context->Draw( cube, meshShader );
+		if ( vulkanImage->IsStreamed() == true && streamingFeedback == false ) {
+			RequestStreamingLevel( vulkanImage, 0 );
+		}
+		// Spin the cubes around the y axis, in opposite directions, to test per-draw constants.
+		for ( uint32_t i = 0; i < cubeCount; ++i ) {
+			const float angle = ( float )renderObjects.frameNumber * ( i == 0 ? 0.01f : -0.01f );
+			const float c = cosf( angle );
+			const float s = sinf( angle );
+			drawConstants_t constants = {
+				{
+					c, 0.0f, -s, 0.0f,
+					0.0f, 1.0f, 0.0f, 0.0f,
+					s, 0.0f, c, 0.0f,
+					i == 0 ? 1.5f : -1.5f, 0.0f, 3.0f, 1.0f
+				},
+				i,
+				streamingFeedback == true ? GetStreamingFeedbackIndex( vulkanImage ) : 0,
+			};
+			context->SetDrawConstants( constants );
+			context->Draw( cube, meshShader );
+		}
+		ReleaseRenderTarget( depthImage );
 		Renderer_AcquireSwapchainImage();
 		// Transition the color image to a readable state and swapchain image to writable.
 		context->PipelineBarrier( colorImage, IMAGE_LAYOUT_FRAGMENT_SHADER_READ, BARRIER_NONE );
@@ -341,4 +378,6 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 		context->PipelineBarrier( swapchainImage, IMAGE_LAYOUT_PRESENT, BARRIER_NONE );
 		Renderer_EndFrame();
 	}
+	Renderer_Shutdown();
+	return 0;
 }
\ No newline at end of file
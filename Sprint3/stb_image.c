@@ -416,6 +416,15 @@ extern "C" {
 	// free the loaded image -- this is just free()
 	STBIDEF void     stbi_image_free( void *retval_from_stbi_load );
 
+#ifndef STBI_NO_JPEG
+	// Decode a JPEG into memory the caller provides.  Once the image has decoded, get_output is called with its size and returns
+	// where the texels go, with rows *stride bytes apart, or NULL to give up.  Each texel is then written once, front to back.
+	// req_comp must be 1, 2 or 4, and vertical flipping isn't applied.  Returns 0 if the data isn't a JPEG, it can't be decoded, or
+	// get_output gave up, and in every one of those cases nothing has been written.  Not part of upstream stb_image.
+	typedef stbi_uc *stbi_output_func( void *user, int x, int y, int *stride );
+	STBIDEF int      stbi_jpeg_load_into_from_memory( stbi_uc const *buffer, int len, int req_comp, stbi_output_func *get_output, void *user );
+#endif
+
 	// get image dimensions & components without fully decoding
 	STBIDEF int      stbi_info_from_memory( stbi_uc const *buffer, int len, int *x, int *y, int *comp );
 	STBIDEF int      stbi_info_from_callbacks( stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp );
@@ -3502,8 +3511,8 @@ static stbi_uc stbi__blinn_8x8( stbi_uc x, stbi_uc y ) {
 	return ( stbi_uc )( ( t + ( t >> 8 ) ) >> 8 );
 }
 
-static stbi_uc *load_jpeg_image( stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp ) {
-	int n, decode_n, is_rgb;
+static stbi_uc *load_jpeg_image( stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, stbi_output_func *get_output, void *user ) {
+	int n, decode_n, is_rgb, stride;
 	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
 					 // validate req_comp
@@ -3554,12 +3563,18 @@ static stbi_uc *load_jpeg_image( stbi__jpeg *z, int *out_x, int *out_y, int *com
 		}
 
 		// can't error after this so, this is safe
-		output = ( stbi_uc * )stbi__malloc_mad3( n, z->s->img_x, z->s->img_y, 1 );
-		if ( !output ) { stbi__cleanup_jpeg( z ); return stbi__errpuc( "outofmem", "Out of memory" ); }
+		if ( get_output ) {
+			output = get_output( user, z->s->img_x, z->s->img_y, &stride );
+			if ( !output ) { stbi__cleanup_jpeg( z ); return stbi__errpuc( "nooutput", "Caller gave up" ); }
+		} else {
+			stride = n * z->s->img_x;
+			output = ( stbi_uc * )stbi__malloc_mad3( n, z->s->img_x, z->s->img_y, 1 );
+			if ( !output ) { stbi__cleanup_jpeg( z ); return stbi__errpuc( "outofmem", "Out of memory" ); }
+		}
 
 		// now go ahead and resample
 		for ( j = 0; j < z->s->img_y; ++j ) {
-			stbi_uc *out = output + n * z->s->img_x * j;
+			stbi_uc *out = output + stride * j;
 			for ( k = 0; k < decode_n; ++k ) {
 				stbi__resample *r = &res_comp[ k ];
 				int y_bot = r->ystep >= ( r->vs >> 1 );
@@ -3666,11 +3681,29 @@ static void *stbi__jpeg_load( stbi__context *s, int *x, int *y, int *comp, int r
 	STBI_NOTUSED( ri );
 	j->s = s;
 	stbi__setup_jpeg( j );
-	result = load_jpeg_image( j, x, y, comp, req_comp );
+	result = load_jpeg_image( j, x, y, comp, req_comp, NULL, NULL );
 	STBI_FREE( j );
 	return result;
 }
 
+STBIDEF int stbi_jpeg_load_into_from_memory( stbi_uc const *buffer, int len, int req_comp, stbi_output_func *get_output, void *user ) {
+	stbi__context s;
+	stbi__jpeg* j;
+	stbi_uc *result;
+	int x, y, comp;
+	// three components also write a throwaway fourth byte after each texel, which would land past the caller's memory
+	if ( req_comp != 1 && req_comp != 2 && req_comp != 4 ) return stbi__err( "bad req_comp", "Internal error" );
+	stbi__start_mem( &s, buffer, len );
+	if ( !stbi__jpeg_test( &s ) ) return stbi__err( "not jpeg", "Image not of a known type" );
+	j = ( stbi__jpeg* )stbi__malloc( sizeof( stbi__jpeg ) );
+	if ( !j ) return stbi__err( "outofmem", "Out of memory" );
+	j->s = &s;
+	stbi__setup_jpeg( j );
+	result = load_jpeg_image( j, &x, &y, &comp, req_comp, get_output, user );
+	STBI_FREE( j );
+	return result != NULL;
+}
+
 static int stbi__jpeg_test( stbi__context *s ) {
 	int r;
 	stbi__jpeg* j = ( stbi__jpeg* )stbi__malloc( sizeof( stbi__jpeg ) );